@@ -0,0 +1,2250 @@
+#include "threadpool.hh"
+#include "tracer.hh"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdarg>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <deque>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sched.h>
+#include <unistd.h>
+
+/**
+ * 线程池基准测试
+ *
+ * 用法: ./bench/bench [场景名|all] [线程数] [--csv 文件] [--json 文件]
+ *
+ * 屏幕上是给人看的表格；--csv / --json 把同样的结果（每个 report 一条，附带它下面那几行的指标）
+ * 写成机器可读的文件，用来对比不同的构建。随机数用固定的种子，只依赖 Linux 本身
+ */
+
+using Clock = std::chrono::steady_clock;
+
+// 统计整个进程调用 operator new 的次数（alloc 场景用），数组版本默认转发到这里
+// 替换之后 new/delete 就是 malloc/free，内联之后 gcc 会误报不匹配
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+static std::atomic_long new_calls(0);
+
+void* operator new(std::size_t size) {
+    new_calls.fetch_add(1, std::memory_order_relaxed);
+    if (void* p = std::malloc(size == 0 ? 1 : size))
+        return p;
+    throw std::bad_alloc();
+}
+
+void operator delete(void* p) noexcept { std::free(p); }
+void operator delete(void* p, std::size_t) noexcept { std::free(p); }
+
+static double seconds_since(Clock::time_point start) {
+    return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+// 检查失败：打印出来，并让进程最后返回 1（脚本和 CI 靠退出码发现回归）
+static long failures = 0;
+
+__attribute__((format(printf, 1, 2)))
+static void fail(const char* fmt, ...) {
+    va_list args;
+    va_start(args, fmt);
+    vprintf(fmt, args);
+    va_end(args);
+    failures++;
+}
+
+/*** 结果 ******************************************/
+
+// 一次 report 一条；metric() 给最近的一条加指标
+struct Record {
+    std::string scenario;
+    std::string variant;
+    int threads;
+    long tasks;
+    double secs;
+    std::vector<std::pair<std::string, double>> metrics;
+};
+
+static std::vector<Record> records;
+
+static void report(const char* scenario, const char* variant,
+                   int threads, long tasks, double secs) {
+    printf("%-10s %-18s threads=%-3d tasks=%-9ld %10.2f ms %12.0f tasks/s\n",
+           scenario, variant, threads, tasks, secs * 1e3, tasks / secs);
+    records.push_back({scenario, variant, threads, tasks, secs, {}});
+}
+
+static void metric(const char* name, double value) {
+    if (!records.empty())
+        records.back().metrics.emplace_back(name, value);
+}
+
+// 长格式：一行一个指标，不同场景的指标不一样也能放进同一张表
+static void write_csv(const char* path) {
+    FILE* fp = fopen(path, "w");
+    if (fp == nullptr) {
+        fprintf(stderr, "cannot write %s\n", path);
+        return;
+    }
+    fprintf(fp, "scenario,variant,threads,metric,value\n");
+    for (const Record& r : records) {
+        auto row = [&](const std::string& name, double value) {
+            fprintf(fp, "%s,\"%s\",%d,%s,%.6g\n", r.scenario.c_str(), r.variant.c_str(), r.threads,
+                    name.c_str(), value);
+        };
+        row("tasks", r.tasks);
+        row("ms", r.secs * 1e3);
+        row("tasks_per_s", r.tasks / r.secs);
+        for (auto& [name, value] : r.metrics)
+            row(name, value);
+    }
+    fclose(fp);
+}
+
+// Makefile 传进来的 git 版本
+#ifndef BENCH_REVISION
+#define BENCH_REVISION "unknown"
+#endif
+
+static void write_json(const char* path, const char* which, int threads) {
+#ifdef THREADPOOL_TRACE
+    const char* traced = "true";
+#else
+    const char* traced = "false";
+#endif
+    FILE* fp = fopen(path, "w");
+    if (fp == nullptr) {
+        fprintf(stderr, "cannot write %s\n", path);
+        return;
+    }
+    char host[256] = "";
+    gethostname(host, sizeof(host) - 1);
+    char date[32];
+    time_t now = time(nullptr);
+    strftime(date, sizeof(date), "%Y-%m-%dT%H:%M:%SZ", gmtime(&now));
+
+    fprintf(fp, "{\n  \"meta\": {\"revision\": \"%s\", \"compiler\": \"%s\", \"date\": \"%s\", "
+                "\"host\": \"%s\", \"cpus\": %u, \"scenario\": \"%s\", \"threads\": %d, \"trace\": %s},\n",
+            BENCH_REVISION, __VERSION__, date, host, std::thread::hardware_concurrency(), which, threads,
+            traced);
+    fprintf(fp, "  \"results\": [");
+    for (std::size_t i = 0; i < records.size(); i++) {
+        const Record& r = records[i];
+        fprintf(fp, "%s\n    {\"scenario\": \"%s\", \"variant\": \"%s\", \"threads\": %d, \"tasks\": %ld, "
+                    "\"ms\": %.6g, \"tasks_per_s\": %.6g, \"metrics\": {",
+                i == 0 ? "" : ",", r.scenario.c_str(), r.variant.c_str(), r.threads, r.tasks,
+                r.secs * 1e3, r.tasks / r.secs);
+        for (std::size_t j = 0; j < r.metrics.size(); j++)
+            fprintf(fp, "%s\"%s\": %.6g", j == 0 ? "" : ", ", r.metrics[j].first.c_str(), r.metrics[j].second);
+        fprintf(fp, "}}");
+    }
+    fprintf(fp, "\n  ]\n}\n");
+    fclose(fp);
+}
+
+static const char* mode_name(PoolMode mode) {
+    switch (mode) {
+    case PoolMode::MODE_FIXED:  return "MODE_FIXED";
+    case PoolMode::MODE_CACHED: return "MODE_CACHED";
+    case PoolMode::MODE_STEAL:  return "MODE_STEAL";
+    }
+    return "?";
+}
+
+// 打印 ThreadPool::stats() 快照
+static void print_stats(const PoolStats& ps) {
+    printf("  threads=%u idle=%u pending=%u\n", ps.threads, ps.idle_threads, ps.pending_tasks);
+    printf("  %-8s %10s %8s %10s %10s %6s\n", "worker", "tasks", "steals", "busy ms", "idle ms", "util");
+    auto row = [](const char* name, const WorkerStatsSnapshot& w) {
+        printf("  %-8s %10llu %8llu %10.1f %10.1f %5.1f%%\n", name,
+               (unsigned long long)w.tasks_executed, (unsigned long long)w.steals,
+               w.busy_ns / 1e6, w.idle_ns / 1e6, w.utilization() * 100);
+    };
+    for (const auto& w : ps.workers)
+        row(std::to_string(w.thread_id).c_str(), w);
+    row("retired", ps.retired);
+    row("total", ps.total());
+
+    for (auto [name, h] : {std::make_pair("queue", &ps.queue_latency), std::make_pair("run", &ps.run_time)})
+        printf("  %-6s latency  n=%llu mean=%.0fns p50=%lluns p99=%lluns p999=%lluns\n", name,
+               (unsigned long long)h->count(), h->mean(), (unsigned long long)h->percentile(50),
+               (unsigned long long)h->percentile(99), (unsigned long long)h->percentile(99.9));
+}
+
+// 忙等 ns 纳秒，模拟一小段计算
+static void spin_for(long ns) {
+    auto end = Clock::now() + std::chrono::nanoseconds(ns);
+    while (Clock::now() < end) {}
+}
+
+/*** 任务类型 ******************************************/
+
+// 几乎不做事的任务，用来衡量调度本身的开销
+class EmptyTask : public Task {
+public:
+    Any run() { return 0; }
+};
+
+// 在线程池内部继续提交子任务（fork 风格），MODE_STEAL下子任务进入本地队列
+class FanoutTask : public Task {
+public:
+    FanoutTask(ThreadPool* pool, int children) : pool_(pool), children_(children) {}
+
+    Any run() {
+        for (int i = 0; i < children_; i++)
+            results_.emplace_back(pool_->submitTask(std::make_shared<EmptyTask>()));
+        return 0;
+    }
+
+    // 父任务 get() 返回之后才能调用
+    void wait_children() {
+        for (auto& res : results_)
+            res.get();
+    }
+
+private:
+    ThreadPool* pool_;
+    int children_;
+    std::vector<Result> results_;
+};
+
+// 递归的斐波那契：子问题交给线程池，自己算另一半，再 get() 子任务的结果（老接口）
+class FibTask : public Task {
+public:
+    FibTask(ThreadPool* pool, int n) : pool_(pool), n_(n) {}
+
+    Any run();
+
+private:
+    ThreadPool* pool_;
+    int n_;
+};
+
+/*** 场景 ******************************************/
+
+// 外部线程提交 n 个空任务并等待全部完成
+static double run_external(PoolMode mode, int threads, long n) {
+    ThreadPool pool;
+    pool.setMode(mode);
+    pool.start(threads);
+
+    std::vector<Result> results;
+    results.reserve(n);
+
+    auto start = Clock::now();
+    for (long i = 0; i < n; i++)
+        results.emplace_back(pool.submitTask(std::make_shared<EmptyTask>()));
+    for (auto& res : results)
+        res.get();
+    return seconds_since(start);
+}
+
+// 外部提交 roots 个父任务，每个父任务在线程池内部再提交 children 个子任务
+static double run_fanout(PoolMode mode, int threads, long roots, int children) {
+    ThreadPool pool;
+    pool.setMode(mode);
+    // 线程池内部提交时不能因为队列满而阻塞，否则所有线程都在等自己
+    pool.setTaskqueMaxThreshHold(roots * (children + 1));
+    pool.start(threads);
+
+    std::vector<std::shared_ptr<FanoutTask>> tasks;
+    std::vector<Result> results;
+
+    auto start = Clock::now();
+    for (long i = 0; i < roots; i++) {
+        tasks.emplace_back(std::make_shared<FanoutTask>(&pool, children));
+        results.emplace_back(pool.submitTask(tasks.back()));
+    }
+    for (long i = 0; i < roots; i++) {
+        results[i].get();
+        tasks[i]->wait_children();
+    }
+    return seconds_since(start);
+}
+
+// MODE_STEAL 和 MODE_FIXED 的吞吐对比
+static void bench_steal(int threads) {
+    const long n = 200000;
+    const long roots = 1000;
+    const int children = 200;
+
+    for (PoolMode mode : {PoolMode::MODE_FIXED, PoolMode::MODE_STEAL}) {
+        report("external", mode_name(mode), threads, n, run_external(mode, threads, n));
+        report("fanout", mode_name(mode), threads, roots * (children + 1),
+               run_fanout(mode, threads, roots, children));
+    }
+}
+
+// 老的 Task/Any/Result 路径 和 类型化 submit/Future 路径的对比
+static void bench_future(int threads) {
+    const long n = 200000;
+
+    {
+        ThreadPool pool;
+        pool.start(threads);
+        std::vector<Result> results;
+        results.reserve(n);
+
+        auto start = Clock::now();
+        for (long i = 0; i < n; i++)
+            results.emplace_back(pool.submitTask(std::make_shared<EmptyTask>()));
+        unsigned long long sum = 0;
+        for (auto& res : results)
+            sum += res.get().cast_<int>();
+        report("result", "submitTask", threads, n, seconds_since(start));
+    }
+
+    {
+        ThreadPool pool;
+        pool.start(threads);
+        std::vector<Future<long>> futures;
+        futures.reserve(n);
+
+        auto start = Clock::now();
+        for (long i = 0; i < n; i++)
+            futures.emplace_back(pool.submit([](long x) { return x; }, i));
+        unsigned long long sum = 0;
+        for (auto& fut : futures)
+            sum += fut.get();
+        report("result", "submit", threads, n, seconds_since(start));
+    }
+}
+
+// 多个生产者同时提交空任务：submit 队列满时阻塞等待，try_submit 队列满时直接拒绝
+static void bench_producer(int threads) {
+    const long n = 400000;
+
+    for (int producers : {1, 4, 16}) {
+        for (bool blocking : {true, false}) {
+            std::atomic_long executed(0);
+            std::atomic_long rejected(0);
+            double secs;
+            {
+                ThreadPool pool;
+                pool.setTaskqueMaxThreshHold(4096);
+                pool.start(threads);
+
+                auto start = Clock::now();
+                std::vector<std::thread> ths;
+                for (int p = 0; p < producers; p++) {
+                    ths.emplace_back([&]() {
+                        for (long i = 0; i < n / producers; i++) {
+                            auto task = [&executed]() { executed.fetch_add(1, std::memory_order_relaxed); };
+                            if (blocking)
+                                pool.submit(task);
+                            else if (pool.try_submit(task).first != SubmitStatus::OK)
+                                rejected.fetch_add(1, std::memory_order_relaxed);
+                        }
+                    });
+                }
+                for (auto& t : ths)
+                    t.join();
+                secs = seconds_since(start);
+            }   // 析构时等待所有任务执行完
+
+            char variant[32];
+            snprintf(variant, sizeof(variant), "%s/p=%d", blocking ? "submit" : "try_submit", producers);
+            report("producer", variant, threads, n / producers * producers, secs);
+            if (!blocking) {
+                printf("%-10s %-18s rejected=%ld executed=%ld\n", "", "", rejected.load(), executed.load());
+                metric("rejected", rejected.load());
+            }
+        }
+    }
+}
+
+// 追踪的开销：运行期关闭/打开各跑一遍，打开时把事件写到 trace.json（需要 make TRACE=1）
+static void bench_trace(int threads) {
+    const long n = 200000;
+
+    for (bool on : {false, true}) {
+        Tracer::enable(on);
+        Tracer::clear();
+        report("trace", on ? "enabled" : "disabled", threads, n,
+               run_external(PoolMode::MODE_FIXED, threads, n));
+    }
+    Tracer::enable(false);
+
+#ifdef THREADPOOL_TRACE
+    if (Tracer::dump_chrome_json("trace.json"))
+        printf("%-10s %-18s events written to trace.json\n", "trace", "");
+#else
+    printf("%-10s %-18s built without THREADPOOL_TRACE, nothing recorded\n", "trace", "");
+#endif
+
+    // 输出到调用者的流：调用者设的进制、填充字符原样还给它
+    std::ostringstream os;
+    os << std::hex << std::setfill('*');
+    Tracer::dump_chrome_json(os);
+    os << std::setw(4) << 255;
+    std::string out = os.str();
+    if (out.compare(out.size() - 4, 4, "**ff") != 0)
+        fail("trace: dump_chrome_json changed the caller's stream format (ends with \"%s\")\n",
+             out.substr(out.size() - 4).c_str());
+}
+
+// stats() 快照：每个线程的计数器，排队延迟和执行时间的分布
+static void bench_stats(int threads) {
+    const long n = 100000;
+
+    for (PoolMode mode : {PoolMode::MODE_FIXED, PoolMode::MODE_STEAL}) {
+        ThreadPool pool;
+        pool.setMode(mode);
+        pool.start(threads);
+
+        std::vector<Future<void>> futures;
+        futures.reserve(n);
+        auto start = Clock::now();
+        for (long i = 0; i < n; i++)
+            futures.emplace_back(pool.submit(spin_for, 2000));
+        for (auto& fut : futures)
+            fut.get();
+        report("stats", mode_name(mode), threads, n, seconds_since(start));
+        print_stats(pool.stats());
+    }
+}
+
+// 批量提交 和 逐个 submit 的对比
+struct Identity {
+    long i;
+    long operator()() const { return i; }
+};
+
+static void bench_batch(int threads) {
+    for (long n : {1000L, 10000L, 100000L, 1000000L}) {
+        std::vector<Identity> tasks;
+        tasks.reserve(n);
+        for (long i = 0; i < n; i++)
+            tasks.push_back({i});
+
+        char variant[32];
+        {
+            ThreadPool pool;
+            pool.setTaskqueMaxThreshHold(1 << 20);
+            pool.start(threads);
+
+            std::vector<Future<long>> futures;
+            futures.reserve(n);
+            auto start = Clock::now();
+            for (const auto& t : tasks)
+                futures.emplace_back(pool.submit(t));
+            for (auto& fut : futures)
+                fut.get();
+            snprintf(variant, sizeof(variant), "submit/%ld", n);
+            report("batch", variant, threads, n, seconds_since(start));
+        }
+        {
+            ThreadPool pool;
+            pool.setTaskqueMaxThreshHold(1 << 20);
+            pool.start(threads);
+
+            auto start = Clock::now();
+            Batch<long> batch = pool.submitBatch(tasks.begin(), tasks.end());
+            batch.wait_all();
+            snprintf(variant, sizeof(variant), "submitBatch/%ld", n);
+            report("batch", variant, threads, n, seconds_since(start));
+
+            // 顺便检查结果和提交的一致
+            long sum = 0;
+            for (long v : batch.get_all())
+                sum += v;
+            if (sum != n * (n - 1) / 2)
+                fail("batch: wrong sum %ld\n", sum);
+        }
+    }
+}
+
+// test.cc 里的写法：手工把 [1, n] 切成 threads 段，每段一个 Task，结果通过 Any 取回
+using uLong = unsigned long long;
+
+class RangeSumTask : public Task {
+public:
+    RangeSumTask(uLong begin, uLong end) : begin_(begin), end_(end) {}
+
+    Any run() {
+        uLong sum = 0;
+        for (uLong i = begin_; i <= end_; i++)
+            sum += i;
+        return sum;
+    }
+
+private:
+    uLong begin_, end_;
+};
+
+// parallel_reduce/parallel_for 和 手工切分提交 的对比，顺便检查结果
+static void bench_parallel(int threads) {
+    const uLong n = 200000000ULL;
+    const uLong expect = n * (n + 1) / 2;
+
+    for (PoolMode mode : {PoolMode::MODE_FIXED, PoolMode::MODE_STEAL}) {
+        ThreadPool pool;
+        pool.setMode(mode);
+        pool.start(threads);
+        char variant[32];
+
+        {
+            auto start = Clock::now();
+            std::vector<Result> results;
+            uLong step = n / threads;
+            for (int t = 0; t < threads; t++) {
+                uLong lo = t * step + 1;
+                uLong hi = t == threads - 1 ? n : lo + step - 1;
+                results.emplace_back(pool.submitTask(std::make_shared<RangeSumTask>(lo, hi)));
+            }
+            uLong sum = 0;
+            for (auto& res : results)
+                sum += res.get().cast_<uLong>();
+            snprintf(variant, sizeof(variant), "manual/%s", mode_name(mode) + 5);
+            report("reduce", variant, threads, static_cast<long>(n), seconds_since(start));
+            if (sum != expect)
+                fail("reduce: wrong sum %llu\n", sum);
+        }
+        {
+            auto start = Clock::now();
+            uLong sum = pool.parallel_reduce(uLong(1), n + 1, uLong(0),
+                                             [](uLong i) { return i; }, std::plus<uLong>());
+            snprintf(variant, sizeof(variant), "parallel/%s", mode_name(mode) + 5);
+            report("reduce", variant, threads, static_cast<long>(n), seconds_since(start));
+            if (sum != expect)
+                fail("reduce: wrong sum %llu\n", sum);
+        }
+        {
+            // 不均匀的负载：越往后的元素越重，固定切分会让最后一段拖尾
+            const long m = 20000;
+            std::vector<long> out(m, 0);
+            auto start = Clock::now();
+            pool.parallel_for(0L, m, [&out](long i) {
+                spin_for(i / 10);
+                out[i] = i;
+            });
+            snprintf(variant, sizeof(variant), "for/%s", mode_name(mode) + 5);
+            report("parallel", variant, threads, m, seconds_since(start));
+            for (long i = 0; i < m; i++) {
+                if (out[i] != i) {
+                    fail("parallel: parallel_for index %ld not visited\n", i);
+                    break;
+                }
+            }
+        }
+        {
+            // 在线程池的任务里嵌套调用，调用的线程边等边帮忙执行，不会死锁
+            auto start = Clock::now();
+            auto fut = pool.submit([&pool]() {
+                return pool.parallel_reduce(0L, 1000L, 0L, [&pool](long i) {
+                    return pool.parallel_reduce(0L, 1000L, 0L, [i](long j) { return i ^ j; },
+                                                std::plus<long>());
+                }, std::plus<long>());
+            });
+            long sum = fut.get();
+            snprintf(variant, sizeof(variant), "nested/%s", mode_name(mode) + 5);
+            report("parallel", variant, threads, 1000000, seconds_since(start));
+            long expect_nested = 0;
+            for (long i = 0; i < 1000; i++)
+                for (long j = 0; j < 1000; j++)
+                    expect_nested += i ^ j;
+            if (sum != expect_nested)
+                fail("nested: wrong sum %ld\n", sum);
+        }
+        print_stats(pool.stats());
+    }
+}
+
+// 整个进程（所有线程）的上下文切换次数，自愿 + 非自愿
+static long context_switches() {
+    struct rusage ru;
+    getrusage(RUSAGE_SELF, &ru);
+    return ru.ru_nvcsw + ru.ru_nivcsw;
+}
+
+// 空闲线程的唤醒：任务一个一个稀疏地到来（trickle）或者成批到来（burst）
+// spin=0 时空闲线程直接睡眠，对比自旋一会儿再睡眠的 上下文切换次数 和 派发延迟
+static void bench_wakeup(int threads) {
+    const long n = 20000;
+
+    for (int nthreads : {threads, 64}) {
+        for (int spin : {0, 2000}) {
+            for (bool burst : {false, true}) {
+                ThreadPool pool;
+                pool.setSpinCount(spin);
+                pool.start(nthreads);
+                std::this_thread::sleep_for(std::chrono::milliseconds(10));   // 让线程都睡下
+
+                long csw = context_switches();
+                auto start = Clock::now();
+                if (!burst) {
+                    for (long i = 0; i < n; i++) {
+                        pool.submit([]() {});
+                        spin_for(20000);
+                    }
+                } else {
+                    for (long i = 0; i < n; i += 64) {
+                        std::vector<Future<void>> futures;
+                        for (long j = 0; j < 64; j++)
+                            futures.emplace_back(pool.submit(spin_for, 1000));
+                        for (auto& fut : futures)
+                            fut.get();
+                    }
+                }
+                double secs = seconds_since(start);
+                csw = context_switches() - csw;
+
+                PoolStats ps = pool.stats();
+                char variant[32];
+                snprintf(variant, sizeof(variant), "%s/spin=%d", burst ? "burst" : "trickle", spin);
+                report("wakeup", variant, nthreads, n, secs);
+                printf("%-10s %-18s csw=%ld (%.2f/task) dispatch p50=%lluns p99=%lluns\n", "", "",
+                       csw, static_cast<double>(csw) / n,
+                       (unsigned long long)ps.queue_latency.percentile(50),
+                       (unsigned long long)ps.queue_latency.percentile(99));
+                metric("csw_per_task", static_cast<double>(csw) / n);
+                metric("dispatch_p50_ns", ps.queue_latency.percentile(50));
+                metric("dispatch_p99_ns", ps.queue_latency.percentile(99));
+            }
+        }
+    }
+}
+
+// 在 latencies 里取第 p 百分位
+static long percentile_of(std::vector<long> latencies, double p) {
+    if (latencies.empty()) return 0;
+    std::sort(latencies.begin(), latencies.end());
+    return latencies[static_cast<std::size_t>(p / 100.0 * (latencies.size() - 1))];
+}
+
+// 低优先级的任务把线程池压满，同时每 1ms 提交一个高优先级的探测任务，统计它的排队延迟
+static void bench_priority(int threads) {
+    const int probes = 500;
+
+    for (bool prio : {false, true}) {
+        ThreadPool pool;
+        pool.setTaskqueMaxThreshHold(4096);
+        if (prio) pool.setPriorityLevels(3);
+        pool.start(threads);
+
+        std::atomic_bool stop(false);
+        std::atomic_long bulk_done(0);
+        std::thread flood([&]() {
+            while (!stop) {
+                pool.submit_priority(2, [&bulk_done]() {
+                    spin_for(20000);
+                    bulk_done.fetch_add(1, std::memory_order_relaxed);
+                });
+            }
+        });
+
+        std::vector<long> latencies(probes);
+        std::vector<Future<void>> futures;
+        auto start = Clock::now();
+        for (int i = 0; i < probes; i++) {
+            auto submitted = Clock::now();
+            futures.emplace_back(pool.submit_priority(0, [&latencies, i, submitted]() {
+                latencies[i] = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                    Clock::now() - submitted).count();
+            }));
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        for (auto& fut : futures)
+            fut.get();
+        double secs = seconds_since(start);
+        stop = true;
+        flood.join();
+
+        report("priority", prio ? "levels=3" : "levels=1", threads, probes, secs);
+        printf("%-10s %-18s high p50=%ldus p99=%ldus  bulk done=%ld\n", "", "",
+               percentile_of(latencies, 50) / 1000, percentile_of(latencies, 99) / 1000,
+               bulk_done.load());
+        metric("high_p50_us", percentile_of(latencies, 50) / 1000);
+        metric("high_p99_us", percentile_of(latencies, 99) / 1000);
+    }
+
+    // 反过来：高优先级一直压满，低优先级的任务也要能执行完（不会饿死）
+    {
+        ThreadPool pool;
+        pool.setTaskqueMaxThreshHold(4096);
+        pool.setPriorityLevels(3);
+        pool.start(threads);
+
+        std::atomic_bool stop(false);
+        std::thread flood([&]() {
+            while (!stop)
+                pool.submit_priority(0, spin_for, 20000);
+        });
+
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));   // 等队列压满
+
+        const int low = 100;
+        std::vector<Future<void>> futures;
+        auto start = Clock::now();
+        for (int i = 0; i < low; i++)
+            futures.emplace_back(pool.submit_priority(2, []() {}));
+        for (auto& fut : futures)
+            fut.get();
+        double secs = seconds_since(start);
+        stop = true;
+        flood.join();
+        report("starve", "low under high", threads, low, secs);
+    }
+}
+
+// 定时任务：100 万个还没到期的定时任务挂在时间轮上时，插入/取消的开销 和 到期的准时程度
+static void bench_timer(int threads) {
+    const long pending = 1000000;
+    const long fire = 100000;
+
+    ThreadPool pool;
+    pool.start(threads);
+    std::minstd_rand rng(42);
+
+    // 1.插入 100 万个 1s ~ 100s 之后才到期的定时任务
+    std::vector<TimerHandle> handles;
+    handles.reserve(pending);
+    auto start = Clock::now();
+    for (long i = 0; i < pending; i++)
+        handles.push_back(pool.schedule_after(std::chrono::milliseconds(1000 + rng() % 99000), []() {}));
+    report("timer", "insert", threads, pending, seconds_since(start));
+
+    // 2.在它们还挂着的时候，10 万个定时任务在 0 ~ 200ms 内陆续到期，统计实际执行时间比预定晚了多少
+    std::vector<long> lateness(fire);
+    std::atomic_long fired(0);
+    start = Clock::now();
+    for (long i = 0; i < fire; i++) {
+        auto delay = std::chrono::microseconds(rng() % 200000);
+        auto due = Clock::now() + delay;
+        pool.schedule_after(delay, [&lateness, &fired, i, due]() {
+            lateness[i] = std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - due).count();
+            fired.fetch_add(1, std::memory_order_release);
+        });
+    }
+    while (fired.load(std::memory_order_acquire) < fire)
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    report("timer", "fire", threads, fire, seconds_since(start));
+    long early = std::count_if(lateness.begin(), lateness.end(), [](long ns) { return ns < 0; });
+    printf("%-10s %-18s late p50=%ldus p99=%ldus max=%ldus early=%ld\n", "", "",
+           percentile_of(lateness, 50) / 1000, percentile_of(lateness, 99) / 1000,
+           percentile_of(lateness, 100) / 1000, early);
+    metric("late_p50_us", percentile_of(lateness, 50) / 1000);
+    metric("late_p99_us", percentile_of(lateness, 99) / 1000);
+    metric("early", early);
+
+    // 3.周期任务：每 1ms 一次，100ms 后取消，取消之后不应该再执行
+    std::atomic_long ticks(0);
+    TimerHandle every = pool.schedule_every(std::chrono::milliseconds(1), [&ticks]() { ticks++; });
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    every.cancel();
+    long at_cancel = ticks.load();
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    printf("%-10s %-18s periodic 1ms x 100ms: ran=%ld after_cancel=%ld\n", "timer", "every",
+           at_cancel, ticks.load() - at_cancel);
+
+    // 4.取消那 100 万个
+    start = Clock::now();
+    long cancelled = 0;
+    for (auto& h : handles)
+        cancelled += h.cancel();
+    report("timer", "cancel", threads, pending, seconds_since(start));
+    if (cancelled != pending)
+        fail("timer: only %ld of %ld cancelled\n", cancelled, pending);
+}
+
+// 任务依赖：流水线/DAG 用 then()/submit_after() 接起来，和 用 get()/wait() 阻塞等前驱 的对比
+static void bench_dag(int threads) {
+    ThreadPool pool;
+    pool.start(threads);
+
+    // 1.一条 10 万级的链：每一级等上一级的结果
+    {
+        const long n = 100000;
+        auto start = Clock::now();
+        long v = 0;
+        for (long i = 0; i < n; i++)
+            v = pool.submit([](long x) { return x + 1; }, v).get();   // 调用者在每一级之间阻塞
+        report("dag", "chain/get", threads, n, seconds_since(start));
+        if (v != n)
+            fail("dag: chain/get wrong value %ld\n", v);
+
+        start = Clock::now();
+        Future<long> fut = pool.submit([]() { return 0L; });
+        for (long i = 1; i < n; i++)
+            fut = fut.then([](long x) { return x + 1; });
+        v = fut.get();
+        report("dag", "chain/then", threads, n, seconds_since(start));
+        if (v != n - 1)
+            fail("dag: chain/then wrong value %ld\n", v);
+    }
+
+    // 2.宽 64 深 200 的网格：每个节点依赖上一层相邻的两个节点
+    const int width = 64, depth = 200;
+    const long work_ns = 1000;
+    auto node = [](long a, long b, long i) { return (a * 31 + b + i) % 1000003; };
+    std::vector<long> expect(width * depth);
+    for (int l = 0; l < depth; l++)
+        for (int i = 0; i < width; i++)
+            expect[l * width + i] = l == 0 ? i : node(expect[(l - 1) * width + i],
+                                                     expect[(l - 1) * width + (i + 1) % width], i);
+
+    for (bool blocking : {true, false}) {
+        std::vector<long> vals(width * depth);
+        std::vector<Future<void>> futs(width * depth);
+        auto start = Clock::now();
+        for (int l = 0; l < depth; l++) {
+            for (int i = 0; i < width; i++) {
+                int k = l * width + i;
+                int pa = (l - 1) * width + i, pb = (l - 1) * width + (i + 1) % width;
+                auto body = [&vals, &node, k, pa, pb, l, i, work_ns]() {
+                    spin_for(work_ns);
+                    vals[k] = l == 0 ? i : node(vals[pa], vals[pb], i);
+                };
+                if (l == 0) {
+                    futs[k] = pool.submit(body);
+                } else if (blocking) {
+                    // 按拓扑序提交，任务在线程池里阻塞等前驱（前驱一定更早出队，不会死锁）
+                    futs[k] = pool.submit([&futs, body, pa, pb]() {
+                        futs[pa].wait();
+                        futs[pb].wait();
+                        body();
+                    });
+                } else {
+                    futs[k] = pool.submit_after({futs[pa], futs[pb]}, body);
+                }
+            }
+        }
+        for (auto& fut : futs)
+            fut.wait();
+        report("dag", blocking ? "grid/wait" : "grid/submit_after", threads, width * depth,
+               seconds_since(start));
+        if (vals != expect)
+            fail("dag: wrong result (%s)\n", blocking ? "wait" : "submit_after");
+    }
+    print_stats(pool.stats());
+}
+
+// 返回一个 int 的老式任务，同一个对象反复提交
+class ConstTask : public Task {
+public:
+    Any run() { return 1; }
+};
+
+/**
+ * 稳定状态下每次提交的 malloc 次数和每个任务的开销
+ * operator new 必须是 0；BlockPool 只在块的总数涨到历史峰值之前向系统要内存，
+ * 峰值取决于有多少块正好攒在各个线程的本地链表里（每档每个线程最多 63 块，一次要 32 块），和任务数无关
+ */
+static void bench_alloc(int threads) {
+    const long wave = 1024;
+    const long n = 1000 * wave;
+    auto task = std::make_shared<ConstTask>();
+
+    ThreadPool pool;
+    pool.start(threads);
+
+    std::vector<Future<long>> futs;
+    std::vector<Result> results;
+    futs.reserve(wave);
+    results.reserve(wave);
+
+    for (int variant = 0; variant < 2; variant++) {
+        // 一波一波地提交再取结果：第一轮只用来把各个线程的空闲链表和仓库填起来
+        for (int round = 0; round < 2; round++) {
+            long count = round == 0 ? 300 * wave : n;
+            long sum = 0;
+            long news = new_calls.load();
+            uint64_t sys = BlockPool::system_allocs();
+            auto start = Clock::now();
+
+            for (long done = 0; done < count; done += wave) {
+                if (variant == 0) {
+                    for (long i = 0; i < wave; i++)
+                        futs.push_back(pool.submit([i]() { return i & 1; }));
+                    for (auto& fut : futs)
+                        sum += fut.get();
+                    futs.clear();
+                } else {
+                    for (long i = 0; i < wave; i++)
+                        results.push_back(pool.submitTask(task));
+                    for (auto& res : results)
+                        sum += res.get().cast_<int>();
+                    results.clear();
+                }
+            }
+            if (round == 0) continue;
+
+            double secs = seconds_since(start);
+            long allocs = new_calls.load() - news;
+            long carves = static_cast<long>(BlockPool::system_allocs() - sys);
+            const char* name = variant == 0 ? "submit" : "submitTask";
+            report("alloc", name, threads, count, secs);
+            printf("%-10s %-18s %.1f ns/task  operator new=%ld  BlockPool malloc=%ld\n", "", "",
+                   secs * 1e9 / count, allocs, carves);
+            metric("ns_per_task", secs * 1e9 / count);
+            metric("operator_new", allocs);
+            if (allocs != 0 || carves > 2 * 2 * (threads + 1))
+                fail("alloc: %s still calls malloc in steady state\n", name);
+            if (sum != count / (variant == 0 ? 2 : 1))
+                fail("alloc: wrong sum %ld\n", sum);
+        }
+    }
+}
+
+// 在 dir 下伪造一个 sysfs：nodes 个节点，每个节点 cpus_per_node 个 CPU（每个核两个超线程）
+static void write_fake_sysfs(const std::string& dir, int nodes, int cpus_per_node) {
+    auto write = [](const std::string& path, const std::string& text) {
+        FILE* f = fopen(path.c_str(), "w");
+        if (f == nullptr) return;
+        fputs(text.c_str(), f);
+        fclose(f);
+    };
+    mkdir((dir + "/node").c_str(), 0755);
+    mkdir((dir + "/cpu").c_str(), 0755);
+    for (int n = 0; n < nodes; n++) {
+        std::string node_dir = dir + "/node/node" + std::to_string(n);
+        mkdir(node_dir.c_str(), 0755);
+        int lo = n * cpus_per_node, hi = lo + cpus_per_node - 1;
+        write(node_dir + "/cpulist", std::to_string(lo) + "-" + std::to_string(hi) + "\n");
+        for (int c = lo; c <= hi; c++) {
+            std::string cpu_dir = dir + "/cpu/cpu" + std::to_string(c);
+            mkdir(cpu_dir.c_str(), 0755);
+            mkdir((cpu_dir + "/topology").c_str(), 0755);
+            write(cpu_dir + "/topology/physical_package_id", std::to_string(n) + "\n");
+            write(cpu_dir + "/topology/core_id", std::to_string((c - lo) / 2) + "\n");
+        }
+    }
+}
+
+// fan-out：每个根任务在线程池里提交 children 个子任务，统计子任务和父任务在同一个节点上执行的比例
+static void run_locality(ThreadPool& pool, const char* variant, int threads) {
+    const long roots = 2000;
+    const int children = 16;
+    std::atomic_long same(0), total(0);
+
+    auto start = Clock::now();
+    for (long r = 0; r < roots; r++) {
+        // 根任务不等子任务（固定数量的线程都等在根任务里会死锁），用计数判断结束
+        pool.submit([&pool, &same, &total]() {
+            int parent = ThreadPool::current_node();
+            for (int c = 0; c < children; c++) {
+                pool.submit([&same, &total, parent]() {
+                    spin_for(500);
+                    if (ThreadPool::current_node() == parent)
+                        same.fetch_add(1, std::memory_order_relaxed);
+                    total.fetch_add(1, std::memory_order_release);
+                });
+            }
+        });
+    }
+    while (total.load(std::memory_order_acquire) < roots * children)
+        std::this_thread::sleep_for(std::chrono::microseconds(100));
+    report("affinity", variant, threads, roots * (children + 1), seconds_since(start));
+    printf("%-10s %-18s children on parent's node: %.1f%%\n", "", "",
+           100.0 * same.load() / std::max(1L, total.load()));
+    metric("same_node_pct", 100.0 * same.load() / std::max(1L, total.load()));
+}
+
+// CPU 绑定 和 按 NUMA 节点分队列：本机拓扑 + 伪造的双节点拓扑
+static void bench_affinity(int threads) {
+    const CpuTopology& topo = CpuTopology::system();
+    printf("%-10s topology: %zu cpus, %d node(s)\n", "affinity", topo.cpus().size(), topo.node_count());
+    for (int n = 0; n < topo.node_count(); n++) {
+        printf("%-10s   node %d:", "", n);
+        for (int cpu : topo.node_cpus(n))
+            printf(" %d", cpu);
+        printf("\n");
+    }
+
+    // 1.本机上的各种绑定方式：每个任务看一眼自己所在线程的 CPU 掩码
+    struct Variant {
+        const char* name;
+        AffinityPolicy policy;
+    };
+    std::vector<Variant> variants = {
+        {"none", AffinityPolicy()},
+        {"compact", AffinityPolicy::compact()},
+        {"scatter", AffinityPolicy::scatter()},
+        {"cpu_list", AffinityPolicy::cpu_list({topo.cpus().back().id})},
+        {"per_node", AffinityPolicy::per_node()},
+    };
+    for (auto& v : variants) {
+        ThreadPool pool;
+        pool.start(threads, v.policy);
+
+        std::atomic_int pinned(0), tasks(0);
+        std::vector<Future<void>> futs;
+        for (int i = 0; i < threads * 8; i++) {
+            futs.push_back(pool.submit([&pinned, &tasks]() {
+                cpu_set_t set;
+                CPU_ZERO(&set);
+                sched_getaffinity(0, sizeof(set), &set);
+                if (CPU_COUNT(&set) < static_cast<int>(CpuTopology::system().cpus().size())
+                    || CpuTopology::system().cpus().size() == 1)
+                    pinned++;
+                tasks++;
+                spin_for(10000);
+            }));
+        }
+        for (auto& fut : futs)
+            fut.wait();
+        char variant[32];
+        snprintf(variant, sizeof(variant), "pin/%s", v.name);
+        run_locality(pool, variant, threads);
+        printf("%-10s %-18s tasks on a restricted cpu mask: %d/%d\n", "", "", pinned.load(), tasks.load());
+    }
+
+    // 2.伪造的双节点拓扑：CPU 不存在时绑定失败，但节点队列照常工作
+    char tmpl[] = "/tmp/fake_sysfs_XXXXXX";
+    if (mkdtemp(tmpl) == nullptr)
+        return;
+    write_fake_sysfs(tmpl, 2, 4);
+    CpuTopology fake = CpuTopology::from_sysfs(tmpl);
+    if (fake.node_count() != 2 || fake.cpus().size() != 8)
+        fail("affinity: fake topology parsed as %d nodes %zu cpus\n", fake.node_count(), fake.cpus().size());
+
+    {
+        // 单核机器上别的节点的线程总是闲着，会去取这个节点的任务，比例只能说明节点队列在起作用
+        AffinityPolicy policy = AffinityPolicy::per_node();
+        policy.topology = &fake;
+        ThreadPool pool;
+        pool.start(threads, policy);
+        run_locality(pool, "fake2/per_node", threads);
+
+        std::atomic_int on_node[2] = {{0}, {0}};
+        std::vector<Future<void>> futs;
+        for (int i = 0; i < threads * 64; i++) {
+            futs.push_back(pool.submit([&on_node]() {
+                int node = ThreadPool::current_node();
+                if (node == 0 || node == 1)
+                    on_node[node]++;
+                // 阻塞而不是忙等：单核机器上忙等的任务可能全被同一个线程执行完
+                std::this_thread::sleep_for(std::chrono::microseconds(500));
+            }));
+        }
+        for (auto& fut : futs)
+            fut.wait();
+        printf("%-10s %-18s tasks run on node 0/1: %d/%d\n", "", "", on_node[0].load(), on_node[1].load());
+        if (threads > 1 && (on_node[0] == 0 || on_node[1] == 0))
+            fail("affinity: per_node workers are not spread over both fake nodes\n");
+    }
+    std::string cleanup = std::string("rm -rf ") + tmpl;
+    if (system(cleanup.c_str()) != 0)
+        fail("affinity: failed to remove %s\n", tmpl);
+}
+
+// 按负载轨迹回放：每一段以固定速率提交会阻塞 2ms 的任务（模拟 I/O），中间夹着突发
+// MODE_CACHED 由控制线程按排队时间增减线程，对比固定线程数；每 20ms 采样一次线程数
+static void bench_elastic(int threads) {
+    struct Phase {
+        const char* name;
+        int ms;
+        int rate;       // 每秒提交的任务数
+    };
+    const Phase trace[] = {
+        {"quiet", 200, 200},
+        {"burst", 300, 4000},
+        {"quiet", 400, 200},
+        {"burst", 300, 8000},
+        {"quiet", 600, 100},
+    };
+    const int n_phases = sizeof(trace) / sizeof(trace[0]);
+    const int max_threads = 64;
+
+    for (PoolMode mode : {PoolMode::MODE_FIXED, PoolMode::MODE_CACHED}) {
+        ThreadPool pool;
+        pool.setMode(mode);
+        pool.setThreadThreshHold(max_threads);
+        pool.setThreadIdleTimeout(std::chrono::milliseconds(200));
+        pool.start(threads);
+
+        std::vector<std::vector<long>> latencies(n_phases);
+        std::vector<unsigned> peak(n_phases, 0);
+        std::vector<std::string> timeline;
+        std::atomic_int phase(0);
+        std::atomic_bool done(false);
+
+        std::thread sampler([&]() {
+            int tick = 0;
+            while (!done) {
+                unsigned n = pool.stats().threads;
+                int k = phase.load();
+                peak[k] = std::max(peak[k], n);
+                if (tick++ % 5 == 0)
+                    timeline.push_back(std::to_string(n));
+                std::this_thread::sleep_for(std::chrono::milliseconds(20));
+            }
+        });
+
+        std::vector<Future<void>> futures;
+        long total = 0;
+        auto start = Clock::now();
+        auto next = start;
+        for (int k = 0; k < n_phases; k++) {
+            phase = k;
+            latencies[k].resize(trace[k].ms * trace[k].rate / 1000);
+            std::size_t n = 0;
+            double owed = 0;
+            for (int t = 0; t < trace[k].ms; t++) {
+                owed += trace[k].rate / 1000.0;
+                for (; owed >= 1; owed -= 1) {
+                    auto submitted = Clock::now();
+                    long* slot = &latencies[k][n++];
+                    futures.emplace_back(pool.submit([slot, submitted]() {
+                        *slot = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                            Clock::now() - submitted).count();
+                        std::this_thread::sleep_for(std::chrono::milliseconds(2));
+                    }));
+                }
+                next += std::chrono::milliseconds(1);
+                std::this_thread::sleep_until(next);
+            }
+            latencies[k].resize(n);
+            total += n;
+        }
+        double secs = seconds_since(start);
+        for (auto& fut : futures)
+            fut.get();
+        done = true;
+        sampler.join();
+
+        report("elastic", mode_name(mode), threads, total, secs);
+        for (int k = 0; k < n_phases; k++) {
+            printf("%-10s %-18s %-5s %5d/s  wait p50=%6ldus p99=%6ldus  peak threads=%u\n", "", "",
+                   trace[k].name, trace[k].rate, percentile_of(latencies[k], 50) / 1000,
+                   percentile_of(latencies[k], 99) / 1000, peak[k]);
+            std::string prefix = "phase" + std::to_string(k) + "_" + trace[k].name;
+            metric((prefix + "_p99_us").c_str(), percentile_of(latencies[k], 99) / 1000);
+            metric((prefix + "_peak_threads").c_str(), peak[k]);
+        }
+        std::string line;
+        for (auto& n : timeline)
+            line += n + " ";
+        printf("%-10s %-18s threads every 100ms: %s\n", "", "", line.c_str());
+
+        unsigned most = *std::max_element(peak.begin(), peak.end());
+        if (most > static_cast<unsigned>(std::max(threads, max_threads)))
+            fail("elastic: %u threads exceed the limit of %d\n", most, max_threads);
+        if (mode == PoolMode::MODE_CACHED && peak[n_phases - 1] > 0
+            && pool.stats().threads >= most && most > static_cast<unsigned>(threads))
+            fail("elastic: idle threads were not retired after the last burst\n");
+    }
+}
+
+// 反复创建、关闭线程池：三种模式 × 三种关闭方式（再加上直接析构），检查每个 Future 都有结果
+// DRAIN_ALL 和析构要执行完所有任务，另外两种只能是执行完或者 "task is cancelled!"
+// 放在 ThreadSanitizer 下跑：make tsan && ./bench/bench_tsan lifecycle
+static void bench_lifecycle(int threads) {
+    const int rounds = 2000;
+    const int tasks = 32;
+    const PoolMode modes[] = {PoolMode::MODE_FIXED, PoolMode::MODE_CACHED, PoolMode::MODE_STEAL};
+    const char* how_names[] = {"drain", "cancel", "immediate", "destructor"};
+    std::mt19937 rng(42);
+
+    long done = 0, cancelled = 0, returned = 0, errors = 0;
+    double shutdown_ms[4] = {};
+    int shutdown_count[4] = {};
+    auto start = Clock::now();
+    for (int r = 0; r < rounds; r++) {
+        PoolMode mode = modes[r % 3];
+        int how = (r / 3) % 4;
+        std::atomic_int ran(0);
+        int expected = 0;
+        std::vector<Future<int>> futures;
+        Clock::time_point t0;
+        {
+            ThreadPool pool;
+            pool.setMode(mode);
+            pool.start(1 + rng() % threads);
+
+            for (int i = 0; i < tasks; i++) {
+                if (i % 8 == 7) {
+                    // 在线程池里再提交一个子任务，不等它
+                    futures.push_back(pool.submit([&pool, &ran, i]() {
+                        ran++;
+                        pool.submit([&ran]() { ran++; });
+                        return i;
+                    }));
+                    expected += 2;
+                } else if (i % 8 == 3) {
+                    futures.push_back(pool.submit_after({futures.back()}, [&ran, i]() { ran++; return i; }));
+                    expected++;
+                } else {
+                    futures.push_back(pool.submit([&ran, i]() { ran++; return i; }));
+                    expected++;
+                }
+            }
+
+            if (r % 5 == 0) {
+                pool.wait_idle();
+                if (ran != expected) {
+                    fail("lifecycle: wait_idle returned after %d of %d tasks\n", ran.load(), expected);
+                    errors++;
+                }
+            }
+
+            t0 = Clock::now();
+            if (how < 3) {
+                ShutdownMode m = how == 0 ? ShutdownMode::DRAIN_ALL
+                               : how == 1 ? ShutdownMode::CANCEL_PENDING : ShutdownMode::IMMEDIATE;
+                std::vector<PendingTask> pending = pool.shutdown(m);
+                returned += pending.size();
+            }
+        }
+        // 包括析构：IMMEDIATE 的 join 在析构里
+        shutdown_ms[how] += seconds_since(t0) * 1e3;
+        shutdown_count[how]++;
+
+        for (auto& fut : futures) {
+            try {
+                fut.get();
+                done++;
+            } catch (const char* e) {
+                cancelled++;
+                if (std::strcmp(e, "task is cancelled!") != 0 || how == 0 || how == 3) {
+                    fail("lifecycle: %s round %d: %s\n", how_names[how], r, e);
+                    errors++;
+                }
+            }
+        }
+        if ((how == 0 || how == 3) && ran != expected) {
+            fail("lifecycle: %s round %d ran %d of %d tasks\n", how_names[how], r, ran.load(), expected);
+            errors++;
+        }
+    }
+    double secs = seconds_since(start);
+
+    report("lifecycle", "create+shutdown", threads, rounds, secs);
+    printf("%-10s %-18s futures done=%ld cancelled=%ld (returned by shutdown=%ld) errors=%ld\n",
+           "", "", done, cancelled, returned, errors);
+    metric("errors", errors);
+    for (int how = 0; how < 4; how++) {
+        double avg = shutdown_count[how] == 0 ? 0 : shutdown_ms[how] / shutdown_count[how];
+        printf("%-10s %-18s %-10s shutdown avg=%.3fms\n", "", "", how_names[how], avg);
+        metric((std::string("shutdown_ms_") + how_names[how]).c_str(), avg);
+    }
+}
+
+// 2 倍过载下的有效吞吐：每个请求 20ms 内做完才算数
+// 不带截止时间时所有请求都会执行，队列越排越长，后面的全部超时；
+// 带截止时间/令牌时过期的请求出队时直接跳过，线程只做还来得及的那些
+static void bench_shed(int threads) {
+    const long work_ns = 200000;                        // 每个请求 200us 的计算
+    const auto slo = std::chrono::milliseconds(20);
+    const auto duration = std::chrono::milliseconds(1000);
+
+    // 先测出线程池的处理能力
+    double capacity;
+    {
+        ThreadPool pool;
+        pool.start(threads);
+        const int n = 2000;
+        std::vector<Future<void>> futs;
+        auto start = Clock::now();
+        for (int i = 0; i < n; i++)
+            futs.push_back(pool.submit(spin_for, work_ns));
+        for (auto& fut : futs)
+            fut.get();
+        capacity = n / seconds_since(start);
+    }
+    const double rate = 2 * capacity;
+    printf("%-10s %-18s capacity=%.0f req/s, offering %.0f req/s, slo=%lldms\n", "shed", "", capacity, rate,
+           (long long)slo.count());
+
+    for (const char* variant : {"no deadline", "deadline", "cancel token"}) {
+        ThreadPool pool;
+        pool.setTaskqueMaxThreshHold(1 << 16);
+        pool.start(threads);
+
+        std::vector<Clock::time_point> finished(static_cast<std::size_t>(rate * 2));
+        std::vector<Clock::time_point> submitted(finished.size());
+        std::vector<Future<void>> futures;
+        futures.reserve(finished.size());
+
+        // 令牌：每 5ms 提交的请求共享一个取消源，客户端等满 slo 就放弃（取消）
+        struct Window {
+            CancelSource source;
+            Clock::time_point opened;
+            std::size_t first, last;
+        };
+        std::vector<Window> windows;
+        std::size_t next_cancel = 0;
+        std::vector<char> ready_at_cancel(finished.size(), 0);
+        auto cancel_expired = [&](Clock::time_point now) {
+            for (; next_cancel < windows.size() && now - windows[next_cancel].opened >= slo; next_cancel++) {
+                Window& w = windows[next_cancel];
+                w.source.cancel();
+                for (std::size_t i = w.first; i < w.last; i++)
+                    ready_at_cancel[i] = futures[i].is_ready();
+            }
+        };
+
+        auto start = Clock::now();
+        double owed = 0;
+        auto tick = start;
+        std::size_t n = 0;
+        while (Clock::now() - start < duration && n < finished.size()) {
+            tick += std::chrono::milliseconds(1);
+            for (owed += rate / 1000; owed >= 1 && n < finished.size(); owed -= 1, n++) {
+                auto now = Clock::now();
+                submitted[n] = now;
+                auto job = [&finished, n, work_ns]() {
+                    spin_for(work_ns);
+                    finished[n] = Clock::now();
+                };
+                if (std::strcmp(variant, "no deadline") == 0) {
+                    futures.push_back(pool.submit(job));
+                } else if (std::strcmp(variant, "deadline") == 0) {
+                    futures.push_back(pool.submit_with({ThreadPool::DEFAULT_PRIORITY, CancelToken(), now + slo}, job));
+                } else {
+                    if (windows.empty() || now - windows.back().opened >= std::chrono::milliseconds(5)) {
+                        if (!windows.empty()) windows.back().last = n;
+                        windows.push_back({CancelSource(), now, n, n});
+                    }
+                    futures.push_back(pool.submit_with({ThreadPool::DEFAULT_PRIORITY, windows.back().source.token()}, job));
+                }
+            }
+            if (!windows.empty()) windows.back().last = n;
+            cancel_expired(Clock::now());
+            std::this_thread::sleep_until(tick);
+        }
+        double secs = seconds_since(start);
+        cancel_expired(Clock::time_point::max());   // 剩下的客户端也不等了
+
+        // 取消返回时 还在排队的请求已经带着异常完成了，get() 不用等它排到队头
+        long not_ready_after_cancel = 0;
+        long good = 0, late = 0, skipped = 0;
+        for (std::size_t i = 0; i < n; i++) {
+            try {
+                futures[i].get();
+                if (finished[i] - submitted[i] <= slo) good++;
+                else late++;
+            } catch (const char*) {
+                skipped++;
+                if (!windows.empty() && !ready_at_cancel[i])
+                    not_ready_after_cancel++;
+            }
+        }
+
+        report("shed", variant, threads, static_cast<long>(n), secs);
+        printf("%-10s %-18s goodput=%.0f req/s  in time=%ld late=%ld skipped=%ld\n", "", "",
+               good / secs, good, late, skipped);
+        metric("goodput", good / secs);
+        if (not_ready_after_cancel > 0)
+            fail("shed: %ld cancelled requests were not completed by cancel()\n", not_ready_after_cancel);
+    }
+}
+
+// 提交延迟：外部线程一次提交一个空任务，等它执行完再提交下一个
+// 统计 submit() 调用本身的耗时，以及从调用 submit 到任务开始执行的时间（派发延迟，包括唤醒线程）
+static void bench_latency(int threads) {
+    const long n = 50000;
+
+    for (PoolMode mode : {PoolMode::MODE_FIXED, PoolMode::MODE_STEAL, PoolMode::MODE_CACHED}) {
+        ThreadPool pool;
+        pool.setMode(mode);
+        pool.start(threads);
+
+        std::vector<long> call(n), dispatch(n);
+        auto start = Clock::now();
+        for (long i = 0; i < n; i++) {
+            auto submitted = Clock::now();
+            long* slot = &dispatch[i];
+            Future<void> fut = pool.submit([slot, submitted]() {
+                *slot = std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - submitted).count();
+            });
+            call[i] = std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - submitted).count();
+            fut.get();
+        }
+        double secs = seconds_since(start);
+
+        report("latency", mode_name(mode), threads, n, secs);
+        printf("%-10s %-18s submit p50=%ldns p99=%ldns p999=%ldns  start p50=%ldns p99=%ldns p999=%ldns\n",
+               "", "", percentile_of(call, 50), percentile_of(call, 99), percentile_of(call, 99.9),
+               percentile_of(dispatch, 50), percentile_of(dispatch, 99), percentile_of(dispatch, 99.9));
+        metric("submit_p50_ns", percentile_of(call, 50));
+        metric("submit_p99_ns", percentile_of(call, 99));
+        metric("submit_p999_ns", percentile_of(call, 99.9));
+        metric("start_p50_ns", percentile_of(dispatch, 50));
+        metric("start_p99_ns", percentile_of(dispatch, 99));
+        metric("start_p999_ns", percentile_of(dispatch, 99.9));
+    }
+}
+
+// fan-out / fan-in：外部线程一轮发出 width 个 1us 的小任务，全部完成后再发下一轮，统计每一轮的耗时
+// 逐个 get() 对比 submitBatch + wait_all
+static void bench_fanin(int threads) {
+    const int rounds = 2000;
+
+    for (int width : {8, 64, 256}) {
+        for (bool batched : {false, true}) {
+            ThreadPool pool;
+            pool.setTaskqueMaxThreshHold(1 << 16);
+            pool.start(threads);
+
+            std::vector<long> round_ns(rounds);
+            std::vector<std::function<void()>> fns(width, []() { spin_for(1000); });
+            auto start = Clock::now();
+            for (int r = 0; r < rounds; r++) {
+                auto t0 = Clock::now();
+                if (batched) {
+                    auto batch = pool.submitBatch(fns.begin(), fns.end());
+                    batch.wait_all();
+                } else {
+                    std::vector<Future<void>> futures;
+                    futures.reserve(width);
+                    for (int i = 0; i < width; i++)
+                        futures.emplace_back(pool.submit(spin_for, 1000));
+                    for (auto& fut : futures)
+                        fut.get();
+                }
+                round_ns[r] = std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - t0).count();
+            }
+            double secs = seconds_since(start);
+
+            char variant[32];
+            snprintf(variant, sizeof(variant), "%s/w=%d", batched ? "wait_all" : "get", width);
+            report("fanin", variant, threads, static_cast<long>(rounds) * width, secs);
+            printf("%-10s %-18s round p50=%ldus p99=%ldus p999=%ldus\n", "", "",
+                   percentile_of(round_ns, 50) / 1000, percentile_of(round_ns, 99) / 1000,
+                   percentile_of(round_ns, 99.9) / 1000);
+            metric("round_p50_us", percentile_of(round_ns, 50) / 1000.0);
+            metric("round_p99_us", percentile_of(round_ns, 99) / 1000.0);
+            metric("round_p999_us", percentile_of(round_ns, 99.9) / 1000.0);
+        }
+    }
+}
+
+// 长尾混合负载：每秒 20000 个请求，95% 算 1us、4.5% 算 100us、0.5% 阻塞 2ms（模拟 IO）
+// 统计从提交到完成的延迟，短请求单独统计：长请求占住线程时，短请求会被堵在它后面
+static void bench_mixed(int threads) {
+    const int ms = 1000;
+    const int rate = 20000;
+    const long n = static_cast<long>(ms) * rate / 1000;
+
+    // 同一个种子，每种模式回放同一串请求
+    std::vector<char> kind(n);
+    std::mt19937 rng(42);
+    for (long i = 0; i < n; i++) {
+        unsigned x = rng() % 1000;
+        kind[i] = x < 950 ? 0 : x < 995 ? 1 : 2;
+    }
+
+    for (PoolMode mode : {PoolMode::MODE_FIXED, PoolMode::MODE_STEAL, PoolMode::MODE_CACHED}) {
+        ThreadPool pool;
+        pool.setMode(mode);
+        pool.setThreadThreshHold(64);
+        pool.start(threads);
+
+        std::vector<long> latency(n);
+        std::vector<Future<void>> futures;
+        futures.reserve(n);
+        long i = 0;
+        auto start = Clock::now();
+        auto next = start;
+        for (int t = 0; t < ms; t++) {
+            for (long end = static_cast<long>(t + 1) * rate / 1000; i < end; i++) {
+                auto submitted = Clock::now();
+                long* slot = &latency[i];
+                char k = kind[i];
+                futures.emplace_back(pool.submit([slot, submitted, k]() {
+                    if (k == 0)
+                        spin_for(1000);
+                    else if (k == 1)
+                        spin_for(100000);
+                    else
+                        std::this_thread::sleep_for(std::chrono::milliseconds(2));
+                    *slot = std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - submitted).count();
+                }));
+            }
+            next += std::chrono::milliseconds(1);
+            std::this_thread::sleep_until(next);
+        }
+        for (auto& fut : futures)
+            fut.get();
+        double secs = seconds_since(start);
+
+        std::vector<long> short_latency;
+        for (long j = 0; j < n; j++)
+            if (kind[j] == 0)
+                short_latency.push_back(latency[j]);
+
+        report("mixed", mode_name(mode), threads, n, secs);
+        printf("%-10s %-18s short p50=%ldus p99=%ldus p999=%ldus  all p99=%ldus\n", "", "",
+               percentile_of(short_latency, 50) / 1000, percentile_of(short_latency, 99) / 1000,
+               percentile_of(short_latency, 99.9) / 1000, percentile_of(latency, 99) / 1000);
+        metric("short_p50_us", percentile_of(short_latency, 50) / 1000.0);
+        metric("short_p99_us", percentile_of(short_latency, 99) / 1000.0);
+        metric("short_p999_us", percentile_of(short_latency, 99.9) / 1000.0);
+        metric("all_p99_us", percentile_of(latency, 99) / 1000.0);
+    }
+}
+
+// 在 seconds 秒内执行完 fn，执行不完（死锁了）就报错退出：卡住的线程池没法析构
+template<typename Fn>
+static void with_watchdog(const char* scenario, const char* what, int seconds, Fn fn) {
+    std::atomic_bool done(false);
+    std::thread dog([&]() {
+        for (int i = 0; i < seconds * 100 && !done; i++)
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        if (!done) {
+            printf("%s: %s deadlocked\n", scenario, what);
+            fflush(stdout);
+            std::_Exit(1);
+        }
+    });
+    fn();
+    done = true;
+    dog.join();
+}
+
+// 多租户：一个租户不停地灌 100us 的任务，另一个每 1ms 提交一个 10us 的探测请求，统计探测请求的延迟
+// 共用一个队列时探测请求排在几千个任务后面；分成两个组以后按 DRR 轮流执行，只等当前这一轮
+// 再检查 权重 3:1 的两个组分到的执行时间、并发上限 和 队列上限
+static void bench_groups(int threads) {
+    const int probes = 300;
+
+    for (bool grouped : {false, true}) {
+        ThreadPool pool;
+        pool.start(threads);
+        TaskGroup* noisy = grouped ? &pool.create_group("noisy", {0, 4096, 1}) : nullptr;
+        TaskGroup* quiet = grouped ? &pool.create_group("quiet") : nullptr;
+
+        std::atomic_bool stop(false);
+        std::atomic_long flood_done(0);
+        std::thread flood([&]() {
+            while (!stop) {
+                // 共用一个队列时自己控制积压：最多 4096 个
+                if (!grouped && pool.stats().pending_tasks > 4096) {
+                    std::this_thread::sleep_for(std::chrono::microseconds(200));
+                    continue;
+                }
+                auto work = [&flood_done]() { spin_for(100000); flood_done++; };
+                if (grouped)
+                    noisy->submit(work);
+                else
+                    pool.submit(work);
+            }
+        });
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));   // 先把队列灌满
+
+        std::vector<long> latencies(probes);
+        std::vector<Future<void>> futures;
+        auto start = Clock::now();
+        for (int i = 0; i < probes; i++) {
+            auto submitted = Clock::now();
+            long* slot = &latencies[i];
+            auto probe = [slot, submitted]() {
+                spin_for(10000);
+                *slot = std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - submitted).count();
+            };
+            futures.push_back(grouped ? quiet->submit(probe) : pool.submit(probe));
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        for (auto& fut : futures)
+            fut.get();
+        double secs = seconds_since(start);
+        stop = true;
+        flood.join();
+        pool.shutdown(ShutdownMode::CANCEL_PENDING);
+
+        report("groups", grouped ? "noisy/quiet groups" : "shared queue", threads, probes, secs);
+        printf("%-10s %-18s quiet p50=%ldus p99=%ldus  noisy done=%ld\n", "", "",
+               percentile_of(latencies, 50) / 1000, percentile_of(latencies, 99) / 1000, flood_done.load());
+        metric("quiet_p50_us", percentile_of(latencies, 50) / 1000.0);
+        metric("quiet_p99_us", percentile_of(latencies, 99) / 1000.0);
+    }
+
+    // 两个组都积压着 50us 的任务，按权重 3:1 分执行时间
+    {
+        ThreadPool pool;
+        pool.start(threads);
+        TaskGroup& heavy = pool.create_group("weight3", {0, 0, 3});
+        TaskGroup& light = pool.create_group("weight1", {0, 0, 1});
+        auto start = Clock::now();
+        for (int i = 0; i < 8000; i++) {
+            heavy.submit(spin_for, 50000);
+            light.submit(spin_for, 50000);
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(200));
+        GroupStats hs = heavy.stats(), ls = light.stats();
+        double secs = seconds_since(start);
+        pool.shutdown(ShutdownMode::CANCEL_PENDING);
+
+        double ratio = static_cast<double>(hs.run_ns) / std::max<uint64_t>(ls.run_ns, 1);
+        report("groups", "weights 3:1", threads, static_cast<long>(hs.completed + ls.completed), secs);
+        printf("%-10s %-18s run time ratio=%.2f  completed=%llu/%llu\n", "", "", ratio,
+               (unsigned long long)hs.completed, (unsigned long long)ls.completed);
+        metric("run_time_ratio", ratio);
+        if (ratio < 2.0 || ratio > 4.5)
+            fail("groups: weights 3:1 got a run time ratio of %.2f\n", ratio);
+    }
+
+    // 并发上限 2、队列上限 100：同时执行的不超过 2 个，队列满了 try_submit 被拒绝，wait_all 之后全部完成
+    {
+        ThreadPool pool;
+        pool.start(std::max(threads, 4));
+        TaskGroup& limited = pool.create_group("limited", {2, 100, 1});
+        std::vector<Future<int>> futures;
+        long rejected = 0;
+        auto start = Clock::now();
+        for (int i = 0; i < 400; i++) {
+            auto [status, fut] = limited.try_submit([i]() {
+                std::this_thread::sleep_for(std::chrono::microseconds(200));
+                return i;
+            });
+            if (status == SubmitStatus::OK)
+                futures.push_back(std::move(fut));
+            else
+                rejected++;
+        }
+        limited.wait_all();
+        double secs = seconds_since(start);
+        GroupStats gs = limited.stats();
+
+        long ready = std::count_if(futures.begin(), futures.end(), [](const Future<int>& f) { return f.is_ready(); });
+        report("groups", "limit 2/queue 100", std::max(threads, 4), static_cast<long>(futures.size()), secs);
+        printf("%-10s %-18s peak running=%d  rejected=%ld  ready after wait_all=%ld/%zu\n", "", "",
+               gs.peak_running, rejected, ready, futures.size());
+        metric("peak_running", gs.peak_running);
+        metric("rejected", rejected);
+        if (gs.peak_running > 2)
+            fail("groups: %d tasks ran at once with max_concurrency 2\n", gs.peak_running);
+        if (rejected == 0 || gs.rejected != static_cast<uint64_t>(rejected))
+            fail("groups: queue limit not enforced (rejected %ld)\n", rejected);
+        if (ready != static_cast<long>(futures.size()) || gs.completed != futures.size())
+            fail("groups: wait_all returned before the group was done\n");
+    }
+
+    // 队列上限 2 的组排满了，两个提交者阻塞在 submit 上：放开之后两个都要能提交进去
+    // 再排满、阻塞一个提交者，然后 shutdown：它要返回 SHUTDOWN，不能一直等
+    {
+        ThreadPool pool;
+        pool.start(1);
+        TaskGroup& bounded = pool.create_group("bounded", {1, 2, 1});
+        std::atomic_bool gate(false);
+        auto hold = [&gate]() {
+            while (!gate)
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        };
+        auto fill = [&]() {
+            bounded.submit(hold);
+            while (bounded.stats().running == 0)
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            bounded.submit([] {});
+            bounded.submit([] {});
+        };
+
+        std::atomic_int pushed(0);
+        fill();
+        std::vector<std::thread> producers;
+        for (int i = 0; i < 2; i++)
+            producers.emplace_back([&]() { bounded.submit([] {}); pushed++; });
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        gate = true;
+        with_watchdog("groups", "two producers blocked on a full group queue", 10, [&]() {
+            for (auto& t : producers)
+                t.join();
+            bounded.wait_all();
+        });
+        producers.clear();
+
+        gate = false;
+        fill();
+        SubmitStatus status = SubmitStatus::OK;
+        std::thread producer([&]() { status = bounded.try_submit([] {}).first; });
+        std::thread blocked([&]() { bounded.submit([] {}); });
+        producer.join();
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        with_watchdog("groups", "shutdown with a producer blocked on a full group queue", 10, [&]() {
+            std::thread opener([&]() {
+                std::this_thread::sleep_for(std::chrono::milliseconds(20));
+                gate = true;
+            });
+            pool.shutdown(ShutdownMode::CANCEL_PENDING);
+            blocked.join();
+            opener.join();
+        });
+        if (pushed != 2)
+            fail("groups: %d of 2 blocked producers got in\n", pushed.load());
+        if (status != SubmitStatus::QUEUE_FULL)
+            fail("groups: try_submit on a full group queue was not rejected\n");
+    }
+}
+
+static long fib_serial(int n) {
+    return n < 2 ? n : fib_serial(n - 1) + fib_serial(n - 2);
+}
+
+const int Fib_cutoff = 12;  // 小于它的直接算，不再拆分
+
+// 递归 fork-join 拆出来的任务数
+static long fib_tasks(int n) {
+    return n < Fib_cutoff ? 0 : 1 + fib_tasks(n - 1) + fib_tasks(n - 2);
+}
+
+// 同 FibTask，用 submit/Future
+static long fib_fork(ThreadPool& pool, int n) {
+    if (n < Fib_cutoff)
+        return fib_serial(n);
+    auto left = pool.submit([&pool, n]() { return fib_fork(pool, n - 1); });
+    long right = fib_fork(pool, n - 2);
+    return left.get() + right;
+}
+
+Any FibTask::run() {
+    if (n_ < Fib_cutoff)
+        return fib_serial(n_);
+    Result left = pool_->submitTask(std::make_shared<FibTask>(pool_, n_ - 1));
+    long right = FibTask(pool_, n_ - 2).run().cast_<long>();
+    return left.get().cast_<long>() + right;
+}
+
+static const char* policy_name(RejectPolicy policy) {
+    switch (policy) {
+    case RejectPolicy::BLOCK: return "block";
+    case RejectPolicy::CALLER_RUNS: return "caller-runs";
+    case RejectPolicy::DROP_OLDEST: return "drop-oldest";
+    case RejectPolicy::FAIL: return "fail";
+    }
+    return "?";
+}
+
+// 线程池的线程 get() 自己提交的任务（开启 setHelpWhileWaiting）：2 个线程的 MODE_FIXED，队列只有 64 个位置，不能死锁
+// 以及 外部线程提交得比执行得快时，各种 RejectPolicy 的吞吐
+static void bench_forkjoin(int threads) {
+    const int n = 30;
+    const long expected = fib_serial(n);
+
+    for (RejectPolicy policy : {RejectPolicy::BLOCK, RejectPolicy::CALLER_RUNS}) {
+        for (bool typed : {true, false}) {
+            ThreadPool pool;
+            pool.setMode(PoolMode::MODE_FIXED);
+            pool.setTaskqueMaxThreshHold(64);
+            pool.setRejectPolicy(policy);
+            pool.setHelpWhileWaiting(true);
+            pool.start(2);
+
+            char variant[32];
+            snprintf(variant, sizeof(variant), "%s/%s", typed ? "get" : "Result", policy_name(policy));
+            long got = 0;
+            auto start = Clock::now();
+            with_watchdog("forkjoin", variant, 30, [&]() {
+                if (typed)
+                    got = pool.submit([&pool]() { return fib_fork(pool, n); }).get();
+                else
+                    got = pool.submitTask(std::make_shared<FibTask>(&pool, n)).get().cast_<long>();
+            });
+            double secs = seconds_since(start);
+            PoolStats ps = pool.stats();
+
+            report("forkjoin", variant, 2, fib_tasks(n) + 1, secs);
+            printf("%-10s %-18s fib(%d)=%ld  caller runs=%llu\n", "", "", n, got,
+                   (unsigned long long)ps.caller_runs);
+            metric("caller_runs", ps.caller_runs);
+            if (got != expected)
+                fail("forkjoin: fib(%d) = %ld, expected %ld\n", n, got, expected);
+        }
+    }
+
+    // 外部线程往只有 256 个位置的队列里提交 2us 的任务，比线程池执行得快
+    const long total = 100000;
+    for (RejectPolicy policy : {RejectPolicy::BLOCK, RejectPolicy::CALLER_RUNS,
+                                RejectPolicy::DROP_OLDEST, RejectPolicy::FAIL}) {
+        std::atomic_long executed(0);
+        long invalid = 0;
+        ThreadPool pool;
+        pool.setTaskqueMaxThreshHold(256);
+        pool.setRejectPolicy(policy);
+        pool.start(threads);
+
+        auto start = Clock::now();
+        for (long i = 0; i < total; i++) {
+            auto fut = pool.submit([&executed]() {
+                spin_for(2000);
+                executed.fetch_add(1, std::memory_order_relaxed);
+            });
+            if (!fut.valid())
+                invalid++;
+        }
+        pool.wait_idle();
+        double secs = seconds_since(start);
+        PoolStats ps = pool.stats();
+
+        report("reject", policy_name(policy), threads, total, secs);
+        printf("%-10s %-18s executed=%ld  caller runs=%llu dropped=%llu rejected=%llu\n", "", "",
+               executed.load(), (unsigned long long)ps.caller_runs, (unsigned long long)ps.dropped,
+               (unsigned long long)ps.rejected);
+        metric("executed", executed.load());
+        metric("caller_runs", ps.caller_runs);
+        metric("dropped", ps.dropped);
+        metric("rejected", ps.rejected);
+        if (executed + static_cast<long>(ps.dropped + ps.rejected) != total
+            || invalid != static_cast<long>(ps.rejected))
+            fail("reject: %s lost tasks (executed=%ld dropped=%llu rejected=%llu invalid=%ld)\n",
+                   policy_name(policy), executed.load(), (unsigned long long)ps.dropped,
+                   (unsigned long long)ps.rejected, invalid);
+    }
+
+    // DROP_OLDEST 只挤掉用户的任务：队头是 submit_keyed 的 strand（内部的调度单元）时，
+    // 提交者把它执行掉腾出位置，排在 strand 里的任务不能被取消
+    {
+        ThreadPool pool;
+        pool.setTaskqueMaxThreshHold(64);
+        pool.setRejectPolicy(RejectPolicy::DROP_OLDEST);
+        pool.start(1);
+
+        std::atomic_bool started(false), gate(false);
+        pool.submit([&]() {
+            started = true;
+            while (!gate)
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        });
+        while (!started)
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+
+        auto start = Clock::now();
+        auto keyed = pool.submit_keyed(1, []() { return 7; });
+        for (int i = 0; i < 64; i++)
+            pool.submit([]() {});   // 前 63 个排满队列，最后一个挤队头的 strand
+        gate = true;
+        pool.wait_idle();
+        double secs = seconds_since(start);
+        PoolStats ps = pool.stats();
+
+        int got = -1;
+        try {
+            got = keyed.get();
+        } catch (const char*) {
+        }
+        report("reject", "drop-oldest/keyed", 1, 65, secs);
+        printf("%-10s %-18s keyed result=%d  caller runs=%llu dropped=%llu\n", "", "", got,
+               (unsigned long long)ps.caller_runs, (unsigned long long)ps.dropped);
+        if (got != 7 || ps.dropped != 0 || ps.caller_runs != 1)
+            fail("reject: DROP_OLDEST evicted an internal job (keyed result=%d dropped=%llu)\n",
+                 got, (unsigned long long)ps.dropped);
+    }
+}
+
+// 进程用掉的 CPU 时间（用户态 + 内核态），秒
+static double cpu_seconds() {
+    struct rusage ru;
+    getrusage(RUSAGE_SELF, &ru);
+    return ru.ru_utime.tv_sec + ru.ru_stime.tv_sec + (ru.ru_utime.tv_usec + ru.ru_stime.tv_usec) / 1e6;
+}
+
+// 计算任务里夹着会阻塞的任务（sleep 模拟读磁盘）：不告诉线程池时，阻塞的任务占着线程，CPU 闲着
+// 用 BlockingRegion 包住阻塞的那一段，线程池临时补线程，CPU 利用率（相对 min(线程数, CPU 数)）应该接近 100%
+static void bench_blocking(int threads) {
+    const long cpu_tasks = 2000;
+    const long cpu_ns = 500000;
+    const int block_every = 10;     // 每 10 个计算任务之后有 1 个阻塞 5ms
+    const auto block_time = std::chrono::milliseconds(5);
+    unsigned cpus = std::max(1u, std::min<unsigned>(threads, std::thread::hardware_concurrency()));
+
+    for (PoolMode mode : {PoolMode::MODE_FIXED, PoolMode::MODE_STEAL, PoolMode::MODE_CACHED}) {
+        for (bool region : {false, true}) {
+            ThreadPool pool;
+            pool.setMode(mode);
+            pool.setThreadThreshHold(4 * threads);  // 最多同时补 3 倍的替补线程
+            pool.start(threads);
+
+            auto start = Clock::now();
+            double cpu_start = cpu_seconds();
+            std::atomic_uint peak(0);
+            for (long i = 0; i < cpu_tasks; i++) {
+                pool.submit(spin_for, cpu_ns);
+                if (i % block_every == 0) {
+                    pool.submit([&pool, &peak, region, block_time]() {
+                        if (region) {
+                            BlockingRegion blocking;
+                            std::this_thread::sleep_for(block_time);
+                        } else {
+                            std::this_thread::sleep_for(block_time);
+                        }
+                        unsigned n = pool.stats().threads;
+                        unsigned seen = peak;
+                        while (n > seen && !peak.compare_exchange_weak(seen, n)) {}
+                    });
+                }
+            }
+            pool.wait_idle();
+            double secs = seconds_since(start);
+            double util = (cpu_seconds() - cpu_start) / (secs * cpus);
+
+            // 阻塞都结束了，替补线程回来取任务时退出
+            std::this_thread::sleep_for(std::chrono::milliseconds(20));
+            PoolStats ps = pool.stats();
+
+            char variant[32];
+            snprintf(variant, sizeof(variant), "%s%s", mode_name(mode), region ? "+region" : "");
+            report("blocking", variant, threads, cpu_tasks + cpu_tasks / block_every, secs);
+            printf("%-10s %-18s cpu util=%.0f%%  peak threads=%u  spares spawned=%llu  threads after=%u\n", "", "",
+                   util * 100, peak.load(), (unsigned long long)ps.compensations, ps.threads);
+            metric("cpu_util", util);
+            metric("peak_threads", peak.load());
+            metric("compensations", ps.compensations);
+            if (region && mode != PoolMode::MODE_CACHED && ps.threads != static_cast<unsigned>(threads))
+                fail("blocking: %u threads left after the blocking tasks returned\n", ps.threads);
+            if (ps.blocked_threads != 0)
+                fail("blocking: %u threads still counted as blocked\n", ps.blocked_threads);
+        }
+    }
+
+    // 上面 MODE_CACHED 剩下的线程是控制线程因为排队时间超过目标加的，按 cached 模式的规则空闲超时才退出；
+    // 阻塞区补的替补线程和其它模式一样，阻塞区结束就退出。排队时间的目标设得很大，控制线程就不会加线程
+    {
+        ThreadPool pool;
+        pool.setMode(PoolMode::MODE_CACHED);
+        pool.setThreadThreshHold(4 * threads);
+        pool.setTargetQueueLatency(std::chrono::hours(1));
+        pool.start(threads);
+
+        const int n = 8 * threads;
+        for (int i = 0; i < n; i++) {
+            pool.submit([]() {
+                BlockingRegion blocking;
+                std::this_thread::sleep_for(std::chrono::milliseconds(5));
+            });
+        }
+        pool.wait_idle();
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+        PoolStats ps = pool.stats();
+
+        printf("%-10s %-18s spares spawned=%llu  threads after=%u (base %d)\n", "blocking", "MODE_CACHED/spares",
+               (unsigned long long)ps.compensations, ps.threads, threads);
+        if (ps.threads != static_cast<unsigned>(threads))
+            fail("blocking: %u threads left in cached mode after the blocking regions ended\n", ps.threads);
+    }
+}
+
+// 1MB 的结果：拷贝时真的拷贝 1MB 并计数，移动只交换指针（内容不初始化，只写头尾两个字节）
+static std::atomic_long payload_copies(0);
+
+struct Payload {
+    static constexpr std::size_t Size = 1 << 20;
+
+    Payload() : bytes(new char[Size]) {
+        bytes[0] = 1;
+        bytes[Size - 1] = 2;
+    }
+    Payload(const Payload& other) : bytes(new char[Size]) {
+        std::memcpy(bytes.get(), other.bytes.get(), Size);
+        payload_copies.fetch_add(1, std::memory_order_relaxed);
+    }
+    Payload(Payload&&) noexcept = default;
+
+    long check() const { return bytes[0] + bytes[Size - 1]; }
+
+    std::unique_ptr<char[]> bytes;
+};
+
+class PayloadTask : public Task {
+public:
+    Any run() {
+        Payload payload;
+        return payload;     // 按右值移进 Any
+    }
+};
+
+class UniquePayloadTask : public Task {
+public:
+    Any run() { return std::make_unique<Payload>(); }
+};
+
+// 任务返回 1MB 的结果：老接口 Task/Any/Result 和 submit/Future 一路移动，不拷贝结果
+// 同时在途的任务最多 64 个，取回结果就释放
+static void bench_payload(int threads) {
+    const long n = 100000;
+    const long window = 64;
+
+    auto run = [threads](const char* variant, long tasks, auto submit_one, auto take) {
+        ThreadPool pool;
+        pool.start(threads);
+        payload_copies = 0;
+        long sum = 0;
+        using Handle = decltype(submit_one(pool));
+        std::deque<Handle> inflight;
+        auto start = Clock::now();
+        for (long i = 0; i < tasks; i++) {
+            inflight.push_back(submit_one(pool));
+            if (static_cast<long>(inflight.size()) >= window) {
+                sum += take(inflight.front());
+                inflight.pop_front();
+            }
+        }
+        while (!inflight.empty()) {
+            sum += take(inflight.front());
+            inflight.pop_front();
+        }
+        double secs = seconds_since(start);
+
+        report("payload", variant, threads, tasks, secs);
+        printf("%-10s %-18s payload copies=%ld\n", "", "", payload_copies.load());
+        metric("payload_copies", payload_copies.load());
+        if (sum != 3 * tasks)
+            fail("payload: %s got wrong bytes\n", variant);
+        return payload_copies.load();
+    };
+
+    long copies = run("Result/cast_&&", n,
+        [](ThreadPool& pool) { return pool.submitTask(std::make_shared<PayloadTask>()); },
+        [](Result& res) { return res.get().cast_<Payload>().check(); });
+    copies += run("Result/unique_ptr", n,
+        [](ThreadPool& pool) { return pool.submitTask(std::make_shared<UniquePayloadTask>()); },
+        [](Result& res) { return res.get().cast_<std::unique_ptr<Payload>>()->check(); });
+    copies += run("submit/Future", n,
+        [](ThreadPool& pool) { return pool.submit([]() { return Payload(); }); },
+        [](Future<Payload>& fut) { return fut.get().check(); });
+    copies += run("submit/then", n,
+        [](ThreadPool& pool) {
+            return pool.submit([]() { return Payload(); }).then([](Payload p) { return p; });
+        },
+        [](Future<Payload>& fut) { return fut.get().check(); });
+    if (copies != 0)
+        fail("payload: %ld payload copies on the move-through paths\n", copies);
+
+    // 对比：左值的 Any 取结果要拷贝一份（每个任务 1 次）
+    long lvalue = run("Result/cast_&", n / 10,
+        [](ThreadPool& pool) { return pool.submitTask(std::make_shared<PayloadTask>()); },
+        [](Result& res) {
+            Any any = res.get();
+            return any.cast_<Payload>().check();
+        });
+    if (lvalue != n / 10)
+        fail("payload: expected %ld copies through an lvalue Any, got %ld\n", n / 10, lvalue);
+}
+
+// 按 key 串行：10000 个 key，按 Zipf 分布（s=1）取，最热的 key 占了一成多的任务
+// 每个任务给自己的 key 的状态加一；检查同一个 key 的任务按提交顺序执行、没有同时执行
+// 对比：普通 submit + 每个 key 一把锁，同一个 key 的任务互斥，但顺序没有保证，抢锁的线程干等
+struct alignas(64) KeyState {
+    long next_seq = 0;          // 下一个应该执行的序号
+    std::atomic<int> busy{0};
+    int last_thread = -1;       // 上一个任务在哪个线程上执行
+    long migrations = 0;        // 相邻两个任务换了线程的次数
+    long data[4] = {};
+};
+
+static std::atomic<int> next_thread_index(0);
+
+static int thread_index() {
+    static thread_local int index = next_thread_index++;
+    return index;
+}
+
+static void bench_keyed(int threads) {
+    const int keys = 10000;
+    const long n = 200000;
+
+    // Zipf 的累积分布，按固定种子抽样，每种方式回放同一串 key
+    std::vector<double> cdf(keys);
+    double total = 0;
+    for (int k = 0; k < keys; k++) {
+        total += 1.0 / (k + 1);
+        cdf[k] = total;
+    }
+    std::mt19937 rng(42);
+    std::uniform_real_distribution<double> uniform(0, total);
+    std::vector<int> key_of(n);
+    for (long i = 0; i < n; i++)
+        key_of[i] = static_cast<int>(std::lower_bound(cdf.begin(), cdf.end(), uniform(rng)) - cdf.begin());
+
+    auto run = [&](const char* variant, PoolMode mode, bool keyed) {
+        ThreadPool pool;
+        pool.setMode(mode);
+        pool.start(threads);
+        std::unique_ptr<KeyState[]> state(new KeyState[keys]);
+        std::unique_ptr<std::mutex[]> locks(new std::mutex[keys]);
+        std::vector<long> seq(keys, 0);
+        std::atomic<long> reordered(0);
+        std::atomic<long> overlapped(0);
+
+        auto work = [&reordered, &overlapped](KeyState* ks, long s) {
+            if (ks->busy.exchange(1, std::memory_order_acquire) != 0)
+                overlapped++;
+            if (ks->next_seq != s)
+                reordered++;
+            ks->next_seq = s + 1;
+            int me = thread_index();
+            if (ks->last_thread != -1 && ks->last_thread != me)
+                ks->migrations++;
+            ks->last_thread = me;
+            for (int r = 0; r < 64; r++)
+                ks->data[r & 3] += r;
+            ks->busy.store(0, std::memory_order_release);
+        };
+
+        auto start = Clock::now();
+        for (long i = 0; i < n; i++) {
+            int k = key_of[i];
+            KeyState* ks = &state[k];
+            long s = seq[k]++;
+            if (keyed) {
+                pool.submit_keyed(k, work, ks, s);
+            } else {
+                std::mutex* m = &locks[k];
+                pool.submit([&work, ks, s, m]() {
+                    std::lock_guard<std::mutex> lock(*m);
+                    work(ks, s);
+                });
+            }
+        }
+        pool.wait_idle();
+        double secs = seconds_since(start);
+
+        long migrations = 0;
+        for (int k = 0; k < keys; k++)
+            migrations += state[k].migrations;
+        report("keyed", variant, threads, n, secs);
+        printf("%-10s %-18s reordered=%ld overlapped=%ld thread switches=%.1f%%\n", "", "",
+               reordered.load(), overlapped.load(), 100.0 * migrations / n);
+        metric("reordered", reordered.load());
+        metric("overlapped", overlapped.load());
+        metric("thread_switch_pct", 100.0 * migrations / n);
+        if (overlapped != 0 || (keyed && reordered != 0))
+            fail("keyed: %s broke per-key ordering\n", variant);
+    };
+
+    run("keyed/FIXED", PoolMode::MODE_FIXED, true);
+    run("keyed/STEAL", PoolMode::MODE_STEAL, true);
+    run("mutex/FIXED", PoolMode::MODE_FIXED, false);
+    run("mutex/STEAL", PoolMode::MODE_STEAL, false);
+}
+
+// 剖析：4 个生产者往 256 个位置的队列里灌 1us 的小任务，队列经常是满的
+// make PROFILE=1 编译时输出每个线程 等锁/持锁、等空位、睡眠、唤醒延迟、任务耗时 的汇总表，
+// 检查表里记下的任务数和执行的一样多；普通编译时只有吞吐，对比两次的吞吐就是剖析本身的开销
+static void bench_profile(int threads) {
+    const int producers = 4;
+    const long per_producer = 50000;
+    const long n = producers * per_producer;
+
+    for (PoolMode mode : {PoolMode::MODE_FIXED, PoolMode::MODE_STEAL}) {
+        Profiler::reset();
+        ThreadPool pool;
+        pool.setMode(mode);
+        pool.setTaskqueMaxThreshHold(256);
+        pool.start(threads);
+
+        auto start = Clock::now();
+        std::vector<std::thread> submitters;
+        for (int p = 0; p < producers; p++) {
+            submitters.emplace_back([&pool]() {
+                for (long i = 0; i < per_producer; i++)
+                    pool.submit([]() { spin_for(1000); });
+            });
+        }
+        for (auto& t : submitters)
+            t.join();
+        pool.shutdown();
+        double secs = seconds_since(start);
+
+        report("profile", mode_name(mode), threads, n, secs);
+#ifdef THREADPOOL_PROFILE
+        uint64_t recorded = 0, full_ns = 0, wait_ns = 0;
+        for (const ThreadProfile& tp : Profiler::snapshot()) {
+            recorded += tp[ProfilePoint::TASK_NS].count;
+            full_ns += tp[ProfilePoint::FULL_WAIT].sum;
+            wait_ns += tp[ProfilePoint::QUEUE_LOCK_WAIT].sum;
+        }
+        Profiler::report(std::cout);
+        metric("full_wait_ms", full_ns / 1e6);
+        metric("queue_lock_wait_ms", wait_ns / 1e6);
+        if (recorded != static_cast<uint64_t>(n))
+            fail("profile: %lu tasks recorded, %ld executed\n", (unsigned long)recorded, n);
+#else
+        printf("%-10s %-18s built without THREADPOOL_PROFILE, nothing recorded\n", "profile", "");
+#endif
+    }
+}
+
+struct Scenario {
+    const char* name;
+    void (*fn)(int threads);
+};
+
+static const Scenario scenarios[] = {
+    {"steal", bench_steal},
+    {"future", bench_future},
+    {"producer", bench_producer},
+    {"trace", bench_trace},
+    {"stats", bench_stats},
+    {"batch", bench_batch},
+    {"parallel", bench_parallel},
+    {"wakeup", bench_wakeup},
+    {"priority", bench_priority},
+    {"timer", bench_timer},
+    {"dag", bench_dag},
+    {"alloc", bench_alloc},
+    {"affinity", bench_affinity},
+    {"elastic", bench_elastic},
+    {"lifecycle", bench_lifecycle},
+    {"shed", bench_shed},
+    {"latency", bench_latency},
+    {"fanin", bench_fanin},
+    {"mixed", bench_mixed},
+    {"groups", bench_groups},
+    {"forkjoin", bench_forkjoin},
+    {"blocking", bench_blocking},
+    {"payload", bench_payload},
+    {"keyed", bench_keyed},
+    {"profile", bench_profile},
+};
+
+int main(int argc, char* argv[]) {
+    // 位置参数：场景名、线程数；--csv / --json 后面跟输出文件
+    const char* positional[2] = {"all", nullptr};
+    const char* csv_path = nullptr;
+    const char* json_path = nullptr;
+    int npos = 0;
+    for (int i = 1; i < argc; i++) {
+        if (std::strcmp(argv[i], "--csv") == 0 && i + 1 < argc) {
+            csv_path = argv[++i];
+        } else if (std::strcmp(argv[i], "--json") == 0 && i + 1 < argc) {
+            json_path = argv[++i];
+        } else if (argv[i][0] == '-' && argv[i][1] == '-') {
+            fprintf(stderr, "usage: %s [scenario|all] [threads] [--csv file] [--json file]\n", argv[0]);
+            return 1;
+        } else if (npos < 2) {
+            positional[npos++] = argv[i];
+        }
+    }
+
+    const char* which = positional[0];
+    int threads = positional[1] ? std::atoi(positional[1])
+                                : static_cast<int>(std::thread::hardware_concurrency());
+    if (threads <= 0) threads = 4;
+
+    bool found = false;
+    for (const Scenario& s : scenarios) {
+        if (std::strcmp(which, "all") == 0 || std::strcmp(which, s.name) == 0) {
+            s.fn(threads);
+            found = true;
+        }
+    }
+
+    if (!found) {
+        fprintf(stderr, "unknown scenario: %s\n", which);
+        return 1;
+    }
+    if (csv_path != nullptr)
+        write_csv(csv_path);
+    if (json_path != nullptr)
+        write_json(json_path, which, threads);
+    if (failures > 0) {
+        fprintf(stderr, "%ld check(s) failed\n", failures);
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,223 @@
+#include "coro.hh"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+
+/**
+ * 协程（coro.hh）的检查和基准测试，需要 C++20，用 make coro 编译
+ *
+ * 用法: ./bench/bench_coro [场景名|all] [线程数]
+ */
+
+using Clock = std::chrono::steady_clock;
+
+static double seconds_since(Clock::time_point start) {
+    return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+static long errors = 0;
+
+static void check(bool ok, const char* what) {
+    if (!ok) {
+        printf("coro: %s failed\n", what);
+        errors++;
+    }
+}
+
+class AnswerTask : public Task {
+public:
+    Any run() { return 42; }
+};
+
+static CoTask<long> depth(long n) {
+    if (n == 0)
+        co_return 0;
+    co_return 1 + co_await depth(n - 1);
+}
+
+static CoTask<std::thread::id> hop(ThreadPool& pool) {
+    co_await pool.schedule();
+    co_return std::this_thread::get_id();
+}
+
+// 在线程池的线程上 等同一个线程池的任务：用 get() 的话只有 1 个线程时会死锁
+static CoTask<long> fan_out(ThreadPool& pool, int n) {
+    co_await pool.schedule();
+    std::vector<Future<long>> futures;
+    for (int i = 0; i < n; i++)
+        futures.push_back(pool.submit([](long x) { return x; }, i));
+    long sum = 0;
+    for (auto& fut : futures)
+        sum += co_await fut;
+    co_return sum;
+}
+
+static CoTask<std::string> await_errors(ThreadPool& pool) {
+    co_await pool.schedule();
+    std::string out;
+    try {
+        co_await pool.submit([] { throw "boom"; });
+    } catch (const char* e) {
+        out += e;
+    }
+    Future<int> invalid;
+    try {
+        co_await invalid;
+    } catch (const char* e) {
+        out += std::string(" / ") + e;
+    }
+    co_return out;
+}
+
+static CoTask<int> await_result(ThreadPool& pool) {
+    Any any = co_await pool.submitTask(std::make_shared<AnswerTask>());
+    co_return any.cast_<int>();
+}
+
+// 在调用者的线程上提交：任务排在 blocker 后面，取消时还没出队
+static CoTask<void> await_cancelled(ThreadPool& pool, CancelSource& source, bool& queued, bool& threw,
+                                   std::thread::id& resumed_on) {
+    TaskOptions opts;
+    opts.token = source.token();
+    auto blocker = pool.submit([] { std::this_thread::sleep_for(std::chrono::milliseconds(20)); });
+    auto fut = pool.submit_with(opts, [] { return 1; });
+    queued = !source.cancelled();
+    try {
+        co_await fut;
+    } catch (const char*) {
+        threw = true;
+    }
+    resumed_on = std::this_thread::get_id();
+    co_await blocker;
+}
+
+// 正确性：返回值、异常、嵌套、在线程池的线程上恢复、只有 1 个线程时不死锁、取消、关闭
+static void bench_coro(int threads) {
+    {
+        ThreadPool pool;
+        pool.start(threads);
+
+        check(sync_wait(depth(10000)) == 10000, "nested CoTask");
+        check(sync_wait(hop(pool)) != std::this_thread::get_id(), "schedule() resumes on a worker");
+        check(sync_wait(fan_out(pool, 10000)) == 10000L * 9999 / 2, "co_await submit");
+        check(sync_wait(await_errors(pool)) == "boom / future is invalid!", "exceptions through co_await");
+        check(sync_wait(await_result(pool)) == 42, "co_await submitTask");
+    }
+
+    {
+        ThreadPool pool;
+        pool.start(1);
+        check(sync_wait(fan_out(pool, 1000)) == 1000L * 999 / 2, "co_await on a 1-thread pool");
+
+        // 唯一的线程在执行 blocker，被取消的任务还在排队：取消的线程完成任务的共享状态，
+        // 协程的恢复放进任务队列，由线程池的线程执行（取消的线程不是线程池的线程）
+        CancelSource source;
+        bool queued = false, threw = false;
+        std::thread::id resumed_on;
+        std::thread canceller([&source] {
+            std::this_thread::sleep_for(std::chrono::milliseconds(5));
+            source.cancel();
+        });
+        std::thread::id canceller_id = canceller.get_id();
+        sync_wait(await_cancelled(pool, source, queued, threw, resumed_on));
+        canceller.join();
+        check(queued, "token not cancelled yet when the task is submitted");
+        check(threw, "co_await a cancelled future");
+        check(resumed_on != canceller_id && resumed_on != std::this_thread::get_id(),
+              "coroutine cancelled while queued resumes on a worker");
+
+        pool.shutdown();
+        bool rejected = false;
+        try {
+            sync_wait(hop(pool));
+        } catch (const char*) {
+            rejected = true;
+        }
+        check(rejected, "schedule() after shutdown throws");
+    }
+
+    printf("%-10s %-18s threads=%-3d errors=%ld\n", "coro", "checks", threads, errors);
+}
+
+static void report(const char* variant, int threads, long rounds, double secs) {
+    printf("%-10s %-18s threads=%-3d rounds=%-8ld %10.2f ms %10.0f ns/round\n",
+           "pingpong", variant, threads, rounds, secs * 1e3, secs * 1e9 / rounds);
+}
+
+static CoTask<void> pingpong_submit(ThreadPool& pool, long rounds) {
+    co_await pool.schedule();
+    for (long i = 0; i < rounds; i++)
+        co_await pool.submit([] {});
+}
+
+static CoTask<void> pingpong_schedule(ThreadPool& pool, long rounds) {
+    for (long i = 0; i < rounds; i++)
+        co_await pool.schedule();
+}
+
+// 一来一回的延迟：提交一个空任务、等它完成、接着执行
+// get() 是外部线程阻塞在 futex 上；co_await 时协程在线程池里，由执行完空任务的线程直接恢复
+static void bench_pingpong(int threads) {
+    const long rounds = 200000;
+
+    {
+        ThreadPool pool;
+        pool.start(threads);
+        auto start = Clock::now();
+        for (long i = 0; i < rounds; i++)
+            pool.submit([] {}).get();
+        report("get()", threads, rounds, seconds_since(start));
+    }
+
+    {
+        ThreadPool pool;
+        pool.start(threads);
+        auto start = Clock::now();
+        sync_wait(pingpong_submit(pool, rounds));
+        report("co_await submit", threads, rounds, seconds_since(start));
+    }
+
+    {
+        ThreadPool pool;
+        pool.start(threads);
+        auto start = Clock::now();
+        sync_wait(pingpong_schedule(pool, rounds));
+        report("co_await schedule", threads, rounds, seconds_since(start));
+    }
+}
+
+struct Scenario {
+    const char* name;
+    void (*fn)(int threads);
+};
+
+static const Scenario scenarios[] = {
+    {"coro", bench_coro},
+    {"pingpong", bench_pingpong},
+};
+
+int main(int argc, char* argv[]) {
+    const char* which = argc > 1 ? argv[1] : "all";
+    int threads = argc > 2 ? std::atoi(argv[2])
+                           : static_cast<int>(std::thread::hardware_concurrency());
+    if (threads <= 0) threads = 4;
+
+    bool found = false;
+    for (const Scenario& s : scenarios) {
+        if (std::strcmp(which, "all") == 0 || std::strcmp(which, s.name) == 0) {
+            s.fn(threads);
+            found = true;
+        }
+    }
+
+    if (!found) {
+        fprintf(stderr, "unknown scenario: %s\n", which);
+        return 1;
+    }
+    return errors == 0 ? 0 : 1;
+}
@@ -0,0 +1,146 @@
+#include "block_pool.hh"
+
+#include <atomic>
+#include <cstdlib>
+#include <mutex>
+
+namespace {
+
+const int Size_classes = 4;             // 64 128 256 512
+const std::size_t Min_block = 64;
+const std::size_t Batch_size = 32;      // 线程和仓库之间一次转移的块数
+
+// 空闲的块：next 串成本地链表，整批放进仓库时第一块的 next_batch 把各批串起来
+struct FreeBlock {
+    FreeBlock* next;
+    FreeBlock* next_batch;
+};
+
+int class_of(std::size_t size) {
+    int c = 0;
+    std::size_t block = Min_block;
+    while (block < size) {
+        block <<= 1;
+        c++;
+    }
+    return c;
+}
+
+std::size_t block_size(int c) { return Min_block << c; }
+
+// 全局仓库：每档一个整批的栈
+struct Depot {
+    std::mutex mutx;
+    FreeBlock* batches = nullptr;
+};
+
+// 故意不析构：线程退出时还要往里还块，不能比任何线程先没了
+Depot* depots() {
+    static Depot* d = new Depot[Size_classes];
+    return d;
+}
+
+std::atomic<uint64_t> system_alloc_count(0);
+
+// 向系统要一整批
+FreeBlock* carve(int c) {
+    std::size_t size = block_size(c);
+    char* chunk = static_cast<char*>(std::malloc(size * Batch_size));
+    if (chunk == nullptr)
+        throw std::bad_alloc();
+    system_alloc_count.fetch_add(1, std::memory_order_relaxed);
+
+    for (std::size_t i = 0; i < Batch_size; i++) {
+        auto block = reinterpret_cast<FreeBlock*>(chunk + i * size);
+        block->next = i + 1 < Batch_size ? reinterpret_cast<FreeBlock*>(chunk + (i + 1) * size) : nullptr;
+    }
+    return reinterpret_cast<FreeBlock*>(chunk);
+}
+
+// 每个线程每档一个空闲链表
+struct LocalCache {
+    FreeBlock* head[Size_classes] = {};
+    std::size_t count[Size_classes] = {};
+
+    // 线程退出：剩下的块都还给仓库（不一定凑够一整批，仓库里的批大小不要求一致）
+    ~LocalCache() {
+        for (int c = 0; c < Size_classes; c++) {
+            if (head[c] != nullptr)
+                push_batch(c, head[c]);
+            head[c] = nullptr;  // 之后其它 thread_local 析构时还可能用到，不能再把交出去的块分配出去
+            count[c] = 0;
+        }
+    }
+
+    void push_batch(int c, FreeBlock* batch) {
+        Depot& depot = depots()[c];
+        std::lock_guard<std::mutex> lock(depot.mutx);
+        batch->next_batch = depot.batches;
+        depot.batches = batch;
+    }
+
+    FreeBlock* pop_batch(int c) {
+        Depot& depot = depots()[c];
+        std::lock_guard<std::mutex> lock(depot.mutx);
+        FreeBlock* batch = depot.batches;
+        if (batch != nullptr)
+            depot.batches = batch->next_batch;
+        return batch;
+    }
+};
+
+thread_local LocalCache local_cache;
+
+} // namespace
+
+void* BlockPool::allocate(std::size_t size) {
+    if (size > MAX_BLOCK)
+        return ::operator new(size);
+
+    int c = class_of(size);
+    LocalCache& cache = local_cache;
+    FreeBlock* block = cache.head[c];
+    if (block == nullptr) {
+        block = cache.pop_batch(c);
+        if (block == nullptr)
+            block = carve(c);
+        // 仓库里的批可能是线程退出时还回来的零头，数一下
+        std::size_t n = 0;
+        for (FreeBlock* b = block; b != nullptr; b = b->next)
+            n++;
+        cache.count[c] = n;
+    }
+    cache.head[c] = block->next;
+    cache.count[c]--;
+    return block;
+}
+
+void BlockPool::deallocate(void* ptr, std::size_t size) {
+    if (ptr == nullptr) return;
+    if (size > MAX_BLOCK) {
+        ::operator delete(ptr);
+        return;
+    }
+
+    int c = class_of(size);
+    LocalCache& cache = local_cache;
+    auto block = static_cast<FreeBlock*>(ptr);
+    block->next = cache.head[c];
+    cache.head[c] = block;
+
+    // 攒够两批时把前一批交给仓库，留一批给自己之后分配
+    if (++cache.count[c] >= 2 * Batch_size) {
+        FreeBlock* batch = cache.head[c];
+        FreeBlock* last = batch;
+        for (std::size_t i = 1; i < Batch_size; i++)
+            last = last->next;
+        cache.head[c] = last->next;
+        last->next = nullptr;
+        cache.count[c] -= Batch_size;
+        cache.push_batch(c, batch);
+    }
+}
+
+uint64_t BlockPool::system_allocs() {
+    return system_alloc_count.load(std::memory_order_relaxed);
+}
@@ -0,0 +1,43 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <new>
+
+/**
+ * 小对象的块分配器：提交任务时的 任务+共享状态、Any 的数据、任务组 都从这里分配
+ *
+ * 按大小分成 64/128/256/512 字节四档，更大的直接走 ::operator new
+ * 每个线程每档一个空闲链表，分配/释放都不加锁；
+ * 本地链表攒多了整批（32 块）交给全局仓库，本地空了再从仓库整批取回，
+ * 生产者分配、工作线程释放 这种一边倒的流向也能循环起来
+ * 仓库也空了才向系统要一整批（一次 malloc 切成 32 块），稳定之后提交任务不再调用 malloc
+ *
+ * 对象可能比线程池活得长（Future 还在用户手里），所以分配器是进程级的
+ * 块只在线程之间流转，不还给系统，占用的内存等于历史峰值
+ */
+class BlockPool {
+public:
+    static constexpr std::size_t MAX_BLOCK = 512;
+
+    static void* allocate(std::size_t size);
+    static void deallocate(void* ptr, std::size_t size);
+
+    // 向系统要内存的次数（只算切块用的那几次），用于统计
+    static uint64_t system_allocs();
+};
+
+// 继承它的类用 BlockPool 分配；按 new 的对象实际大小分档，delete 时需要虚析构函数给出正确的大小
+class PoolAllocated {
+public:
+    static void* operator new(std::size_t size) { return BlockPool::allocate(size); }
+    static void operator delete(void* ptr, std::size_t size) { BlockPool::deallocate(ptr, size); }
+
+    // 超过默认对齐的类型不走块分配器
+    static void* operator new(std::size_t size, std::align_val_t align) {
+        return ::operator new(size, align);
+    }
+    static void operator delete(void* ptr, std::size_t size, std::align_val_t align) {
+        ::operator delete(ptr, size, align);
+    }
+};
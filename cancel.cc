@@ -0,0 +1,47 @@
+#include "cancel.hh"
+
+#include <vector>
+
+bool detail::CancelState::cancel() {
+    std::vector<CancelHook*> hooks;
+    {
+        std::lock_guard<std::mutex> lock(mutx_);
+        if (cancelled_.load(std::memory_order_relaxed))
+            return false;
+        cancelled_.store(true, std::memory_order_release);
+
+        // 持锁摘下所有节点：fire 会完成任务、触发后继，可能又往这个取消源上登记，不能在锁里调用
+        for (CancelHook* hook = head_.next; hook != &head_; hook = hook->next) {
+            hook->hold();
+            hook->linked = false;
+            hooks.push_back(hook);
+        }
+        head_.prev = head_.next = &head_;
+    }
+
+    for (CancelHook* hook : hooks)
+        hook->fire();
+    return true;
+}
+
+bool detail::CancelState::link(CancelHook* hook) {
+    std::lock_guard<std::mutex> lock(mutx_);
+    if (cancelled_.load(std::memory_order_relaxed))
+        return false;
+    hook->prev = head_.prev;
+    hook->next = &head_;
+    head_.prev->next = hook;
+    head_.prev = hook;
+    hook->linked = true;
+    return true;
+}
+
+void detail::CancelState::unlink(CancelHook* hook) {
+    std::lock_guard<std::mutex> lock(mutx_);
+    if (!hook->linked)
+        return;
+    hook->prev->next = hook->next;
+    hook->next->prev = hook->prev;
+    hook->prev = hook->next = nullptr;
+    hook->linked = false;
+}
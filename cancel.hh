@@ -0,0 +1,119 @@
+#pragma once
+
+#include <atomic>
+#include <mutex>
+#include <utility>
+
+#include "block_pool.hh"
+
+/**
+ * 协作式取消：CancelSource 发出取消，CancelToken 查询
+ * 和 C++20 的 std::stop_source / std::stop_token 一个意思
+ *
+ * 带令牌提交的任务登记在取消源上：取消时还没开始执行的任务马上带着 "task is cancelled!" 完成，
+ * Future::get() 不用等它排到队头；已经在执行的任务由任务自己检查令牌（或者 ThreadPool::stop_requested()）
+ */
+
+namespace detail {
+
+// 登记在取消源上的节点（侵入式双向链表），由线程池的任务对象实现
+struct CancelHook {
+    CancelHook* prev = nullptr;
+    CancelHook* next = nullptr;
+    bool linked = false;    // 受所在取消源的锁保护
+
+    // 取消时在持锁的情况下调用：之后节点被摘下来，fire 之前所属的对象不能被释放
+    virtual void hold() = 0;
+    // 取消时在锁外调用，调用完释放 hold 的那一份
+    virtual void fire() = 0;
+
+protected:
+    ~CancelHook() = default;
+};
+
+// 取消源和令牌共享的状态，引用计数
+class CancelState : public PoolAllocated {
+public:
+    CancelState() : refs_(1), cancelled_(false) {
+        head_.prev = head_.next = &head_;
+    }
+
+    void add_ref() { refs_.fetch_add(1, std::memory_order_relaxed); }
+    void release() {
+        if (refs_.fetch_sub(1, std::memory_order_acq_rel) == 1)
+            delete this;
+    }
+
+    bool cancelled() const { return cancelled_.load(std::memory_order_acquire); }
+
+    // 第一次调用返回 true：置取消标志，摘下所有登记的节点逐个 fire
+    bool cancel();
+
+    // 登记节点，已经取消了返回 false
+    bool link(CancelHook* hook);
+
+    // 摘下节点（不在链表上时什么也不做）
+    void unlink(CancelHook* hook);
+
+private:
+    // 自己构造的哨兵，只用 prev/next
+    struct Head : CancelHook {
+        void hold() override {}
+        void fire() override {}
+    };
+
+    std::atomic<int> refs_;
+    std::atomic_bool cancelled_;
+    std::mutex mutx_;
+    Head head_;
+};
+
+} // namespace detail
+
+// 只能查询的一方，可以随意复制；默认构造的令牌永远不会被取消
+class CancelToken {
+public:
+    CancelToken() = default;
+    ~CancelToken() { if (state_) state_->release(); }
+    CancelToken(const CancelToken& other) : state_(other.state_) { if (state_) state_->add_ref(); }
+    CancelToken(CancelToken&& other) noexcept : state_(other.state_) { other.state_ = nullptr; }
+    CancelToken& operator=(CancelToken other) noexcept {
+        std::swap(state_, other.state_);
+        return *this;
+    }
+
+    bool cancelled() const { return state_ != nullptr && state_->cancelled(); }
+
+    // 有没有关联的取消源
+    bool can_be_cancelled() const { return state_ != nullptr; }
+
+private:
+    friend class CancelSource;
+    friend class ThreadPool;
+    explicit CancelToken(detail::CancelState* state) : state_(state) { state_->add_ref(); }
+
+    detail::CancelState* state_ = nullptr;
+};
+
+// 发出取消的一方，复制之后共享同一个状态
+class CancelSource {
+public:
+    CancelSource() : state_(new detail::CancelState()) {}
+    ~CancelSource() { if (state_) state_->release(); }
+    CancelSource(const CancelSource& other) : state_(other.state_) { if (state_) state_->add_ref(); }
+    CancelSource(CancelSource&& other) noexcept : state_(other.state_) { other.state_ = nullptr; }
+    CancelSource& operator=(CancelSource other) noexcept {
+        std::swap(state_, other.state_);
+        return *this;
+    }
+
+    CancelToken token() const { return state_ ? CancelToken(state_) : CancelToken(); }
+
+    // 第一次调用返回 true；登记在上面的还没开始执行的任务在这里完成（调用者的线程上）
+    bool cancel() { return state_ != nullptr && state_->cancel(); }
+
+    bool cancelled() const { return state_ != nullptr && state_->cancelled(); }
+
+private:
+    detail::CancelState* state_;
+};
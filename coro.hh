@@ -0,0 +1,283 @@
+#pragma once
+
+#if __cplusplus < 202002L
+#error "coro.hh needs C++20 (e.g. make coro)"
+#endif
+
+#include <atomic>
+#include <coroutine>
+#include <exception>
+#include <optional>
+#include <utility>
+
+#include "threadpool.hh"
+
+/**
+ * 协程：在线程池上等待任务的结果，不占用线程
+ * 需要 C++20，只有包含这个头文件的源文件要用 -std=c++20 编译，线程池本身还是 C++17
+ *
+ * CoTask<T>                 惰性启动的协程，被 co_await 时才开始执行，执行完直接接着执行等它的协程
+ * co_await pool.schedule()  挂起，由线程池的线程接着执行
+ * co_await future / result  任务完成时，由完成它的线程（执行完当前任务后）接着执行，中间不阻塞任何线程
+ * sync_wait(task)           在普通线程里阻塞等一个协程执行完
+ *
+ * e.g.
+ *   CoTask<int> sum(ThreadPool& pool) {
+ *       co_await pool.schedule();
+ *       int a = co_await pool.submit(load, 1);
+ *       int b = co_await pool.submit(load, 2);
+ *       co_return a + b;
+ *   }
+ *   int s = sync_wait(sum(pool));
+ */
+
+template<typename T = void>
+class CoTask;
+
+namespace detail {
+
+// 恢复一个挂起的协程：嵌在 awaiter 里（也就是协程帧里），不用另外分配
+class ResumeJob : public Job {
+public:
+    template<typename Handle>
+    void bind(Handle h) {
+        addr_ = h.address();
+        resume_ = [](void* addr) { Handle::from_address(addr).resume(); };
+    }
+
+    // 恢复之后 awaiter 可能已经销毁，线程池不会再碰这个任务
+    void run() override { resume_(addr_); }
+
+    // 线程池关闭，不会再被线程取到：在当前线程恢复，由 awaiter 决定怎么处理
+    void cancel() override {
+        cancelled_ = true;
+        resume_(addr_);
+    }
+
+    bool cancelled() const { return cancelled_; }
+
+private:
+    void* addr_ = nullptr;
+    void (*resume_)(void*) = nullptr;
+    bool cancelled_ = false;
+};
+
+// 等一个任务完成再恢复：挂在任务的后继链表上，和 then() 的后继一样由完成它的线程调度
+class ResumeAfterJob : public ResumeJob, public Dependent {
+protected:
+    Job* as_job() override { return this; }
+};
+
+// CoTask 的 promise 里和返回值类型无关的部分
+class CoPromiseBase {
+public:
+    // 执行完：有等它的协程就直接转过去（对称转移，不占栈），否则是 sync_wait 在等，叫醒它
+    struct FinalAwaiter {
+        bool await_ready() noexcept { return false; }
+
+        template<typename Promise>
+        std::coroutine_handle<> await_suspend(std::coroutine_handle<Promise> h) noexcept {
+            CoPromiseBase& promise = h.promise();
+            if (promise.continuation_)
+                return promise.continuation_;
+            promise.done_.store(1, std::memory_order_release);
+            futex_wake(&promise.done_, 1);
+            return std::noop_coroutine();
+        }
+
+        void await_resume() noexcept {}
+    };
+
+    std::suspend_always initial_suspend() noexcept { return {}; }
+    FinalAwaiter final_suspend() noexcept { return {}; }
+    void unhandled_exception() { error_ = std::current_exception(); }
+
+    std::coroutine_handle<> continuation_;  // co_await 这个协程的协程
+    std::exception_ptr error_;
+    std::atomic<int> done_{0};              // sync_wait 用
+};
+
+template<typename T>
+class CoPromise : public CoPromiseBase {
+public:
+    template<typename U>
+    void return_value(U&& value) { value_.emplace(std::forward<U>(value)); }
+
+    T result() {
+        if (error_)
+            std::rethrow_exception(error_);
+        return std::move(*value_);
+    }
+
+private:
+    std::optional<T> value_;
+};
+
+template<>
+class CoPromise<void> : public CoPromiseBase {
+public:
+    void return_void() {}
+
+    void result() {
+        if (error_)
+            std::rethrow_exception(error_);
+    }
+};
+
+} // namespace detail
+
+// 协程的返回类型，只能移动；析构时销毁协程帧（还没执行完的不能析构）
+template<typename T>
+class CoTask {
+public:
+    struct promise_type : detail::CoPromise<T> {
+        CoTask get_return_object() {
+            return CoTask(std::coroutine_handle<promise_type>::from_promise(*this));
+        }
+    };
+
+    CoTask() = default;
+    ~CoTask() { if (handle_) handle_.destroy(); }
+
+    CoTask(const CoTask&) = delete;
+    CoTask& operator=(const CoTask&) = delete;
+    CoTask(CoTask&& other) noexcept : handle_(std::exchange(other.handle_, nullptr)) {}
+    CoTask& operator=(CoTask&& other) noexcept {
+        if (this != &other) {
+            if (handle_) handle_.destroy();
+            handle_ = std::exchange(other.handle_, nullptr);
+        }
+        return *this;
+    }
+
+    bool valid() const { return static_cast<bool>(handle_); }
+
+    // co_await 时才开始执行，在等它的协程所在的线程上
+    auto operator co_await() && noexcept {
+        struct Awaiter {
+            std::coroutine_handle<promise_type> handle;
+
+            bool await_ready() noexcept { return false; }
+            std::coroutine_handle<> await_suspend(std::coroutine_handle<> caller) noexcept {
+                handle.promise().continuation_ = caller;
+                return handle;
+            }
+            T await_resume() { return handle.promise().result(); }
+        };
+        return Awaiter{handle_};
+    }
+
+private:
+    template<typename U>
+    friend U sync_wait(CoTask<U> task);
+
+    explicit CoTask(std::coroutine_handle<promise_type> handle) : handle_(handle) {}
+
+    std::coroutine_handle<promise_type> handle_;
+};
+
+/**
+ * 在当前线程开始执行 task，阻塞到它执行完，返回结果（异常在这里重新抛出）
+ * 不要在线程池自己的线程里调用：它等的协程可能要在这个线程上恢复
+ */
+template<typename T>
+T sync_wait(CoTask<T> task) {
+    if (!task.handle_)
+        throw "task is invalid!";
+    auto& promise = task.handle_.promise();
+    task.handle_.resume();
+    while (promise.done_.load(std::memory_order_acquire) == 0)
+        detail::futex_wait(&promise.done_, 0);
+    return promise.result();
+}
+
+// co_await pool.schedule() 的 awaiter：线程池关闭时抛出 "task is cancelled!"
+class ScheduleAwaiter {
+public:
+    ScheduleAwaiter(ThreadPool* pool, int priority) : pool_(pool), priority_(priority) {}
+
+    bool await_ready() noexcept { return false; }
+
+    template<typename Handle>
+    bool await_suspend(Handle h) {
+        job_.bind(h);
+        if (pool_->post_resume(&job_, priority_))
+            return true;
+        rejected_ = true;   // 没入队，不用挂起
+        return false;
+    }
+
+    void await_resume() {
+        if (rejected_ || job_.cancelled())
+            throw "task is cancelled!";
+    }
+
+private:
+    ThreadPool* pool_;
+    int priority_;
+    bool rejected_ = false;
+    detail::ResumeJob job_;
+};
+
+inline ScheduleAwaiter ThreadPool::schedule(int priority) {
+    return ScheduleAwaiter(this, priority);
+}
+
+// co_await future 的 awaiter：等待期间不占用线程，结果（或者异常）和 get() 一样
+template<typename R>
+class FutureAwaiter {
+public:
+    explicit FutureAwaiter(Future<R>&& future) : future_(std::move(future)) {}
+
+    // 无效的 Future 不挂起，await_resume 里 get() 抛出 "future is invalid!"
+    bool await_ready() const noexcept { return !future_.valid() || future_.is_ready(); }
+
+    template<typename Handle>
+    bool await_suspend(Handle h) {
+        job_.bind(h);
+        // 挂上之后协程随时可能在别的线程恢复，返回值是唯一还能用的东西
+        return ThreadPool::resume_after(future_.state_, &job_);
+    }
+
+    R await_resume() { return future_.get(); }
+
+private:
+    Future<R> future_;
+    detail::ResumeAfterJob job_;
+};
+
+template<typename R>
+FutureAwaiter<R> operator co_await(Future<R>&& future) {
+    return FutureAwaiter<R>(std::move(future));
+}
+
+// co_await 之后 future 变为无效，和 get() 一样
+template<typename R>
+FutureAwaiter<R> operator co_await(Future<R>& future) {
+    return FutureAwaiter<R>(std::move(future));
+}
+
+// co_await submitTask(...) 的结果：和 Result::get() 一样，提交失败时得到 ""
+class ResultAwaiter : public FutureAwaiter<Any> {
+public:
+    explicit ResultAwaiter(Result&& result)
+        : FutureAwaiter<Any>(std::move(result.future_)), is_valid_(result.is_valid_) {}
+
+    bool await_ready() const noexcept { return !is_valid_ || FutureAwaiter<Any>::await_ready(); }
+
+    Any await_resume() {
+        if (!is_valid_) return "";
+        return FutureAwaiter<Any>::await_resume();
+    }
+
+private:
+    bool is_valid_;
+};
+
+inline ResultAwaiter operator co_await(Result&& result) {
+    return ResultAwaiter(std::move(result));
+}
+
+inline ResultAwaiter operator co_await(Result& result) {
+    return ResultAwaiter(std::move(result));
+}
@@ -0,0 +1,127 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+/**
+ * 有界无锁多生产者多消费者队列（Dmitry Vyukov 的 bounded MPMC queue）
+ *
+ * 每个槽位带一个序号 seq：
+ *   seq == pos      槽位空闲，生产者可以写入第 pos 个元素
+ *   seq == pos + 1  槽位已写入，消费者可以取出第 pos 个元素
+ * 生产者和消费者只在 enqueue_pos_/dequeue_pos_ 上 CAS，各自占一条 cache line，
+ * 槽位只有 16 字节，相邻的槽位共享 cache line，顺序访问对 cache 友好
+ *
+ * 容量向上取整到 2 的幂，队列只保存指针，不负责对象的生命周期
+ */
+template<typename T>
+class MpmcQueue {
+public:
+    explicit MpmcQueue(std::size_t capacity) {
+        std::size_t cap = 2;
+        while (cap < capacity) cap <<= 1;
+        mask_ = cap - 1;
+        slots_.reset(new Slot[cap]);
+        for (std::size_t i = 0; i < cap; i++)
+            slots_[i].seq.store(i, std::memory_order_relaxed);
+        enqueue_pos_.store(0, std::memory_order_relaxed);
+        dequeue_pos_.store(0, std::memory_order_relaxed);
+    }
+    ~MpmcQueue() = default;
+
+    MpmcQueue(const MpmcQueue&) = delete;
+    MpmcQueue& operator=(const MpmcQueue&) = delete;
+
+    // 队列满返回 false
+    bool push(T* item) {
+        std::size_t pos = enqueue_pos_.load(std::memory_order_relaxed);
+        for (;;) {
+            Slot& slot = slots_[pos & mask_];
+            std::size_t seq = slot.seq.load(std::memory_order_acquire);
+            intptr_t diff = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos);
+            if (diff == 0) {
+                if (enqueue_pos_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    slot.data = item;
+                    slot.seq.store(pos + 1, std::memory_order_release);
+                    return true;
+                }
+            } else if (diff < 0) {
+                return false;   // 这个槽位上一轮的元素还没被取走
+            } else {
+                pos = enqueue_pos_.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    /**
+     * 批量入队：一次 CAS 预留 min(n, 空位数) 个位置，再逐个写入，返回写入的个数
+     * 预留时已经确认这些位置上一轮的元素都被消费者取走了，只需要等它们把 seq 写回
+     */
+    std::size_t push_bulk(T* const* items, std::size_t n) {
+        std::size_t cap = mask_ + 1;
+        std::size_t pos = enqueue_pos_.load(std::memory_order_relaxed);
+        std::size_t k;
+        for (;;) {
+            std::size_t used = pos - dequeue_pos_.load(std::memory_order_acquire);
+            if (static_cast<intptr_t>(used) < 0) used = 0;  // 读到的 dequeue_pos_ 比 pos 新
+            k = used >= cap ? 0 : std::min(n, cap - used);
+            if (k == 0)
+                return 0;
+            if (enqueue_pos_.compare_exchange_weak(pos, pos + k, std::memory_order_relaxed))
+                break;
+        }
+
+        for (std::size_t i = 0; i < k; i++) {
+            Slot& slot = slots_[(pos + i) & mask_];
+            while (slot.seq.load(std::memory_order_acquire) != pos + i) {}
+            slot.data = items[i];
+            slot.seq.store(pos + i + 1, std::memory_order_release);
+        }
+        return k;
+    }
+
+    // 队列空返回 nullptr
+    T* pop() {
+        std::size_t pos = dequeue_pos_.load(std::memory_order_relaxed);
+        for (;;) {
+            Slot& slot = slots_[pos & mask_];
+            std::size_t seq = slot.seq.load(std::memory_order_acquire);
+            intptr_t diff = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos + 1);
+            if (diff == 0) {
+                if (dequeue_pos_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    T* item = slot.data;
+                    slot.seq.store(pos + mask_ + 1, std::memory_order_release);
+                    return item;
+                }
+            } else if (diff < 0) {
+                return nullptr; // 这个槽位还没写入
+            } else {
+                pos = dequeue_pos_.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    std::size_t capacity() const { return mask_ + 1; }
+
+    // 近似值，只用于统计
+    std::size_t size() const {
+        std::size_t e = enqueue_pos_.load(std::memory_order_relaxed);
+        std::size_t d = dequeue_pos_.load(std::memory_order_relaxed);
+        return e > d ? e - d : 0;
+    }
+
+private:
+    struct Slot {
+        std::atomic<std::size_t> seq;
+        T* data;
+    };
+
+    std::unique_ptr<Slot[]> slots_;
+    std::size_t mask_;
+
+    alignas(64) std::atomic<std::size_t> enqueue_pos_;
+    alignas(64) std::atomic<std::size_t> dequeue_pos_;
+};
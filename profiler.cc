@@ -0,0 +1,208 @@
+#include "profiler.hh"
+#include "stats.hh"
+
+#include <algorithm>
+#include <cstdio>
+#include <iostream>
+#include <memory>
+
+std::atomic_bool Profiler::report_at_shutdown_(false);
+
+// 单个线程的计数器：只有所属线程写，snapshot 时其它线程读
+class ProfileBuffer {
+public:
+    explicit ProfileBuffer(const std::string& name) : name(name) {}
+
+    void record(ProfilePoint point, uint64_t value) {
+        Point& p = points_[static_cast<int>(point)];
+        add(p.count, 1);
+        add(p.sum, value);
+        if (value > p.max.load(std::memory_order_relaxed))
+            p.max.store(value, std::memory_order_relaxed);
+        if (value != 0)
+            add(p.nonzero, 1);
+        p.hist.record(value);
+    }
+
+    ThreadProfile snapshot() const {
+        ThreadProfile tp;
+        tp.name = name;
+        for (int i = 0; i < static_cast<int>(ProfilePoint::COUNT); i++) {
+            const Point& p = points_[i];
+            ProfileStat& s = tp.points[i];
+            s.count = p.count.load(std::memory_order_relaxed);
+            s.sum = p.sum.load(std::memory_order_relaxed);
+            s.max = p.max.load(std::memory_order_relaxed);
+            s.nonzero = p.nonzero.load(std::memory_order_relaxed);
+            HistogramSnapshot hs;
+            p.hist.merge_into(hs.counts);
+            s.p50 = hs.percentile(50);
+            s.p99 = hs.percentile(99);
+        }
+        return tp;
+    }
+
+    void clear() {
+        for (Point& p : points_) {
+            p.count.store(0, std::memory_order_relaxed);
+            p.sum.store(0, std::memory_order_relaxed);
+            p.max.store(0, std::memory_order_relaxed);
+            p.nonzero.store(0, std::memory_order_relaxed);
+            p.hist.clear();
+        }
+    }
+
+    std::string name;       // 线程名，受 registry 的锁保护
+    uint64_t wake_ns = 0;   // 被唤醒的时间，还没取到任务（只有所属线程访问）
+
+private:
+    struct Point {
+        std::atomic<uint64_t> count{0};
+        std::atomic<uint64_t> sum{0};
+        std::atomic<uint64_t> max{0};
+        std::atomic<uint64_t> nonzero{0};
+        LatencyHistogram hist;
+    };
+
+    static void add(std::atomic<uint64_t>& counter, uint64_t n) {
+        counter.store(counter.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+    }
+
+    Point points_[static_cast<int>(ProfilePoint::COUNT)];
+};
+
+namespace {
+
+// 所有线程的计数器，线程退出后还保留着，直到进程结束
+struct Registry {
+    std::mutex mtx;
+    std::vector<std::unique_ptr<ProfileBuffer>> buffers;
+};
+
+Registry& registry() {
+    static Registry* reg = new Registry;  // 不析构，其它线程退出时可能还在用
+    return *reg;
+}
+
+thread_local ProfileBuffer* tls_buffer = nullptr;
+thread_local std::string tls_name;
+
+} // namespace
+
+ProfileBuffer* Profiler::local_buffer() {
+    if (tls_buffer == nullptr) {
+        Registry& reg = registry();
+        std::lock_guard<std::mutex> lock(reg.mtx);
+        std::string name = tls_name.empty() ? "thread " + std::to_string(reg.buffers.size()) : tls_name;
+        reg.buffers.emplace_back(new ProfileBuffer(name));
+        tls_buffer = reg.buffers.back().get();
+    }
+    return tls_buffer;
+}
+
+void Profiler::record(ProfilePoint point, uint64_t value) {
+    local_buffer()->record(point, value);
+}
+
+void Profiler::set_thread_name(const std::string& name) {
+    tls_name = name;
+    if (tls_buffer != nullptr) {
+        std::lock_guard<std::mutex> lock(registry().mtx);
+        tls_buffer->name = name;
+    }
+}
+
+void Profiler::woken(uint64_t wake_ns) {
+    local_buffer()->wake_ns = wake_ns;
+}
+
+void Profiler::dequeued() {
+    ProfileBuffer* buf = local_buffer();
+    if (buf->wake_ns == 0)
+        return;
+    uint64_t now = now_ns();
+    buf->record(ProfilePoint::WAKEUP, now > buf->wake_ns ? now - buf->wake_ns : 0);
+    buf->wake_ns = 0;
+}
+
+std::vector<ThreadProfile> Profiler::snapshot() {
+    Registry& reg = registry();
+    std::lock_guard<std::mutex> lock(reg.mtx);
+    std::vector<ThreadProfile> out;
+    for (auto& buf : reg.buffers)
+        out.push_back(buf->snapshot());
+    return out;
+}
+
+void Profiler::reset() {
+    std::lock_guard<std::mutex> lock(registry().mtx);
+    for (auto& buf : registry().buffers)
+        buf->clear();
+}
+
+void Profiler::report(std::ostream& os) {
+#ifndef THREADPOOL_PROFILE
+    os << "profiler: built without THREADPOOL_PROFILE (make PROFILE=1), nothing recorded\n";
+#endif
+    std::vector<ThreadProfile> threads = snapshot();
+
+    // 合计：次数、总和相加，最大值取最大；分位数没法合并，合计行不输出
+    ThreadProfile total;
+    total.name = "total";
+    for (const ThreadProfile& tp : threads) {
+        for (int i = 0; i < static_cast<int>(ProfilePoint::COUNT); i++) {
+            const ProfileStat& s = tp.points[i];
+            ProfileStat& t = total.points[i];
+            t.count += s.count;
+            t.sum += s.sum;
+            t.nonzero += s.nonzero;
+            t.max = std::max(t.max, s.max);
+        }
+    }
+
+    char line[512];
+    auto us = [](uint64_t ns) { return ns / 1000.0; };
+    auto ms = [](uint64_t ns) { return ns / 1e6; };
+    snprintf(line, sizeof(line),
+             "%-12s %9s %9s %9s | %9s %6s %10s %10s %10s | %10s %10s | %10s %10s | %9s %9s %9s\n",
+             "thread", "tasks", "task_ns", "cycles",
+             "qlock", "cont%", "qwait_us", "qmax_us", "qhold_us",
+             "pwait_us", "phold_us",
+             "full_ms", "park_ms",
+             "wakeups", "wake_p50", "wake_p99");
+    os << line;
+
+    auto row = [&](const ThreadProfile& tp, bool percentiles) {
+        const ProfileStat& task = tp[ProfilePoint::TASK_NS];
+        const ProfileStat& qwait = tp[ProfilePoint::QUEUE_LOCK_WAIT];
+        const ProfileStat& wake = tp[ProfilePoint::WAKEUP];
+        bool idle = task.count == 0 && qwait.count == 0 && tp[ProfilePoint::PARK_LOCK_WAIT].count == 0
+                    && tp[ProfilePoint::FULL_WAIT].count == 0 && tp[ProfilePoint::PARK].count == 0;
+        if (idle)
+            return;
+        snprintf(line, sizeof(line),
+                 "%-12s %9lu %9.0f %9.0f | %9lu %6.1f %10.1f %10.1f %10.1f | %10.1f %10.1f | %10.2f %10.2f | %9lu ",
+                 tp.name.c_str(), (unsigned long)task.count, task.mean(), tp[ProfilePoint::TASK_CYCLES].mean(),
+                 (unsigned long)qwait.count, qwait.count == 0 ? 0.0 : 100.0 * qwait.nonzero / qwait.count,
+                 us(qwait.sum), us(qwait.max), us(tp[ProfilePoint::QUEUE_LOCK_HOLD].sum),
+                 us(tp[ProfilePoint::PARK_LOCK_WAIT].sum), us(tp[ProfilePoint::PARK_LOCK_HOLD].sum),
+                 ms(tp[ProfilePoint::FULL_WAIT].sum), ms(tp[ProfilePoint::PARK].sum),
+                 (unsigned long)wake.count);
+        os << line;
+        if (percentiles)
+            snprintf(line, sizeof(line), "%8.1fus %8.1fus\n", us(wake.p50), us(wake.p99));
+        else
+            snprintf(line, sizeof(line), "%9s %9s\n", "-", "-");
+        os << line;
+    };
+    for (const ThreadProfile& tp : threads)
+        row(tp, true);
+    row(total, false);
+}
+
+void Profiler::shutdown_hook() {
+    if (!report_at_shutdown_.load(std::memory_order_relaxed))
+        return;
+    report(std::cerr);
+    reset();
+}
@@ -0,0 +1,191 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+/**
+ * 线程池的竞争和调度延迟剖析
+ *
+ * 每个线程一组计数器（只有自己写），按测量点累计 次数、总和、最大值 和 直方图：
+ * 等 taskque_mutx_ / park_mutx_ 的时间和持有它们的时间、生产者在 not_full_ 上等空位的时间、
+ * 线程睡眠等任务的时间、从被唤醒到开始执行任务的延迟、每个任务的执行时间（steady_clock 纳秒 和 rdtsc 周期）
+ *
+ * 编译期开关：定义 THREADPOOL_PROFILE 才会埋点（make PROFILE=1），否则 TP_PROFILE_* 展开为空，
+ * 两把锁还是 std::mutex / std::condition_variable，线程池的代码和不剖析时完全一样
+ * 结果：Profiler::report 随时输出汇总表，也可以 set_report_at_shutdown(true) 让每次 shutdown 时输出到 stderr
+ */
+
+enum class ProfilePoint : uint32_t {
+    QUEUE_LOCK_WAIT,    // 等 taskque_mutx_（没有竞争时记 0）
+    QUEUE_LOCK_HOLD,    // 持有 taskque_mutx_（条件变量上等待的时间不算）
+    PARK_LOCK_WAIT,     // 等 park_mutx_
+    PARK_LOCK_HOLD,     // 持有 park_mutx_
+    FULL_WAIT,          // 生产者等任务队列的空位（not_full_）
+    PARK,               // 线程睡眠等任务
+    WAKEUP,             // 唤醒方置位 到 被唤醒的线程取到任务
+    TASK_NS,            // 执行一个任务，纳秒
+    TASK_CYCLES,        // 执行一个任务，rdtsc 周期（不是 x86 时和 TASK_NS 一样）
+    COUNT,
+};
+
+// 一个测量点的汇总，时间单位纳秒（TASK_CYCLES 是周期）
+struct ProfileStat {
+    uint64_t count = 0;
+    uint64_t sum = 0;
+    uint64_t max = 0;
+    uint64_t p50 = 0;
+    uint64_t p99 = 0;
+    uint64_t nonzero = 0;   // 值不为 0 的次数（锁：发生竞争的次数）
+
+    double mean() const { return count == 0 ? 0 : static_cast<double>(sum) / count; }
+};
+
+struct ThreadProfile {
+    std::string name;       // 线程名，没起名字的（提交任务的外部线程）是 "thread N"
+    ProfileStat points[static_cast<int>(ProfilePoint::COUNT)];
+
+    const ProfileStat& operator[](ProfilePoint p) const { return points[static_cast<int>(p)]; }
+};
+
+class ProfileBuffer;
+
+class Profiler {
+public:
+    // 记录一次测量到当前线程的计数器
+    static void record(ProfilePoint point, uint64_t value);
+
+    // 给当前线程起个名字，显示在汇总表里
+    static void set_thread_name(const std::string& name);
+
+    // 当前线程被唤醒（wake_ns 是唤醒方置位的时间），下一次 dequeued() 时记一次 WAKEUP
+    static void woken(uint64_t wake_ns);
+    static void dequeued();
+
+    // 所有记录过数据的线程（包括已经退出的），线程还在写时读到的是近似值
+    static std::vector<ThreadProfile> snapshot();
+
+    // 汇总表：每个线程一行，最后一行是合计
+    static void report(std::ostream& os);
+
+    // 清零所有计数器（线程同时在写的话可能漏掉几次清零）
+    static void reset();
+
+    // 每次 shutdown（等线程退出的那种）结束时把汇总表输出到 stderr 并清零，默认关闭
+    static void set_report_at_shutdown(bool on) { report_at_shutdown_.store(on, std::memory_order_relaxed); }
+    static void shutdown_hook();
+
+    static uint64_t now_ns() {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    static uint64_t cycles() {
+#if defined(__x86_64__) || defined(__i386__)
+        return __rdtsc();
+#else
+        return now_ns();
+#endif
+    }
+
+private:
+    static ProfileBuffer* local_buffer();
+
+    static std::atomic_bool report_at_shutdown_;
+};
+
+// 作用域结束时记一次经过的时间
+class ProfileScope {
+public:
+    explicit ProfileScope(ProfilePoint point) : point_(point), start_(Profiler::now_ns()) {}
+    ~ProfileScope() { Profiler::record(point_, Profiler::now_ns() - start_); }
+
+    ProfileScope(const ProfileScope&) = delete;
+    ProfileScope& operator=(const ProfileScope&) = delete;
+
+private:
+    ProfilePoint point_;
+    uint64_t start_;
+};
+
+// 执行一个任务：同时记纳秒和周期
+class ProfileTaskScope {
+public:
+    ProfileTaskScope() : start_ns_(Profiler::now_ns()), start_cycles_(Profiler::cycles()) {}
+    ~ProfileTaskScope() {
+        Profiler::record(ProfilePoint::TASK_CYCLES, Profiler::cycles() - start_cycles_);
+        Profiler::record(ProfilePoint::TASK_NS, Profiler::now_ns() - start_ns_);
+    }
+
+    ProfileTaskScope(const ProfileTaskScope&) = delete;
+    ProfileTaskScope& operator=(const ProfileTaskScope&) = delete;
+
+private:
+    uint64_t start_ns_;
+    uint64_t start_cycles_;
+};
+
+/**
+ * 记录等待和持有时间的互斥锁，满足 Lockable，配合 std::condition_variable_any 使用
+ * 条件变量上等待时会 unlock / lock：等待的时间不算持有，醒来重新抢锁的时间算等待
+ */
+template<ProfilePoint Wait, ProfilePoint Hold>
+class ProfiledMutex {
+public:
+    void lock() {
+        if (mtx_.try_lock()) {
+            locked_ns_ = Profiler::now_ns();
+            Profiler::record(Wait, 0);
+            return;
+        }
+        uint64_t start = Profiler::now_ns();
+        mtx_.lock();
+        locked_ns_ = Profiler::now_ns();
+        Profiler::record(Wait, locked_ns_ - start);
+    }
+
+    bool try_lock() {
+        if (!mtx_.try_lock())
+            return false;
+        locked_ns_ = Profiler::now_ns();
+        return true;
+    }
+
+    void unlock() {
+        uint64_t held = Profiler::now_ns() - locked_ns_;
+        mtx_.unlock();
+        Profiler::record(Hold, held);
+    }
+
+private:
+    std::mutex mtx_;
+    uint64_t locked_ns_ = 0;    // 受 mtx_ 保护
+};
+
+#ifdef THREADPOOL_PROFILE
+#define TP_PROFILE_CAT_(a, b) a##b
+#define TP_PROFILE_CAT(a, b) TP_PROFILE_CAT_(a, b)
+#define TP_PROFILE_SCOPE(point) ProfileScope TP_PROFILE_CAT(tp_profile_, __LINE__)(ProfilePoint::point)
+#define TP_PROFILE_TASK_SCOPE() ProfileTaskScope TP_PROFILE_CAT(tp_profile_, __LINE__)
+#define TP_PROFILE_THREAD_NAME(name) Profiler::set_thread_name(name)
+#define TP_PROFILE_STAMP(var) (var).store(Profiler::now_ns(), std::memory_order_relaxed)
+#define TP_PROFILE_WOKEN(var) Profiler::woken((var).load(std::memory_order_relaxed))
+#define TP_PROFILE_DEQUEUED() Profiler::dequeued()
+#define TP_PROFILE_SHUTDOWN() Profiler::shutdown_hook()
+#else
+#define TP_PROFILE_SCOPE(point) ((void)0)
+#define TP_PROFILE_TASK_SCOPE() ((void)0)
+#define TP_PROFILE_THREAD_NAME(name) ((void)0)
+#define TP_PROFILE_STAMP(var) ((void)0)
+#define TP_PROFILE_WOKEN(var) ((void)0)
+#define TP_PROFILE_DEQUEUED() ((void)0)
+#define TP_PROFILE_SHUTDOWN() ((void)0)
+#endif
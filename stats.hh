@@ -0,0 +1,190 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/**
+ * 线程池的统计信息
+ *
+ * 每个线程的计数器和直方图都放在自己的 Thread 对象里（按 cache line 对齐），
+ * 只有所属线程写，stats() 读取时只做 relaxed load，统计本身不会引入竞争
+ */
+
+// HDR 风格的对数-线性直方图：每个 2 的幂区间再均分 8 份，相对误差 < 12.5%
+class LatencyHistogram {
+public:
+    static constexpr int SUB_BITS = 3;
+    static constexpr int SUB_COUNT = 1 << SUB_BITS;
+    static constexpr int BUCKETS = SUB_COUNT + (64 - SUB_BITS) * SUB_COUNT;
+
+    LatencyHistogram() {
+        for (auto& c : counts_) c.store(0, std::memory_order_relaxed);
+    }
+
+    // 只有所属线程调用，不需要原子的读-改-写
+    void record(uint64_t value) {
+        auto& c = counts_[bucket_of(value)];
+        c.store(c.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    }
+
+    // 清零（所属线程同时在写的话可能漏掉几次）
+    void clear() {
+        for (auto& c : counts_) c.store(0, std::memory_order_relaxed);
+    }
+
+    // 把计数累加到 out（out.size() == BUCKETS）
+    void merge_into(std::vector<uint64_t>& out) const {
+        for (int i = 0; i < BUCKETS; i++)
+            out[i] += counts_[i].load(std::memory_order_relaxed);
+    }
+
+    static int bucket_of(uint64_t value) {
+        if (value < SUB_COUNT)
+            return static_cast<int>(value);
+        int e = 63 - __builtin_clzll(value);    // value 的最高位
+        int sub = static_cast<int>((value >> (e - SUB_BITS)) & (SUB_COUNT - 1));
+        return SUB_COUNT + (e - SUB_BITS) * SUB_COUNT + sub;
+    }
+
+    // 桶的下界
+    static uint64_t bucket_lower(int idx) {
+        if (idx < SUB_COUNT)
+            return static_cast<uint64_t>(idx);
+        int e = (idx - SUB_COUNT) / SUB_COUNT + SUB_BITS;
+        uint64_t sub = static_cast<uint64_t>((idx - SUB_COUNT) % SUB_COUNT);
+        return (SUB_COUNT + sub) << (e - SUB_BITS);
+    }
+
+    // 桶的宽度
+    static uint64_t bucket_width(int idx) {
+        if (idx < SUB_COUNT)
+            return 1;
+        int e = (idx - SUB_COUNT) / SUB_COUNT + SUB_BITS;
+        return uint64_t(1) << (e - SUB_BITS);
+    }
+
+private:
+    std::atomic<uint64_t> counts_[BUCKETS];
+};
+
+// 直方图快照，单位纳秒
+struct HistogramSnapshot {
+    std::vector<uint64_t> counts = std::vector<uint64_t>(LatencyHistogram::BUCKETS, 0);
+
+    uint64_t count() const {
+        uint64_t n = 0;
+        for (uint64_t c : counts) n += c;
+        return n;
+    }
+
+    // p 取 [0, 100]，返回所在桶的中点
+    uint64_t percentile(double p) const {
+        uint64_t total = count();
+        if (total == 0) return 0;
+        uint64_t rank = static_cast<uint64_t>(p / 100.0 * (total - 1)) + 1;
+        uint64_t seen = 0;
+        for (int i = 0; i < LatencyHistogram::BUCKETS; i++) {
+            seen += counts[i];
+            if (seen >= rank)
+                return LatencyHistogram::bucket_lower(i) + LatencyHistogram::bucket_width(i) / 2;
+        }
+        return 0;
+    }
+
+    double mean() const {
+        uint64_t total = 0;
+        double sum = 0;
+        for (int i = 0; i < LatencyHistogram::BUCKETS; i++) {
+            total += counts[i];
+            sum += counts[i] * (LatencyHistogram::bucket_lower(i) + LatencyHistogram::bucket_width(i) / 2.0);
+        }
+        return total == 0 ? 0 : sum / total;
+    }
+};
+
+// 每个线程的统计数据，只有所属线程写
+struct alignas(64) WorkerStats {
+    std::atomic<uint64_t> tasks_executed{0};   // 执行过的任务数
+    std::atomic<uint64_t> steals{0};           // MODE_STEAL 下从其它线程窃取的任务数
+    std::atomic<uint64_t> idle_ns{0};          // 没有任务可做的时间
+    std::atomic<uint64_t> busy_ns{0};          // 执行任务的时间
+    std::atomic<uint64_t> queue_wait_ns{0};    // 所有任务排队时间的总和（入队 -> 开始执行）
+
+    LatencyHistogram queue_latency;            // 入队 -> 开始执行
+    LatencyHistogram run_time;                 // 开始执行 -> 执行完
+
+    // 只有所属线程调用
+    static void add(std::atomic<uint64_t>& counter, uint64_t n) {
+        counter.store(counter.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+    }
+};
+
+// 单个线程的计数器快照
+struct WorkerStatsSnapshot {
+    int thread_id = -1;
+    uint64_t tasks_executed = 0;
+    uint64_t steals = 0;
+    uint64_t idle_ns = 0;
+    uint64_t busy_ns = 0;
+    uint64_t queue_wait_ns = 0;
+
+    // 忙碌时间占比
+    double utilization() const {
+        uint64_t total = idle_ns + busy_ns;
+        return total == 0 ? 0 : static_cast<double>(busy_ns) / total;
+    }
+};
+
+// 一个任务组（ThreadPool::create_group）的统计，计数都是创建以来的累计值
+struct GroupStats {
+    std::string name;
+    int weight = 1;
+    uint64_t submitted = 0;         // 进了组的队列的任务数
+    uint64_t completed = 0;         // 执行完的
+    uint64_t cancelled = 0;         // 线程池关闭时还在组的队列里、被取消的
+    uint64_t rejected = 0;          // 组的队列满了，try_submit 被拒绝的
+    std::size_t queued = 0;         // 正在排队
+    int running = 0;                // 正在执行
+    int peak_running = 0;           // 同时执行的任务数的最大值
+    uint64_t run_ns = 0;            // 累计执行时间
+    uint64_t queue_wait_ns = 0;     // 累计排队时间（进组的队列 -> 开始执行）
+};
+
+// ThreadPool::stats() 的返回值
+struct PoolStats {
+    unsigned threads = 0;          // 当前线程数
+    unsigned idle_threads = 0;     // 空闲线程数
+    unsigned pending_tasks = 0;    // 还没开始执行的任务数
+
+    // 任务队列满时（RejectPolicy）
+    uint64_t caller_runs = 0;      // 在提交者线程上执行的任务数（包括 DROP_OLDEST 挤不掉的内部任务）
+    uint64_t dropped = 0;          // 被挤出队列的任务数
+    uint64_t rejected = 0;         // 直接拒绝的任务数
+
+    // 阻塞区（BlockingRegion）
+    unsigned blocked_threads = 0;  // 正在阻塞区里的线程数
+    uint64_t compensations = 0;    // 进入阻塞区时新建替补线程的次数
+
+    std::vector<WorkerStatsSnapshot> workers;   // 存活的线程
+    WorkerStatsSnapshot retired;                // 已经退出的线程（MODE_CACHED 回收）的累计值
+
+    HistogramSnapshot queue_latency;    // 入队 -> 开始执行
+    HistogramSnapshot run_time;         // 开始执行 -> 执行完
+
+    std::vector<GroupStats> groups;     // 任务组，按创建的顺序
+
+    // 所有线程（包括已退出的）的汇总
+    WorkerStatsSnapshot total() const {
+        WorkerStatsSnapshot sum = retired;
+        for (const auto& w : workers) {
+            sum.tasks_executed += w.tasks_executed;
+            sum.steals += w.steals;
+            sum.idle_ns += w.idle_ns;
+            sum.busy_ns += w.busy_ns;
+            sum.queue_wait_ns += w.queue_wait_ns;
+        }
+        return sum;
+    }
+};
@@ -34,7 +34,11 @@ public:
     Any run() {
         std::cout << "tid: " << std::this_thread::get_id()
                   << " begin!\n";
-        std::this_thread::sleep_for(std::chrono::seconds(1));
+        {
+            // 模拟阻塞（读磁盘、等锁）：告诉线程池，让它临时补一个线程
+            BlockingRegion blocking;
+            std::this_thread::sleep_for(std::chrono::seconds(1));
+        }
         uLong sum = 0;
         for (int i = begin_; i <= end_; i++)
             sum += (uLong)i;
@@ -1,12 +1,132 @@
 #include "threadpool.hh"
 
 #include <thread>
+#include <random>
+#include <algorithm>
 
-#include <iostream>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sched.h>
+#include <cassert>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
 
-const int Task_max_threshhold = INT32_MAX;
+#include <string>
+
+#include "tracer.hh"
+
+const int Task_max_threshhold = 1 << 16;     // 每个环形队列的默认容量（原来是 INT32_MAX），每个 16 字节、预先分配
 const int Thread_max_threshhold = 1024;
 const int Thread_max_idle_time = 60;
+const int Control_interval_ms = 10;         // cached 模式的控制线程多久采样一次
+const int Control_max_step = 16;            // 控制线程一次最多加几个线程
+const int Control_backoff_ticks = 20;       // 加线程没用时，多少次采样之后再试
+const int Thread_spin_count = 2000;
+const int Priority_max_levels = 16;
+const unsigned Priority_aging_interval = 16;
+const uint64_t Timer_tick_ns = 1000000;    // 时间轮的精度 1ms
+const int64_t Group_quantum_ns = 200000;    // 任务组轮到一次的额度（乘以权重）
+const int64_t Group_initial_cost_ns = 10000;    // 任务组的单个任务执行时间的初始估计
+const int64_t Help_wait_ns = 50000;         // 帮忙等待时没有任务可执行：睡这么久再看看有没有新任务
+const int Strand_default_count = 256;
+const int Strand_batch = 32;                // strand 被取到一次最多连续执行几个任务，然后回到队尾
+
+// 自旋等待时的 pause：让出流水线资源给同一物理核上的另一个超线程，也省电
+static inline void cpu_relax() {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__)
+    asm volatile("yield" ::: "memory");
+#else
+    std::this_thread::yield();
+#endif
+}
+
+// 统计用的单调时钟，单位纳秒
+static uint64_t now_ns() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// 到期时间换算成时间轮的 tick，向上取整，定时任务不会提前执行
+static uint64_t timer_tick_of(uint64_t ns) {
+    return (ns + Timer_tick_ns - 1) / Timer_tick_ns;
+}
+
+// 当前线程所属的线程池、线程对象和槽位（区分 外部调用 和 线程池内部调用）
+// 计数不为 0 时减 1，返回是否减到了
+static bool take_one(std::atomic_uint& counter) {
+    unsigned n = counter;
+    while (n > 0) {
+        if (counter.compare_exchange_weak(n, n - 1))
+            return true;
+    }
+    return false;
+}
+
+static thread_local ThreadPool* cur_pool_ = nullptr;
+static thread_local Thread* cur_thread_ = nullptr;
+static thread_local std::size_t cur_slot_ = 0;
+static thread_local int cur_node_ = -1;     // 线程池的线程分到的 NUMA 节点，不绑定为 -1
+// 当前任务执行完后 这个线程接着执行的后继（依赖刚被当前任务满足）
+static thread_local detail::Job* cur_inline_ = nullptr;
+
+/**
+ * submit_keyed 的串行执行器：自己的任务排在一个无锁的多生产者单消费者链表里（Vyukov），链接用 Job::strand_next_
+ * pending_ 是排着的任务数，从 0 变成 1 的那个提交者负责把 strand 放进任务队列，
+ * 执行的一方减到 0 才退出：同一时刻只有一个线程在执行它的任务，任务按入队顺序执行
+ */
+class alignas(64) detail::Strand : public Job {
+public:
+    Strand() : pool_(nullptr), tail_(&stub_), head_(&stub_), pending_(0) {}
+
+    // 任何线程：放入一个任务，返回 true 时由调用者调度这个 strand
+    bool push(Job* job) {
+        link(job);
+        return pending_.fetch_add(1, std::memory_order_acq_rel) == 0;
+    }
+
+    bool idle() const { return pending_.load() == 0; }
+
+    void run() override;
+    void cancel() override;
+
+    ThreadPool* pool_;
+
+private:
+    // 链表的哨兵，不会被执行
+    class Stub : public Job {
+    public:
+        void run() override {}
+        void cancel() override {}
+    };
+
+    void link(Job* job) {
+        job->strand_next_.store(nullptr, std::memory_order_relaxed);
+        Job* prev = tail_.exchange(job, std::memory_order_acq_rel);
+        prev->strand_next_.store(job, std::memory_order_release);
+    }
+
+    // 消费者：取出队头的任务；提交者换了 tail_ 还没来得及链上时返回 nullptr
+    Job* pop();
+
+    // 消费者：pending_ 保证有任务，等提交者链好
+    Job* take() {
+        Job* job;
+        while ((job = pop()) == nullptr)
+            cpu_relax();
+        return job;
+    }
+
+    Stub stub_;
+    std::atomic<Job*> tail_;
+    Job* head_;                 // 只有执行 strand 的线程访问
+    std::atomic<int> pending_;
+};
 
 ThreadPool::ThreadPool():
     init_thread_size_(0),
@@ -14,23 +134,184 @@ ThreadPool::ThreadPool():
     cur_thread_size_(0),
     idle_thread_num_(0),
     task_size_(0),
-    thread_max_threshhold_(Thread_max_threshhold),
+    thread_max_threshhold_(0),
+    thread_limit_(0),
     pool_mode_(PoolMode::MODE_FIXED),
-    is_pool_running_(false) {}
+    is_pool_running_(false),
+    priority_levels_(1),
+    blocked_producer_num_(0),
+    sleep_thread_num_(0),
+    spinning_num_(0),
+    spin_count_(Thread_spin_count),
+    timer_wheel_(now_ns() / Timer_tick_ns),
+    next_timer_ns_(UINT64_MAX),
+    timer_duty_(-1),
+    slot_num_(0),
+    topology_(nullptr),
+    node_count_(1),
+    retire_wanted_(0),
+    spares_owed_(0),
+    idle_waiters_(0),
+    stopping_(false),
+    cancel_pending_(false),
+    blocked_num_(0),
+    compensations_(0),
+    idle_timeout_ns_(uint64_t(Thread_max_idle_time) * 1000000000),
+    target_latency_ns_(1000000),
+    reject_policy_(RejectPolicy::BLOCK),
+    help_while_waiting_(false),
+    caller_runs_(0),
+    dropped_(0),
+    rejected_(0),
+    drr_cursor_(0),
+    strand_num_(0) {
+    taskques_.emplace_back(std::make_unique<MpmcQueue<detail::Job>>(Task_max_threshhold));
+    setStrandCount(Strand_default_count);
+}
 
 ThreadPool::~ThreadPool() {
-    is_pool_running_ = false;
-
     /** 等待线程池里面所有的线程返回 有两种状态：阻塞 & 正在执行任务中
-     *  涉及到不同线程池的通信（用户的线程，线程池的线程）：condition_variable
-     * 
-     *  回收时需要notify一下exit_cond_，否则会阻塞在这
-    */
-    std::unique_lock<std::mutex> lock(taskque_mutx_);
+     *  队列里的任务全部执行完，再 join 所有线程；之前 shutdown(IMMEDIATE) 过的话只剩 join
+     *
+     *  前提：不在线程池自己的线程里析构。线程等不了自己退出，析构完它还要回到线程函数里；
+     *  析构函数又不能把 shutdown 的异常抛出去（std::terminate），只能在这里停下
+     */
+    if (cur_pool_ == this) {
+        assert(!"ThreadPool destroyed from one of its own threads");
+        fprintf(stderr, "ThreadPool destroyed from one of its own threads\n");
+        std::abort();
+    }
+    stop(ShutdownMode::DRAIN_ALL);
+}
+
+std::vector<PendingTask> ThreadPool::shutdown(ShutdownMode mode) {
+    if (ShutdownMode::IMMEDIATE != mode && cur_pool_ == this)
+        throw "can not wait for the pool to shut down in its own thread!";
+    return stop(mode);
+}
+
+std::vector<PendingTask> ThreadPool::stop(ShutdownMode mode) {
+    bool join = ShutdownMode::IMMEDIATE != mode;
+    std::lock_guard<std::mutex> guard(shutdown_mutx_);
+    std::vector<PendingTask> pending;
+
+    if (!stopping_) {
+        // 先拒绝提交再改运行状态：线程看到 is_pool_running_ 为 false 时，之前抢进来的任务已经算在 task_size_ 里
+        cancel_pending_ = ShutdownMode::DRAIN_ALL != mode;
+        stopping_ = true;
+        is_pool_running_ = false;
+
+        // 叫醒在任务组的队列上等空位的提交者，它们看到拒绝提交就返回 SHUTDOWN
+        {
+            std::lock_guard<std::mutex> lock(group_mutx_);
+            for (auto& group : groups_)
+                group->space_cond_.notify_all();
+        }
+
+        // 控制线程先退出，之后不会再创建线程
+        {
+            std::lock_guard<std::mutex> lock(ctl_mutx_);
+            ctl_cond_.notify_all();
+        }
+        if (controller_.joinable())
+            controller_.join();
+
+        // 还没到期的定时任务直接丢弃（已经放进任务队列的按关闭方式处理，周期任务不再挂回去）
+        drop_timers();
+
+        if (cancel_pending_)
+            drain_queues(pending);
+
+        // 唤醒所有睡眠的线程；之后才登记睡眠的线程 登记完会看到 is_pool_running_ 为 false，自己退出
+        wake_parked(SIZE_MAX);
+    }
+
+    if (join) {
+        join_workers();
+        // 线程退出前可能又把队列满时没放进去的定时任务挂回了时间轮
+        drop_timers();
+        // 没有线程执行过的任务（从来没 start 过）只能交给调用者
+        drain_queues(pending);
+        TP_PROFILE_SHUTDOWN();
+    }
+    return pending;
+}
+
+void ThreadPool::join_workers() {
+    // 线程退出时不再碰 threads_，这里先 join 再回收线程对象
+    std::vector<Thread*> workers;
+    {
+        std::lock_guard<QueueMutex> lock(taskque_mutx_);
+        for (auto& [tid, thread] : threads_)
+            workers.push_back(thread.get());
+    }
+    for (Thread* thread : workers)
+        thread->join();
+    reap_exited();
+
+    std::lock_guard<QueueMutex> lock(taskque_mutx_);
+    for (auto& [tid, thread] : threads_) {
+        retire_stats(*thread);
+        release_slot(thread->getSlot());
+    }
+    threads_.clear();
+    cur_thread_size_ = 0;
+    idle_thread_num_ = 0;
+    idle_cond_.notify_all();
+}
+
+void ThreadPool::drop_timers() {
+    std::lock_guard<std::mutex> lock(timer_mutx_);
+    timer_wheel_.clear([](TimerWheel::Node* node) {
+        auto job = static_cast<detail::TimerJob*>(node);
+        job->state_ = detail::TimerJob::CANCELLED;
+        job->release();
+    });
+    next_timer_ns_ = UINT64_MAX;
+}
+
+void ThreadPool::reap_exited() {
+    std::vector<std::unique_ptr<Thread>> exited;
+    {
+        std::lock_guard<QueueMutex> lock(taskque_mutx_);
+        exited.swap(exited_);
+    }
+    for (auto& thread : exited)
+        thread->join();
+}
+
+void ThreadPool::drain_queues(std::vector<PendingTask>& out) {
+    auto drain = [&](auto& que, auto pop) {
+        while (detail::Job* job = pop(*que)) {
+            task_size_--;
+            out.push_back(PendingTask(job));
+        }
+    };
+    auto pop = [](MpmcQueue<detail::Job>& que) { return que.pop(); };
+    for (auto& que : taskques_)
+        drain(que, pop);
+    for (auto& que : node_ques_)
+        drain(que, pop);
+    for (auto& que : local_ques_)
+        drain(que, [](WorkStealingDeque<detail::Job>& q) { return q.steal(); });
+    notify_not_full();
+}
+
+bool ThreadPool::submit_rejected() const {
+    return stopping_ && (cancel_pending_ || cur_pool_ != this);
+}
 
-    // 析构时唤醒所有的线程(并且是在拿到🔒后，否则会导致第二种死锁)
-    not_empty_.notify_all();
-    exit_cond_.wait(lock, [&]()->bool { return threads_.size() == 0; });
+void ThreadPool::wait_idle() {
+    if (cur_pool_ == this)
+        throw "can not wait for the pool to be idle in its own thread!";
+
+    std::unique_lock<QueueMutex> lock(taskque_mutx_);
+    idle_waiters_++;
+    // 一个线程都没有时（还没 start、已经关闭）队列里的任务不会有人执行，不等
+    idle_cond_.wait(lock, [&]()->bool {
+        return cur_thread_size_ == 0 || (task_size_ == 0 && idle_thread_num_ == cur_thread_size_);
+    });
+    idle_waiters_--;
 }
 
 void ThreadPool::setMode(PoolMode mode) {
@@ -41,72 +322,429 @@ void ThreadPool::setMode(PoolMode mode) {
 
 void ThreadPool::setTaskqueMaxThreshHold(int threshhold) {
     if (check_running_state()) return;
+    if (threshhold <= 0 || task_size_ > 0) return; // 已经有任务在队列里了，不能换队列
 
     taskque_max_threshhold_ = threshhold;
+    for (auto& que : taskques_)
+        que = std::make_unique<MpmcQueue<detail::Job>>(threshhold);
+}
+
+void ThreadPool::setPriorityLevels(int levels) {
+    if (check_running_state()) return;
+    if (levels <= 0 || levels > Priority_max_levels || task_size_ > 0) return;
+
+    priority_levels_ = levels;
+    taskques_.clear();
+    for (int i = 0; i < levels; i++)
+        taskques_.emplace_back(std::make_unique<MpmcQueue<detail::Job>>(taskque_max_threshhold_));
 }
 
 void ThreadPool::setThreadThreshHold(int threshhold) {
     if (check_running_state()) return;
-    if (pool_mode_ == PoolMode::MODE_FIXED) return;
+    if (threshhold <= 0) return;
 
     thread_max_threshhold_ = threshhold;
 }
 
-Result ThreadPool::submitTask(std::shared_ptr<Task> sptr) {
-    // 1.获取锁
-    std::unique_lock<std::mutex> lock(taskque_mutx_);
+void ThreadPool::setThreadIdleTimeout(std::chrono::milliseconds timeout) {
+    if (check_running_state()) return;
+    if (timeout.count() <= 0) return;
 
-    // 2.1 线程通信  等待Taskque有空余
-    /** 
-     * 2.2 用户提交任务，最长不能超过1s，否则判提交任务失败，返回
-     * 
-     * wait       - 等待条件满足，等待期间自动 unlock
-     * wait_for   - 等待一段时间
-     * wait_until - 一直等到某个时刻
-     */
-    if(!not_full_.wait_for(lock, std::chrono::seconds(1),
-        [&]()->bool { return taskque_.size() < taskque_max_threshhold_; })) {
-        // 说明 not_full_ 等待1s，条件仍然没有满足
-        std::cerr << "task queue is full, submit task failed." << std::endl;
-        printf("taskque_.size(): %ld --- task_threshhold: %d\n", taskque_.size(), taskque_max_threshhold_);
+    idle_timeout_ns_ = std::chrono::duration_cast<std::chrono::nanoseconds>(timeout).count();
+}
+
+void ThreadPool::setTargetQueueLatency(std::chrono::microseconds latency) {
+    if (check_running_state()) return;
+    if (latency.count() <= 0) return;
+
+    target_latency_ns_ = std::chrono::duration_cast<std::chrono::nanoseconds>(latency).count();
+}
+
+void ThreadPool::setSpinCount(int count) {
+    if (check_running_state()) return;
+    if (count < 0) return;
+
+    spin_count_ = count;
+}
+
+void ThreadPool::setRejectPolicy(RejectPolicy policy) {
+    if (check_running_state()) return;
+
+    reject_policy_ = policy;
+}
+
+void ThreadPool::setStrandCount(int count) {
+    if (check_running_state()) return;
+    if (count <= 0) return;
+    // shutdown 交出来的 PendingTask 里可能还有 strand
+    for (std::size_t i = 0; i < strand_num_; i++) {
+        if (!strands_[i].idle())
+            return;
+    }
+
+    strands_.reset(new detail::Strand[count]);
+    strand_num_ = count;
+    for (std::size_t i = 0; i < strand_num_; i++)
+        strands_[i].pool_ = this;
+}
+
+void ThreadPool::setHelpWhileWaiting(bool enable) {
+    if (check_running_state()) return;
+
+    help_while_waiting_ = enable;
+}
+
+Result ThreadPool::submitTask(std::shared_ptr<Task> sptr, int priority) {
+    TaskOptions opts;
+    opts.priority = priority;
+    return submitTask(std::move(sptr), opts);
+}
+
+Result ThreadPool::submitTask(std::shared_ptr<Task> sptr, const TaskOptions& opts) {
+    // 老接口适配到 submit：Task::run() 的返回值 Any 直接存进共享状态
+    // 用户提交任务，最长不能超过1s，否则判提交任务失败，返回无效的 Result
+    auto [status, future] = submit_job(std::chrono::seconds(1), true, opts,
+                                       [sptr]() -> Any { return sptr->run(); });
+    return Result(std::move(future), status == SubmitStatus::OK);
+}
+
+std::size_t ThreadPool::priority_level(int priority) const {
+    if (priority == DEFAULT_PRIORITY) return priority_levels_ / 2;
+    if (priority < 0) return 0;
+    return std::min(static_cast<std::size_t>(priority), priority_levels_ - 1);
+}
+
+SubmitStatus ThreadPool::enqueue(detail::Job* job, std::chrono::nanoseconds timeout, int priority,
+                                 bool by_policy) {
+    job->enqueue_ns_ = now_ns();
+    std::size_t level = priority_level(priority);
+
+    // 先占一个任务计数再入队：消费者看到的 task_size_ 不会比队列里实际的少
+    // 占了计数再看是否在关闭：没被拒绝的任务，shutdown 之后的线程一定看得到它
+    task_size_++;
+    if (submit_rejected()) {
+        task_size_--;
+        return SubmitStatus::SHUTDOWN;
+    }
+
+    MpmcQueue<detail::Job>* que = taskques_[level].get();
+
+    // 按节点分队列时，默认优先级的任务放进提交者所在节点的队列
+    int node = -1;
+    if (node_count_ > 1 && level == priority_levels_ / 2) {
+        node = submit_node();
+        if (node >= 0)
+            que = node_ques_[node].get();
+    }
+    MpmcQueue<detail::Job>& taskque = *que;
+
+    if (PoolMode::MODE_STEAL == pool_mode_ && cur_pool_ == this && level == priority_levels_ / 2) {
+        // MODE_STEAL: 线程池内部的线程提交任务，直接放到自己的本地队列（不限长度）
+        local_ques_[cur_slot_]->push(job);
+    } else if (!taskque.push(job)) {
+        // 任务队列满了
+        RejectPolicy policy = by_policy ? reject_policy_ : RejectPolicy::BLOCK;
+        if (RejectPolicy::FAIL == policy || timeout == std::chrono::nanoseconds::zero()) {
+            task_size_--;
+            if (by_policy)
+                rejected_++;
+            return SubmitStatus::QUEUE_FULL;
+        }
+
+        if (RejectPolicy::CALLER_RUNS == policy) {
+            task_size_--;
+            caller_runs_++;
+            run_in_caller(job);
+            return SubmitStatus::OK;
+        }
+
+        if (RejectPolicy::DROP_OLDEST == policy) {
+            // 挤掉的任务可能正好被线程取走了，那就再试一次，总能放进去
+            // 队头是内部的调度单元（parallel_for 的区间等）时不能丢，在这里执行掉，同样腾出一个位置
+            do {
+                detail::Job* oldest = taskque.pop();
+                if (oldest == nullptr)
+                    continue;
+                task_size_--;
+                if (oldest->evictable()) {
+                    dropped_++;
+                    oldest->drop();
+                } else {
+                    caller_runs_++;
+                    run_in_caller(oldest);
+                }
+            } while (!taskque.push(job));
+            TP_TRACE(ENQUEUE, job);
+            notify_not_empty(1, node);
+            return SubmitStatus::OK;
+        }
+
+        if (cur_pool_ == this && help_while_waiting_) {
+            // 线程池自己的线程不能干等：所有线程都卡在这里的话，没人取任务，队列永远是满的
+            auto until = timeout == std::chrono::nanoseconds::max()
+                       ? std::chrono::steady_clock::time_point::max()
+                       : std::chrono::steady_clock::now() + timeout;
+            while (!taskque.push(job)) {
+                if (std::chrono::steady_clock::now() >= until) {
+                    task_size_--;
+                    return SubmitStatus::TIMEOUT;
+                }
+                if (!run_pending_task())
+                    std::this_thread::yield();
+            }
+            TP_TRACE(ENQUEUE, job);
+            notify_not_empty(1, node);
+            return SubmitStatus::OK;
+        }
 
         /**
-         *  return task->getResult(); X
-         *  不能用这种方法，因为 task对象 在线程函数中执行完就析构了
+         * 线程通信  等待Taskque有空余
+         * wait       - 等待条件满足，等待期间自动 unlock
+         * wait_for   - 等待一段时间
          */
-        return Result(sptr, false); // 返回的临时对象，会自动匹配"移动copy和assign"(>=c++17)
+        TP_PROFILE_SCOPE(FULL_WAIT);
+        std::unique_lock<QueueMutex> lock(taskque_mutx_);
+        blocked_producer_num_++;
+        // 和 notify_not_full 里的 fence 配对：要么消费者看到有人阻塞，要么这里重试时看到空位
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+
+        auto pushed = [&]()->bool { return taskque.push(job); };
+        bool ok = true;
+        if (timeout == std::chrono::nanoseconds::max())
+            not_full_.wait(lock, pushed);
+        else
+            ok = not_full_.wait_for(lock, timeout, pushed);
+        blocked_producer_num_--;
+
+        if (!ok) {
+            task_size_--;
+            return SubmitStatus::TIMEOUT;
+        }
     }
 
-    // 3.如果有空余，把任务放入Taskque中
-    taskque_.emplace(sptr);
-    task_size_++;
+    TP_TRACE(ENQUEUE, job);
 
-    // 4. 因为新放了任务，任务队列肯定不空，在notEmpty上进行通知，赶快分配线程执行任务
-    not_empty_.notify_all();
+    notify_not_empty(1, node);
+    return SubmitStatus::OK;
+}
 
-    // *cached 模式 任务处理比较紧急 场景：根据任务数量和空闲线程数量，判断是否需要创建新的线程？
-    if (PoolMode::MODE_CACHED == pool_mode_
-        && task_size_ > idle_thread_num_
-        && cur_thread_size_ < thread_max_threshhold_) {
+void ThreadPool::enqueue_bulk(detail::Job* const* jobs, std::size_t n) {
+    uint64_t ts = now_ns();
+    for (std::size_t i = 0; i < n; i++) {
+        jobs[i]->enqueue_ns_ = ts;
+        TP_TRACE(ENQUEUE, jobs[i]);
+    }
+    task_size_ += n;
+    if (submit_rejected()) {
+        task_size_ -= n;
+        for (std::size_t i = 0; i < n; i++)
+            jobs[i]->cancel();
+        return;
+    }
 
-            std::cout << ">>> create new thread..." << std::endl;
+    if (PoolMode::MODE_STEAL == pool_mode_ && cur_pool_ == this) {
+        // MODE_STEAL: 线程池内部提交的批量任务全部放到自己的本地队列
+        for (std::size_t i = 0; i < n; i++)
+            local_ques_[cur_slot_]->push(jobs[i]);
+        notify_not_empty(n);
+        return;
+    }
 
-            // 创建新线程
-            auto ptr = std::make_unique<Thread>(std::bind(&ThreadPool::threadFunc, this, std::placeholders::_1));
-            int tid = ptr->getId();
-            threads_.emplace(tid, std::move(ptr));
-            // 启动线程
-            threads_[tid]->start();
-            // 修改线程个数相关的变量
-            cur_thread_size_++; // 记得增加
-            idle_thread_num_++; 
+    // 批量提交的任务都是默认优先级
+    MpmcQueue<detail::Job>& taskque = *taskques_[priority_levels_ / 2];
+    std::size_t pushed = 0;
+    while (pushed < n) {
+        std::size_t k = taskque.push_bulk(jobs + pushed, n - pushed);
+        if (k > 0) {
+            // 先放进去的这部分马上就可以执行了
+            pushed += k;
+            notify_not_empty(k);
+            continue;
         }
 
-    // 返回 Result 对象
-    return Result(sptr);
+        // 任务队列满了，等消费者腾出位置
+        TP_PROFILE_SCOPE(FULL_WAIT);
+        std::unique_lock<QueueMutex> lock(taskque_mutx_);
+        blocked_producer_num_++;
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        not_full_.wait(lock, [&]()->bool {
+            k = taskque.push_bulk(jobs + pushed, n - pushed);
+            return k > 0;
+        });
+        blocked_producer_num_--;
+        lock.unlock();
+
+        pushed += k;
+        notify_not_empty(k);
+    }
+}
+
+void ThreadPool::notify_not_empty(std::size_t n, int node) {
+    // 因为新放了任务，任务队列肯定不空，有线程在睡眠才需要唤醒
+    // 新放了 n 个任务，最多只需要唤醒 n 个线程；正在自旋的线程自己会取走任务，不用再叫醒别人
+    if (sleep_thread_num_ > 0) {
+        std::size_t spinning = spinning_num_;
+        if (n > spinning)
+            wake_parked(n - spinning, node);
+    }
+
+    // *cached 模式 需要多少线程由控制线程根据排队时间决定（controlFunc），提交任务时不再创建线程
 }
 
-void ThreadPool::start(int initThreadSize) {
+bool ThreadPool::spawn_thread() {
+    if (!is_pool_running_ || cur_thread_size_ >= thread_limit_) return false;
+
+    // 创建新线程
+    auto ptr = std::make_unique<Thread>(std::bind(&ThreadPool::threadFunc, this, std::placeholders::_1));
+    ptr->setSlot(acquire_slot());
+    assign_placement(*ptr);
+    int tid = ptr->getId();
+    TP_TRACE(SPAWN, tid);
+    threads_.emplace(tid, std::move(ptr));
+    // 启动线程
+    threads_[tid]->start();
+    // 修改线程个数相关的变量
+    cur_thread_size_++; // 记得增加
+    idle_thread_num_++;
+    return true;
+}
+
+void ThreadPool::controlFunc() {
+    TP_TRACE_THREAD_NAME("controller");
+    TP_PROFILE_THREAD_NAME("controller");
+
+    // 所有线程（包括已退出的）完成的任务数 和 排队时间的总和
+    auto sample = [this](uint64_t& done, uint64_t& wait) {
+        std::lock_guard<QueueMutex> lock(taskque_mutx_);
+        done = retired_stats_.tasks_executed;
+        wait = retired_stats_.queue_wait_ns;
+        for (auto& [tid, thread] : threads_) {
+            done += thread->stats().tasks_executed.load(std::memory_order_relaxed);
+            wait += thread->stats().queue_wait_ns.load(std::memory_order_relaxed);
+        }
+    };
+
+    uint64_t last_done, last_wait;
+    sample(last_done, last_wait);
+    uint64_t last_rate = 0;     // 上一次采样期间完成的任务数
+    int last_step = 0;          // 上一次加了几个线程
+    int starved = 0;            // 连续几次 有任务排队但一个都没完成
+    int backoff = 0;            // 还要等几次采样才能再试着加线程
+    unsigned last_backlog = 0;  // 上一次采样时排队的任务数
+
+    std::unique_lock<std::mutex> lock(ctl_mutx_);
+    while (is_pool_running_) {
+        ctl_cond_.wait_for(lock, std::chrono::milliseconds(Control_interval_ms),
+                           [&]()->bool { return !is_pool_running_; });
+        if (!is_pool_running_) break;
+
+        reap_exited();
+
+        uint64_t done, wait;
+        sample(done, wait);
+        uint64_t rate = done - last_done;
+        uint64_t avg_wait = rate == 0 ? 0 : (wait - last_wait) / rate;
+        last_done = done;
+        last_wait = wait;
+        unsigned queued = task_size_;
+        bool backlog = queued > 0;
+        // 队列在变短，而且照这个速度两次采样之内就能排空：现有的线程够用了，只是还在消化之前积压的
+        bool draining = queued < last_backlog && queued <= 2 * (last_backlog - queued);
+        last_backlog = queued;
+        if (backoff > 0) backoff--;
+
+        int step = 0;
+        if (backlog && rate == 0) {
+            // 线程都阻塞在任务里了，不管吞吐，一直加（不然可能死锁：任务在等队列里的任务）
+            starved++;
+            step = std::min(1 << std::min(starved - 1, 4), Control_max_step);
+        } else if (backlog && avg_wait > target_latency_ns_ && !draining) {
+            starved = 0;
+            if (last_step > 0 && rate * 20 < last_rate * 21) {
+                // 上一次加的线程没让吞吐涨 5% 以上：退回去，让那几个线程空下来退出
+                retire_wanted_ += last_step;
+                backoff = Control_backoff_ticks;
+            } else if (backoff == 0) {
+                step = last_step > 0 ? std::min(last_step * 2, Control_max_step) : 1;
+            }
+        } else {
+            starved = 0;
+        }
+
+        int added = 0;
+        if (step > 0) {
+            // 准备加线程了，之前让退出的作废
+            retire_wanted_ = 0;
+            std::lock_guard<QueueMutex> guard(taskque_mutx_);
+            while (added < step && spawn_thread())
+                added++;
+        }
+        last_step = added;
+        last_rate = rate;
+    }
+}
+
+bool ThreadPool::retire_idle(int thread_id, uint64_t idle_since, bool wanted) {
+    /** 开始回收当前线程
+     *  修改 记录线程数量的相关变量值
+     *  把线程对象从线程列表中删除    如何将 threadFunc <=> thread 对应起来？
+     *  thread_id => thread对象 => 删除
+     */
+    std::lock_guard<QueueMutex> lock(taskque_mutx_);
+    if (!is_pool_running_) return false;
+    if (cur_thread_size_ <= init_thread_size_) {
+        // 多出来的线程已经因为空闲太久退出了，退出的请求作废，别让每个线程每次取任务都来抢锁
+        if (wanted) {
+            spares_owed_ = 0;
+            retire_wanted_ = 0;
+        }
+        return false;
+    }
+    // 先还阻塞区的替补，再应控制线程的要求
+    if (wanted && !take_one(spares_owed_) && !take_one(retire_wanted_))
+        return false;
+
+    // 线程对象留到 join 之后再释放：线程函数返回之前还在用它
+    auto it = threads_.find(thread_id);
+    Thread& self = *it->second;
+    WorkerStats::add(self.stats().idle_ns, now_ns() - idle_since);
+    retire_stats(self);
+    release_slot(self.getSlot());
+    exited_.push_back(std::move(it->second));
+    threads_.erase(it);
+    cur_thread_size_--;
+    idle_thread_num_--;
+
+    TP_TRACE(RETIRE, thread_id);
+    return true;
+}
+
+void ThreadPool::notify_not_full() {
+    // 只有真的有生产者阻塞时才去抢锁，腾出一个位置只唤醒一个生产者
+    // 有多个优先级或者按节点分队列时 阻塞的生产者等的不一定是这个队列，只能都唤醒
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (blocked_producer_num_ > 0) {
+        std::lock_guard<QueueMutex> lock(taskque_mutx_);
+        if (priority_levels_ == 1 && node_count_ == 1)
+            not_full_.notify_one();
+        else
+            not_full_.notify_all();
+    }
+}
+
+void ThreadPool::start(int initThreadSize, AffinityPolicy affinity) {
+    if (check_running_state()) return;
+
+    // 关闭之后重新启动：shutdown(IMMEDIATE) 还没 join 的线程先 join 掉
+    {
+        std::lock_guard<std::mutex> guard(shutdown_mutx_);
+        join_workers();
+        stopping_ = false;
+        cancel_pending_ = false;
+        retire_wanted_ = 0;
+        spares_owed_ = 0;
+    }
+
     // 设置线程池运行状态
     is_pool_running_ = true;
 
@@ -114,6 +752,32 @@ void ThreadPool::start(int initThreadSize) {
     init_thread_size_ = initThreadSize;
     cur_thread_size_ = initThreadSize;
 
+    // 线程数上限：cached 模式默认 Thread_max_threshhold；其它模式只有阻塞区的替补线程会超过初始线程数，默认补到 2 倍
+    // 每个线程一个槽位
+    thread_limit_ = thread_max_threshhold_;
+    if (thread_limit_ == 0)
+        thread_limit_ = PoolMode::MODE_CACHED == pool_mode_ ? Thread_max_threshhold : 2 * initThreadSize;
+    thread_limit_ = std::max<uint>(thread_limit_, initThreadSize);
+    slot_num_ = thread_limit_;
+    slot_used_.assign(slot_num_, false);
+    parks_ = std::make_unique<ParkSlot[]>(slot_num_);
+    parked_.reserve(slot_num_);
+
+    // 绑定 CPU 时，线程分布在几个节点上就按节点分几个队列
+    affinity_ = std::move(affinity);
+    topology_ = affinity_.topology != nullptr ? affinity_.topology : &CpuTopology::system();
+    node_count_ = AffinityMode::NONE == affinity_.mode ? 1 : topology_->node_count();
+    slot_node_.assign(slot_num_, -1);
+    node_ques_.clear();
+    local_ques_.clear();
+    if (node_count_ > 1) {
+        node_threads_ = std::make_unique<std::atomic_int[]>(node_count_);
+        for (int i = 0; i < node_count_; i++) {
+            node_threads_[i] = 0;
+            node_ques_.emplace_back(std::make_unique<MpmcQueue<detail::Job>>(taskque_max_threshhold_));
+        }
+    }
+
     /** 
      * 创建线程对象
      * 保证线程启动的公平性，先集中创建，后边再启动所有线程
@@ -124,14 +788,23 @@ void ThreadPool::start(int initThreadSize) {
         // threads_使用智能指针，避免出现new/delete
         // threads_改用map
         auto ptr = std::make_unique<Thread>(std::bind(&ThreadPool::threadFunc, this, std::placeholders::_1));
+        ptr->setSlot(acquire_slot());
+        assign_placement(*ptr);
         // threads_.emplace_back(std::move(ptr));      // unique_ptr 不允许copy, 所以要用 移动语义，传右值
         int tid = ptr->getId();
         threads_.emplace(tid, std::move(ptr));
     }
 
-    // 启动所有线程: std::vector<Thread*> threads_;
-    for (uint i=0; i < init_thread_size_; i++) {
-        threads_[i]->start();   // 会去执行一个线程函数
+    // MODE_STEAL: 给每个槽位准备一个本地队列（包括替补线程的），下标就是槽位
+    if (PoolMode::MODE_STEAL == pool_mode_) {
+        for (std::size_t i = 0; i < slot_num_; i++)
+            local_ques_.emplace_back(std::make_unique<WorkStealingDeque<detail::Job>>());
+    }
+
+    // 启动所有线程: 线程id是全局生成的，不一定从0开始，所以遍历 threads_
+    for (auto& [tid, thread] : threads_) {
+        TP_TRACE(SPAWN, tid);
+        thread->start();        // 会去执行一个线程函数
 
         idle_thread_num_++;     // 启动一个增加一个空闲线程
                                 /**
@@ -139,102 +812,1185 @@ void ThreadPool::start(int initThreadSize) {
                                  * 线程函数会先--，好像又没问题？
                                  */
     }
+
+    if (PoolMode::MODE_CACHED == pool_mode_)
+        controller_ = std::thread(&ThreadPool::controlFunc, this);
 }
 
 /**
  * 线程池的所有线程从任务队列消费任务
  */
 void ThreadPool::threadFunc(int thread_id) {
-    auto last_time = std::chrono::high_resolution_clock::now();
+    TP_TRACE_THREAD_NAME("worker " + std::to_string(thread_id));
+    TP_PROFILE_THREAD_NAME("worker " + std::to_string(thread_id));
+
+    // 线程对象的统计数据，只有自己写
+    Thread* self;
+    {
+        std::lock_guard<QueueMutex> lock(taskque_mutx_);
+        self = threads_.at(thread_id).get();
+    }
+    WorkerStats& stats = self->stats();
+    std::size_t local_idx = self->getSlot();
+    cur_pool_ = this;
+    cur_thread_ = self;
+    cur_slot_ = local_idx;
+    cur_node_ = self->getPlacement().node;
+    uint64_t idle_since = now_ns();
+    bool cached = PoolMode::MODE_CACHED == pool_mode_;
 
     for (;;) {
-        std::shared_ptr<Task> task;
-        {
-            // 1.先获取锁
-            std::unique_lock<std::mutex> lock(taskque_mutx_);
-            std::cout << "tid: " << std::this_thread::get_id()
-                      << " 获取任务中...\n";
-
-            /* 有任务时就一直执行 */
-            // 没有任务的时候等待，并检查
-            while (taskque_.size() == 0) {
-                /* 🔒 + 双重判断（避免第一种死锁） */
-                if (!is_pool_running_) {
-                    threads_.erase(thread_id);
-                    exit_cond_.notify_all();
-                    std::cout << "thread: " << std::this_thread::get_id()
-                            << " exit." << std::endl;
-                    
-                    return;
-                }
+        // 阻塞区结束了、控制线程觉得线程多了：多出来的(超过init_thread_size_数量)线程做完手上的任务就退出
+        if ((spares_owed_ > 0 || retire_wanted_ > 0) && retire_idle(thread_id, idle_since, true))
+            return;
 
-                // *cached模式下，可能已经创建了很多线程，但是空闲时间超过60s，应该把多余的(超过init_thread_size_数量)线程结束回收掉
-                // 当前时间 - 线程上次执行结束的时间 > 60s
-                if (PoolMode::MODE_CACHED == pool_mode_) {
-                    /** 每一秒检查一次
-                     *  区分：超时返回 | 有任务等待返回
-                     */
-                    if (std::cv_status::timeout ==
-                        not_empty_.wait_for(lock, std::chrono::seconds(1))) {
-                        // 如果没拿到任务就检查空闲时间
-                        auto now = std::chrono::high_resolution_clock::now();
-                        auto dur = std::chrono::duration_cast<std::chrono::seconds>(now - last_time);
-                        if (dur.count() >= Thread_max_idle_time
-                            && cur_thread_size_ > init_thread_size_) {
-                            /** 开始回收当前线程
-                             *  修改 记录线程数量的相关变量值
-                             *  把线程对象从线程列表中删除    如何将 threadFunc <=> thread 对应起来？
-                             *  thread_id => thread对象 => 删除
-                             */
-                            threads_.erase(thread_id);
-                            cur_thread_size_--;
-                            idle_thread_num_--;
-
-                            std::cout << "thread: " << std::this_thread::get_id()
-                                      << " exit." << std::endl;
-                            return;
-                        }
-                    } 
-                } else {
-                    // 2.等待任务队列不空, not_empty_ 条件
-                    not_empty_.wait(lock);
-                }
+        // 0.顺便推进时间轮，到期的定时任务放进任务队列
+        poll_timers();
+
+        // 1.无锁取任务
+        detail::Job* task = take_task(local_idx, stats, true);
+
+        // 2.没有任务，先自旋一会儿：任务很快就来的话，省掉睡眠/唤醒的两次上下文切换
+        if (task == nullptr)
+            task = spin_for_task(local_idx, stats);
+
+        if (task == nullptr) {
+            /* 任务都执行完了才退出 */
+            if (!is_pool_running_ && task_size_ == 0) {
+                // 线程对象由 shutdown join 之后回收
+                WorkerStats::add(stats.idle_ns, now_ns() - idle_since);
+                TP_TRACE(RETIRE, thread_id);
+                return;
             }
 
-            idle_thread_num_--;
+            // 3.睡眠等待任务
+            // 有定时任务时，其中一个线程负责定时：最多睡到最早的定时任务到期
+            bool timer_duty = false;
+            if (next_timer_ns_ != UINT64_MAX) {
+                int none = -1;
+                timer_duty = timer_duty_.compare_exchange_strong(none, static_cast<int>(local_idx));
+            }
 
-            std::cout << "tid: " << std::this_thread::get_id()
-                      << " 获取任务成功...\n";
+            // *cached模式下，空闲时间超过 idle_timeout_ns_ 的多余线程结束回收掉：最多睡到那个时候
+            auto timeout = std::chrono::nanoseconds::max();
+            if (cached) {
+                uint64_t idle = now_ns() - idle_since;
+                timeout = std::chrono::nanoseconds(idle < idle_timeout_ns_ ? idle_timeout_ns_ - idle : 0);
+            }
+            bool woken = park(local_idx, timeout, timer_duty);
+            if (timer_duty)
+                timer_duty_.store(-1);
 
-            // 3.如果不空，从任务队列取一个任务
-            task = taskque_.front();
-            taskque_.pop();
-            task_size_--;
+            if (cached && !woken && task_size_ == 0 && now_ns() - idle_since >= idle_timeout_ns_
+                && retire_idle(thread_id, idle_since, false))
+                return;
 
-            // 3.1 如果队列还有任务，继续通知其它的线程
-            if (taskque_.size() > 0)
-                not_empty_.notify_all();
+            continue;   // 醒了，回去取任务
+        }
 
-            // 3.2 取出一个任务，在 not_full_ 上通知，可以继续提交生产任务
-            not_full_.notify_all();
+        TP_TRACE(DEQUEUE, task);
+        TP_PROFILE_DEQUEUED();
 
-        }   // 4.弄个作用域，取出任务后就需要释放锁了
+        uint64_t start_ns = now_ns();
+        WorkerStats::add(stats.idle_ns, start_ns - idle_since);
+        stats.queue_latency.record(start_ns - task->enqueue_ns_);
+        WorkerStats::add(stats.queue_wait_ns, start_ns - task->enqueue_ns_);
 
-        // 5.当前线程执行这个任务
-        if (task != nullptr)
-            // task->run(); 执行任务，并把任务返回值get_val给到Result
-            task->exec();
+        // 4.当前线程执行这个任务，并把任务返回值存进共享状态
+        // 它完成时如果有后继就绪，第一个留给这个线程接着执行，不经过任务队列
+        for (;;) {
+            TP_TRACE(START, task);
+            {
+                TP_PROFILE_TASK_SCOPE();
+                // 按 CANCEL_PENDING / IMMEDIATE 关闭时，关闭之后才取到的任务不再执行
+                if (cancel_pending_.load(std::memory_order_relaxed))
+                    task->cancel();
+                else
+                    task->run();
+            }
+            TP_TRACE(FINISH, task);
+
+            idle_since = now_ns();
+            WorkerStats::add(stats.busy_ns, idle_since - start_ns);
+            WorkerStats::add(stats.tasks_executed, 1);
+            stats.run_time.record(idle_since - start_ns);
+
+            task = cur_inline_;
+            if (task == nullptr) break;
+            cur_inline_ = nullptr;
+            start_ns = idle_since;
+            stats.queue_latency.record(start_ns - task->enqueue_ns_);
+            WorkerStats::add(stats.queue_wait_ns, start_ns - task->enqueue_ns_);
+        }
     
         idle_thread_num_++;
-        
-        last_time = std::chrono::high_resolution_clock::now();  // 线程结束，重新记录last_time
+        // 有人在 wait_idle：任务都取完了才可能全部空闲，这时通知它检查一下
+        if (idle_waiters_ > 0 && task_size_ == 0) {
+            std::lock_guard<QueueMutex> lock(taskque_mutx_);
+            idle_cond_.notify_all();
+        }
+    }
+}
+
+detail::Job* ThreadPool::spin_for_task(std::size_t local_idx, WorkerStats& stats) {
+    // 同时自旋的线程最多占一半的 CPU（单核机器上不自旋），剩下的留给生产者和干活的线程
+    static const unsigned max_spinning = std::thread::hardware_concurrency() / 2;
+    if (spin_count_ == 0 || spinning_num_ >= max_spinning) return nullptr;
+
+    // 登记自旋：入队的一方看到有线程在自旋，就少唤醒一个睡眠的线程
+    spinning_num_++;
+    for (int i = 0; i < spin_count_ && task_size_.load(std::memory_order_relaxed) == 0; i++)
+        cpu_relax();
+    spinning_num_--;
+
+    detail::Job* task = take_task(local_idx, stats, true);
+    // 入队的一方可能因为这个线程在自旋而没有唤醒别人，还有任务就替它唤醒一个
+    if (task != nullptr && task_size_ > 0 && sleep_thread_num_ > 0 && spinning_num_ == 0)
+        wake_parked(1);
+    return task;
+}
+
+bool ThreadPool::park(std::size_t slot, std::chrono::nanoseconds timeout, bool timer_duty) {
+    TP_PROFILE_SCOPE(PARK);
+    ParkSlot& p = parks_[slot];
+    p.state.store(0, std::memory_order_relaxed);
+    {
+        std::lock_guard<ParkMutex> lock(park_mutx_);
+        parked_.push_back(slot);
+        sleep_thread_num_++;
+    }
+
+    // 先登记睡眠再检查 task_size_，和入队时 "先加task_size_再看睡眠数" 配对，不会丢唤醒
+    bool wait = task_size_ == 0 && is_pool_running_;
+    if (timer_duty) {
+        // 登记之后再读最早的到期时间：之后再插入更早的定时任务，kick_timer_duty 一定能在睡眠栈上找到这个线程
+        uint64_t next = next_timer_ns_;
+        uint64_t now = now_ns();
+        if (next <= now)
+            wait = false;
+        else if (next != UINT64_MAX && std::chrono::nanoseconds(next - now) < timeout)
+            timeout = std::chrono::nanoseconds(next - now);
+    } else if (next_timer_ns_ != UINT64_MAX && timer_duty_ < 0) {
+        wait = false;   // 有定时任务但是没有线程负责，回去接手
+    }
+
+    if (wait) {
+        auto deadline = timeout == std::chrono::nanoseconds::max()
+                        ? std::chrono::steady_clock::time_point::max()
+                        : std::chrono::steady_clock::now() + timeout;
+        while (p.state.load(std::memory_order_acquire) == 0) {
+            if (timeout == std::chrono::nanoseconds::max()) {
+                detail::futex_wait(&p.state, 0);
+                continue;
+            }
+            auto left = deadline - std::chrono::steady_clock::now();
+            if (left <= std::chrono::nanoseconds::zero()
+                || !detail::futex_wait_for(&p.state, 0, left))
+                break;
+        }
+    }
+    if (p.state.load(std::memory_order_acquire) == 1) {
+        TP_PROFILE_WOKEN(p.wake_ns);
+        return true;
+    }
+
+    // 自己醒来的：还在睡眠栈上就把自己摘掉
+    {
+        std::lock_guard<ParkMutex> lock(park_mutx_);
+        for (auto it = parked_.begin(); it != parked_.end(); ++it) {
+            if (*it == slot) {
+                parked_.erase(it);
+                sleep_thread_num_--;
+                return false;
+            }
+        }
+    }
+    // 已经被唤醒方从栈上取走了，等它把 state 置 1（很快）
+    while (p.state.load(std::memory_order_acquire) == 0)
+        detail::futex_wait(&p.state, 0);
+    TP_PROFILE_WOKEN(p.wake_ns);
+    return true;
+}
+
+void ThreadPool::wake_slot(std::size_t slot) {
+    bool found = false;
+    {
+        std::lock_guard<ParkMutex> lock(park_mutx_);
+        for (auto it = parked_.begin(); it != parked_.end(); ++it) {
+            if (*it == slot) {
+                parked_.erase(it);
+                sleep_thread_num_--;
+                found = true;
+                break;
+            }
+        }
+    }
+    if (found) {
+        TP_PROFILE_STAMP(parks_[slot].wake_ns);
+        parks_[slot].state.store(1, std::memory_order_release);
+        detail::futex_wake(&parks_[slot].state, 1);
+    }
+}
+
+std::size_t ThreadPool::wake_parked(std::size_t n, int node) {
+    std::size_t woken = 0;
+    while (woken < n) {
+        // 一次最多取一小批，持锁时间短，唤醒（系统调用）放在锁外
+        std::size_t batch[16];
+        std::size_t k = 0;
+        {
+            std::lock_guard<ParkMutex> lock(park_mutx_);
+            // 先从栈顶往下找指定节点上的线程
+            if (node >= 0) {
+                for (auto it = parked_.rbegin(); it != parked_.rend() && k < 16 && woken + k < n; ) {
+                    if (slot_node_[*it] == node) {
+                        batch[k++] = *it;
+                        it = std::make_reverse_iterator(parked_.erase(std::next(it).base()));
+                    } else {
+                        ++it;
+                    }
+                }
+            }
+            while (k < 16 && woken + k < n && !parked_.empty()) {
+                batch[k++] = parked_.back();
+                parked_.pop_back();
+            }
+            sleep_thread_num_ -= k;
+        }
+        if (k == 0) break;
+
+        for (std::size_t i = 0; i < k; i++) {
+            TP_PROFILE_STAMP(parks_[batch[i]].wake_ns);
+            parks_[batch[i]].state.store(1, std::memory_order_release);
+            detail::futex_wake(&parks_[batch[i]].state, 1);
+        }
+        woken += k;
     }
+    return woken;
+}
+
+detail::Job* ThreadPool::take_task(std::size_t local_idx, WorkerStats& stats, bool idle) {
+    detail::Job* task = nullptr;
+    std::size_t levels = priority_levels_;
+    std::size_t normal = levels / 2;
+
+    if (levels > 1) {
+        // 防止饿死：每取 Priority_aging_interval 个任务，有一次从轮转到的那一级开始找
+        static thread_local unsigned take_tick = 0;
+        if (++take_tick % Priority_aging_interval == 0) {
+            std::size_t first = take_tick / Priority_aging_interval % levels;
+            task = pop_levels(first, levels);
+            if (task == nullptr)
+                task = pop_levels(0, first);
+        }
+        // 比默认优先级高的任务 先于本地队列
+        if (task == nullptr)
+            task = pop_levels(0, normal);
+    }
+
+    // MODE_STEAL: 先取自己的本地队列
+    if (task == nullptr && PoolMode::MODE_STEAL == pool_mode_)
+        task = local_ques_[local_idx]->pop();
+
+    // 再取公共队列（单个优先级时就是一个 FIFO 队列）
+    if (task == nullptr)
+        task = levels == 1 ? pop_levels(0, 1) : pop_levels(normal, levels);
+
+    // MODE_STEAL: 最后随机选一个起点，依次尝试窃取其它线程的本地队列
+    if (task == nullptr && PoolMode::MODE_STEAL == pool_mode_) {
+        static thread_local std::minstd_rand rng(std::random_device{}());
+        std::size_t n = local_ques_.size();
+        std::size_t start = rng() % n;
+        for (std::size_t i = 0; i < n && task == nullptr; i++) {
+            std::size_t victim = (start + i) % n;
+            if (victim != local_idx)
+                task = local_ques_[victim]->steal();
+        }
+        if (task != nullptr)
+            WorkerStats::add(stats.steals, 1);
+    }
+
+    if (task != nullptr) {
+        if (idle)
+            idle_thread_num_--;
+        task_size_--;
+    }
+    return task;
+}
+
+detail::Job* ThreadPool::pop_levels(std::size_t from, std::size_t to) {
+    std::size_t normal = priority_levels_ / 2;
+    for (std::size_t i = from; i < to; i++) {
+        detail::Job* task = i == normal && node_count_ > 1 ? pop_nodes() : taskques_[i]->pop();
+        if (task != nullptr) {
+            // 取出一个任务，可以继续提交生产任务
+            notify_not_full();
+            return task;
+        }
+    }
+    return nullptr;
+}
+
+detail::Job* ThreadPool::pop_nodes() {
+    int home = cur_node_;
+    detail::Job* task = nullptr;
+    if (home >= 0)
+        task = node_ques_[home]->pop();
+    if (task == nullptr)
+        task = taskques_[priority_levels_ / 2]->pop();
+    // 本节点和公共队列都空了，才去取其它节点的任务（数据多半在那个节点的内存里）
+    for (int k = 1; task == nullptr && k <= node_count_; k++) {
+        int node = (home + k) % node_count_;
+        if (node != home)
+            task = node_ques_[node]->pop();
+    }
+    return task;
+}
+
+int ThreadPool::submit_node() const {
+    int node = cur_pool_ == this ? cur_node_ : topology_->node_of_cpu(sched_getcpu());
+    // 这个节点上没有线程池的线程，放进公共队列
+    if (node < 0 || node >= node_count_ || node_threads_[node].load(std::memory_order_relaxed) == 0)
+        return -1;
+    return node;
+}
+
+void ThreadPool::assign_placement(Thread& thread) {
+    Placement placement = ::place_thread(affinity_, thread.getSlot());
+    slot_node_[thread.getSlot()] = placement.node;
+    if (node_count_ > 1 && placement.node >= 0)
+        node_threads_[placement.node]++;
+    thread.setPlacement(std::move(placement));
+}
+
+int ThreadPool::current_node() {
+    if (cur_node_ >= 0)
+        return cur_node_;
+    return CpuTopology::system().node_of_cpu(sched_getcpu());
+}
+
+void ThreadPool::retire_stats(Thread& thread) {
+    WorkerStats& stats = thread.stats();
+    retired_stats_.tasks_executed += stats.tasks_executed.load(std::memory_order_relaxed);
+    retired_stats_.steals += stats.steals.load(std::memory_order_relaxed);
+    retired_stats_.idle_ns += stats.idle_ns.load(std::memory_order_relaxed);
+    retired_stats_.busy_ns += stats.busy_ns.load(std::memory_order_relaxed);
+    retired_stats_.queue_wait_ns += stats.queue_wait_ns.load(std::memory_order_relaxed);
+    stats.queue_latency.merge_into(retired_queue_latency_.counts);
+    stats.run_time.merge_into(retired_run_time_.counts);
+}
+
+std::size_t ThreadPool::acquire_slot() {
+    for (std::size_t i = 0; i < slot_used_.size(); i++) {
+        if (!slot_used_[i]) {
+            slot_used_[i] = true;
+            return i;
+        }
+    }
+    // 线程数不会超过槽位数，走不到这里
+    throw "no free thread slot!";
+}
+
+void ThreadPool::release_slot(std::size_t slot) {
+    slot_used_[slot] = false;
+    if (node_count_ > 1 && slot_node_[slot] >= 0)
+        node_threads_[slot_node_[slot]]--;
+}
+
+std::size_t ThreadPool::current_slot() const {
+    return cur_pool_ == this ? cur_slot_ : slot_num_;
+}
+
+bool ThreadPool::run_pending_task() {
+    if (cur_pool_ != this) return false;
+
+    detail::Job* task = take_task(cur_slot_, cur_thread_->stats(), false);
+    if (task == nullptr) return false;
+
+    // 嵌在当前任务里执行，耗时算在外层任务里，这里只记排队延迟和任务数
+    // 它就绪的后继也在这里执行掉：留到外层任务结束再执行的话，外层任务可能正在等它
+    run_nested(task);
+    return true;
+}
+
+void ThreadPool::run_in_caller(detail::Job* job) {
+    if (cur_pool_ == this) {
+        run_nested(job);
+    } else {
+        TP_TRACE(START, job);
+        job->run();
+        TP_TRACE(FINISH, job);
+    }
+}
+
+void ThreadPool::run_nested(detail::Job* task) {
+    WorkerStats& stats = cur_thread_->stats();
+    detail::Job* outer_inline = cur_inline_;
+    cur_inline_ = nullptr;
+    do {
+        stats.queue_latency.record(now_ns() - task->enqueue_ns_);
+        TP_TRACE(START, task);
+        {
+            TP_PROFILE_TASK_SCOPE();
+            if (cancel_pending_.load(std::memory_order_relaxed))
+                task->cancel();
+            else
+                task->run();
+        }
+        TP_TRACE(FINISH, task);
+        WorkerStats::add(stats.tasks_executed, 1);
+        task = cur_inline_;
+        cur_inline_ = nullptr;
+    } while (task != nullptr);
+    cur_inline_ = outer_inline;
+}
+
+bool detail::SharedStateBase::help_wait() {
+    ThreadPool* pool = cur_pool_;
+    if (pool == nullptr || !pool->help_while_waiting_)
+        return false;
+
+    // 帮的是当前线程所属的线程池（等的任务可能在别的线程池里）：正是它少了一个干活的线程
+    int s = state_.load(std::memory_order_acquire);
+    while (s != READY) {
+        if (pool->run_pending_task()) {
+            s = state_.load(std::memory_order_acquire);
+            continue;
+        }
+        // 队列里没有任务：要等的任务正在别的线程上执行，它可能还会提交新任务，睡一会儿再看
+        if (s == WAITING || state_.compare_exchange_weak(s, WAITING, std::memory_order_acquire))
+            futex_wait_for(&state_, WAITING, std::chrono::nanoseconds(Help_wait_ns));
+        s = state_.load(std::memory_order_acquire);
+    }
+    return true;
+}
+
+/*** 取消和截止时间 ************************************/
+
+void ThreadPool::attach_hook(detail::SharedStateBase* job, const TaskOptions& opts) {
+    auto hook = new detail::TaskHook();
+    hook->job = job;
+    if (opts.deadline != std::chrono::steady_clock::time_point::max()) {
+        auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(opts.deadline.time_since_epoch()).count();
+        hook->deadline_ns = ns > 0 ? static_cast<uint64_t>(ns) : 1;
+    }
+    job->hook_ = hook;
+
+    detail::CancelState* source = opts.token.state_;
+    if (source != nullptr) {
+        source->add_ref();
+        hook->source = source;
+        // 已经取消了就不登记，线程取到它时会看到
+        source->link(hook);
+    }
+}
+
+bool ThreadPool::stop_requested() {
+    const detail::TaskHook* hook = detail::cur_task_hook;
+    if (hook == nullptr)
+        return false;
+    if (hook->source != nullptr && hook->source->cancelled())
+        return true;
+    return hook->deadline_ns != 0 && now_ns() >= hook->deadline_ns;
+}
+
+bool Task::stop_requested() const {
+    return ThreadPool::stop_requested();
+}
+
+void detail::TaskHook::hold() {
+    job->add_ref();
+}
+
+void detail::TaskHook::fire() {
+    SharedStateBase* state = job;
+    state->abort("task is cancelled!");
+    state->release();
+}
+
+bool detail::SharedStateBase::abort(const char* why) {
+    // 没有 hook 的任务只有任务队列一方会执行或者取消它
+    if (hook_ != nullptr) {
+        int expected = 0;
+        if (!hook_->claim.compare_exchange_strong(expected, 2))
+            return false;
+        if (hook_->source != nullptr)
+            hook_->source->unlink(hook_);
+    }
+    error_ = std::make_exception_ptr(why);
+    discard();
+    set_ready();
+    return true;
+}
+
+bool detail::SharedStateBase::begin_run() {
+    TaskHook* hook = hook_;
+    if (hook->source != nullptr && hook->source->cancelled()) {
+        abort("task is cancelled!");
+        return false;
+    }
+    if (hook->deadline_ns != 0 && now_ns() >= hook->deadline_ns) {
+        abort("task deadline exceeded!");
+        return false;
+    }
+
+    int expected = 0;
+    if (!hook->claim.compare_exchange_strong(expected, 1))
+        return false;   // 刚被取消了
+    // 开始执行了，之后的取消只能靠任务自己检查，不用再登记着
+    if (hook->source != nullptr)
+        hook->source->unlink(hook);
+    return true;
+}
+
+void detail::SharedStateBase::wait_deadline() {
+    uint64_t deadline = hook_->deadline_ns;
+    int s = state_.load(std::memory_order_acquire);
+    while (s != READY) {
+        uint64_t now = now_ns();
+        if (now >= deadline) {
+            // 还没开始执行的就地完成；已经在执行的 只能接着等它执行完
+            abort("task deadline exceeded!");
+            return;
+        }
+        if (s == WAITING || state_.compare_exchange_weak(s, WAITING, std::memory_order_acquire))
+            futex_wait_for(&state_, WAITING, std::chrono::nanoseconds(deadline - now));
+        s = state_.load(std::memory_order_acquire);
+    }
+}
+
+void detail::SharedStateBase::drop_hook() {
+    if (hook_->source != nullptr) {
+        hook_->source->unlink(hook_);
+        hook_->source->release();
+    }
+    delete hook_;
+}
+
+/*** 任务依赖 ******************************************/
+
+void ThreadPool::add_dependencies(detail::Dependent* job, const Dependency* deps, std::size_t n) {
+    job->dep_pool_ = this;
+    job->deps_.store(static_cast<int>(n) + 1, std::memory_order_relaxed);
+    detail::Successor* edges = job->inline_edges_;
+    if (n > 2) {
+        job->edges_.reset(new detail::Successor[n]);
+        edges = job->edges_.get();
+    }
+    for (std::size_t i = 0; i < n; i++) {
+        edges[i].dep = job;
+        if (!deps[i].state_->add_successor(&edges[i]))
+            job->resolve(false);    // 这个前驱已经完成了
+    }
+    // 登记的线程是提交者，可能接下来就要等这个任务，不能留给自己执行
+    job->resolve(false);
+}
+
+void ThreadPool::dispatch_ready(detail::Job* job, bool inline_ok) {
+    if (cur_pool_ != this) {
+        if (enqueue(job, std::chrono::nanoseconds::max()) != SubmitStatus::OK)
+            job->cancel();  // 线程池已经关闭
+        return;
+    }
+
+    if (inline_ok && cur_inline_ == nullptr) {
+        job->enqueue_ns_ = now_ns();
+        TP_TRACE(ENQUEUE, job);
+        cur_inline_ = job;
+        return;
+    }
+
+    // 线程池自己的线程阻塞在满的队列上，可能所有线程都在等，干脆自己执行
+    SubmitStatus status = enqueue(job, std::chrono::nanoseconds::zero());
+    if (SubmitStatus::SHUTDOWN == status) {
+        job->cancel();
+    } else if (status != SubmitStatus::OK) {
+        TP_TRACE(START, job);
+        job->run();
+        TP_TRACE(FINISH, job);
+    }
+}
+
+void detail::Dependent::resolve(bool inline_ok) {
+    if (deps_.fetch_sub(1, std::memory_order_acq_rel) == 1)
+        dep_pool_->dispatch_ready(as_job(), inline_ok);
+}
+
+void detail::resolve_successors(Successor* list) {
+    while (list != nullptr) {
+        // 后继就绪后随时可能被执行、释放（节点嵌在它里面），先取出 next
+        Successor* next = list->next;
+        list->dep->resolve(true);
+        list = next;
+    }
+}
+
+/*** 任务组 ******************************************/
+
+// 任务队列里的票：取到它的线程按 DRR 挑一个组执行，和哪个组放的票无关
+class detail::GroupTicket : public Job, public PoolAllocated {
+public:
+    explicit GroupTicket(ThreadPool* pool) : pool_(pool) {}
+
+    void run() override {
+        ThreadPool* pool = pool_;
+        delete this;
+        pool->run_group_task();
+    }
+
+    void cancel() override {
+        ThreadPool* pool = pool_;
+        delete this;
+        pool->cancel_group_tasks();
+    }
+
+private:
+    ThreadPool* pool_;
+};
+
+TaskGroup::TaskGroup(ThreadPool* pool, const std::string& name, const GroupOptions& opts)
+    : pool_(pool),
+      name_(name),
+      max_running_(opts.max_concurrency > 0 ? opts.max_concurrency : INT_MAX),
+      max_queued_(opts.max_queued > 0 ? opts.max_queued : SIZE_MAX),
+      weight_(std::max(opts.weight, 1)),
+      cost_ns_(Group_initial_cost_ns) {
+    stats_.name = name;
+    stats_.weight = weight_;
+}
+
+int64_t TaskGroup::quantum() const {
+    return Group_quantum_ns * weight_;
+}
+
+SubmitStatus TaskGroup::push(detail::Job* job, bool wait) {
+    if (pool_->submit_rejected())
+        return SubmitStatus::SHUTDOWN;
+
+    std::unique_lock<std::mutex> lock(pool_->group_mutx_);
+    if (queue_.size() >= max_queued_) {
+        if (!wait) {
+            stats_.rejected++;
+            return SubmitStatus::QUEUE_FULL;
+        }
+        // shutdown 会叫醒所有等空位的提交者：开始拒绝提交了就不再等
+        space_cond_.wait(lock, [&]() { return queue_.size() < max_queued_ || pool_->submit_rejected(); });
+        if (pool_->submit_rejected())
+            return SubmitStatus::SHUTDOWN;
+    }
+    job->enqueue_ns_ = now_ns();
+    queue_.push_back(job);
+    stats_.submitted++;
+    // 可以执行的任务数 min(排队数, 并发上限 - 执行数) 多了一个才需要一张票
+    bool runnable = static_cast<int64_t>(queue_.size()) + running_ <= max_running_;
+    pool_->update_active(this);
+    lock.unlock();
+
+    if (runnable)
+        pool_->issue_ticket();
+    return SubmitStatus::OK;
+}
+
+void TaskGroup::wait_all() {
+    std::unique_lock<std::mutex> lock(pool_->group_mutx_);
+    idle_cond_.wait(lock, [&]() { return queue_.empty() && running_ == 0; });
+}
+
+GroupStats TaskGroup::stats() const {
+    std::lock_guard<std::mutex> lock(pool_->group_mutx_);
+    GroupStats gs = stats_;
+    gs.queued = queue_.size();
+    gs.running = running_;
+    return gs;
+}
+
+TaskGroup& ThreadPool::create_group(const std::string& name, const GroupOptions& opts) {
+    std::lock_guard<std::mutex> lock(group_mutx_);
+    for (auto& group : groups_) {
+        if (group->name_ == name)
+            throw "group already exists!";
+    }
+    groups_.emplace_back(new TaskGroup(this, name, opts));
+    return *groups_.back();
+}
+
+TaskGroup* ThreadPool::find_group(const std::string& name) {
+    std::lock_guard<std::mutex> lock(group_mutx_);
+    for (auto& group : groups_) {
+        if (group->name_ == name)
+            return group.get();
+    }
+    return nullptr;
+}
+
+void ThreadPool::issue_ticket() {
+    // 和就绪的后继一样：外部线程等队列的空位，线程池的线程遇到队列满直接执行；放不进去（关闭了）就取消
+    dispatch_ready(new detail::GroupTicket(this), false);
+}
+
+void ThreadPool::run_group_task() {
+    std::unique_lock<std::mutex> lock(group_mutx_);
+    TaskGroup* group = pick_group();
+    if (group == nullptr)
+        return;
+
+    detail::Job* job = group->queue_.front();
+    group->queue_.pop_front();
+    // 每取出一个就通知一次：只在 满->不满 时通知的话，连着取两个只叫醒一个提交者，另一个一直睡着
+    group->space_cond_.notify_one();
+    group->running_++;
+    group->stats_.peak_running = std::max(group->stats_.peak_running, group->running_);
+    uint64_t start = now_ns();
+    group->stats_.queue_wait_ns += start - job->enqueue_ns_;
+    // 还不知道要执行多久：先按估计值扣额度，执行完再按实际的时间补差
+    int64_t charged = group->cost_ns_;
+    group->deficit_ -= charged;
+    update_active(group);
+    lock.unlock();
+
+    job->run();
+
+    int64_t cost = static_cast<int64_t>(now_ns() - start);
+    lock.lock();
+    group->running_--;
+    group->stats_.completed++;
+    group->stats_.run_ns += cost;
+    group->deficit_ += charged - cost;
+    group->cost_ns_ += (cost - group->cost_ns_) / 8;
+    // 到了并发上限 还有任务在排队的组，执行完一个 就多了一个可以执行的
+    bool more = !group->queue_.empty()
+                && static_cast<int64_t>(group->queue_.size()) + group->running_ >= group->max_running_;
+    update_active(group);
+    if (group->queue_.empty() && group->running_ == 0)
+        group->idle_cond_.notify_all();
+    lock.unlock();
+
+    if (more)
+        issue_ticket();
+}
+
+TaskGroup* ThreadPool::pick_group() {
+    if (active_groups_.empty())
+        return nullptr;
+
+    for (;;) {
+        for (std::size_t i = 0; i < active_groups_.size(); i++) {
+            TaskGroup* group = active_groups_[drr_cursor_];
+            if (group->deficit_ > 0)
+                return group;
+            // 这个组的额度用完了：轮到下一个组，给它一份额度
+            drr_cursor_ = (drr_cursor_ + 1) % active_groups_.size();
+            TaskGroup* next = active_groups_[drr_cursor_];
+            next->deficit_ += next->quantum();
+        }
+        // 转了一圈还都欠着（执行了很长的任务）：直接补上够用的圈数，不用一圈一圈地转
+        int64_t rounds = INT64_MAX;
+        for (TaskGroup* group : active_groups_)
+            rounds = std::min(rounds, -group->deficit_ / group->quantum() + 1);
+        for (TaskGroup* group : active_groups_)
+            group->deficit_ += rounds * group->quantum();
+    }
+}
+
+void ThreadPool::update_active(TaskGroup* group) {
+    bool runnable = !group->queue_.empty() && group->running_ < group->max_running_;
+    if (runnable == group->active_)
+        return;
+    group->active_ = runnable;
+    if (runnable) {
+        active_groups_.push_back(group);
+        return;
+    }
+
+    // 移出轮转表：攒下的额度作废，欠的留着，不能靠闲一会儿把账清掉
+    group->deficit_ = std::min<int64_t>(group->deficit_, 0);
+    std::size_t idx = std::find(active_groups_.begin(), active_groups_.end(), group) - active_groups_.begin();
+    bool was_current = idx == drr_cursor_;
+    active_groups_.erase(active_groups_.begin() + idx);
+    if (idx < drr_cursor_)
+        drr_cursor_--;
+    if (drr_cursor_ >= active_groups_.size())
+        drr_cursor_ = 0;
+    if (was_current && !active_groups_.empty())
+        active_groups_[drr_cursor_]->deficit_ += active_groups_[drr_cursor_]->quantum();
+}
+
+void ThreadPool::cancel_group_tasks() {
+    std::vector<detail::Job*> jobs;
+    std::unique_lock<std::mutex> lock(group_mutx_);
+    for (auto& group : groups_) {
+        jobs.insert(jobs.end(), group->queue_.begin(), group->queue_.end());
+        group->stats_.cancelled += group->queue_.size();
+        group->queue_.clear();
+        update_active(group.get());
+        group->space_cond_.notify_all();
+    }
+    lock.unlock();
+
+    for (detail::Job* job : jobs)
+        job->cancel();
+
+    // 取消完再通知：wait_all 返回时 Future 都已经有结果了
+    lock.lock();
+    for (auto& group : groups_) {
+        if (group->queue_.empty() && group->running_ == 0)
+            group->idle_cond_.notify_all();
+    }
+}
+
+/*** 按 key 串行（strand） *******************************/
+
+bool ThreadPool::submit_strand(std::size_t hash, detail::Job* job) {
+    if (submit_rejected())
+        return false;
+
+    // std::hash 对整数是恒等映射：乘一个奇数打散，取高位，连续的 key 也能均匀分到各个 strand
+    uint64_t mixed = static_cast<uint64_t>(hash) * 0x9E3779B97F4A7C15ull;
+    detail::Strand& strand = strands_[(mixed >> 32) % strand_num_];
+    job->enqueue_ns_ = now_ns();
+    if (strand.push(job))
+        dispatch_ready(&strand, false);
+    return true;
+}
+
+detail::Job* detail::Strand::pop() {
+    Job* head = head_;
+    Job* next = head->strand_next_.load(std::memory_order_acquire);
+    if (head == &stub_) {
+        if (next == nullptr)
+            return nullptr;
+        head_ = next;
+        head = next;
+        next = next->strand_next_.load(std::memory_order_acquire);
+    }
+    if (next != nullptr) {
+        head_ = next;
+        return head;
+    }
+    // head 是最后一个：把哨兵链到它后面再取，链表不会变空
+    if (tail_.load(std::memory_order_acquire) != head)
+        return nullptr;
+    link(&stub_);
+    next = head->strand_next_.load(std::memory_order_acquire);
+    if (next != nullptr) {
+        head_ = next;
+        return head;
+    }
+    return nullptr;
+}
+
+void detail::Strand::run() {
+    // 线程池的线程执行一批就让出来，别的 strand 不至于等太久；PendingTask::run 在外部线程上一次执行完
+    bool on_pool = cur_pool_ == pool_;
+    int budget = on_pool ? Strand_batch : INT_MAX;
+    uint64_t ran = 0;
+    for (;;) {
+        Job* job = take();
+        if (on_pool && pool_->cancel_pending_.load(std::memory_order_relaxed))
+            job->cancel();
+        else
+            job->run();
+        ran++;
+        if (pending_.fetch_sub(1, std::memory_order_acq_rel) == 1)
+            break;
+
+        if (--budget == 0) {
+            // 放回任务队列（MODE_STEAL 是当前线程的本地队列，多半还是这个线程接着执行）
+            SubmitStatus status = pool_->enqueue(this, std::chrono::nanoseconds::zero());
+            if (SubmitStatus::OK == status)
+                break;
+            if (SubmitStatus::SHUTDOWN == status) {
+                cancel();
+                break;
+            }
+            budget = Strand_batch;  // 队列满了：不等，接着执行
+        }
+    }
+    // 线程统计 strand 本身算一个任务，多执行的补上
+    if (on_pool && ran > 1)
+        WorkerStats::add(cur_thread_->stats().tasks_executed, ran - 1);
+}
+
+void detail::Strand::cancel() {
+    do {
+        take()->cancel();
+    } while (pending_.fetch_sub(1, std::memory_order_acq_rel) != 1);
+}
+
+/*** 阻塞区 ******************************************/
+
+// 当前线程嵌套了几层阻塞区，只有最外层的补替补线程
+static thread_local int cur_blocking_ = 0;
+
+BlockingRegion::BlockingRegion() : pool_(nullptr), compensated_(false) {
+    if (cur_pool_ == nullptr) return;
+    if (cur_blocking_++ > 0) return;
+    pool_ = cur_pool_;
+    compensated_ = pool_->enter_blocking();
+}
+
+BlockingRegion::~BlockingRegion() {
+    if (cur_pool_ == nullptr) return;
+    if (--cur_blocking_ > 0) return;
+    pool_->leave_blocking(compensated_);
+}
+
+bool ThreadPool::enter_blocking() {
+    // 之前退出的替补线程：固定线程数的模式没有控制线程替它们 join，反正这个线程接下来也要阻塞
+    reap_exited();
+    blocked_num_++;
+
+    // 还有多出来、等着退出的线程：把它留下来当替补，不用新建
+    if (take_one(spares_owed_) || take_one(retire_wanted_))
+        return true;
+
+    std::lock_guard<QueueMutex> lock(taskque_mutx_);
+    if (!spawn_thread())
+        return false;   // 到上限了、正在关闭
+    compensations_++;
+    return true;
+}
+
+void ThreadPool::leave_blocking(bool compensated) {
+    blocked_num_--;
+    // 线程多了一个：下一个回来取任务的线程退出，一般就是这个线程自己，执行完手上的任务就走
+    // 单独记在 spares_owed_ 里：cached 模式的控制线程加线程时会清零 retire_wanted_，替补线程不能因此留下来
+    if (compensated)
+        spares_owed_++;
+}
+
+/*** 协程（coro.hh） ***********************************/
+
+bool ThreadPool::post_resume(detail::Job* job, int priority) {
+    // 成功入队之后协程随时可能被恢复、awaiter 随之销毁，不能再碰 job
+    return enqueue(job, std::chrono::nanoseconds::max(), priority) == SubmitStatus::OK;
+}
+
+bool ThreadPool::resume_after(detail::SharedStateBase* state, detail::Dependent* job) {
+    // 和 add_dependencies 一样走后继链表，只是只有一个前驱，不用多占一份依赖
+    job->dep_pool_ = state->pool_;
+    job->deps_.store(1, std::memory_order_relaxed);
+    job->inline_edges_[0].dep = job;
+    return state->add_successor(&job->inline_edges_[0]);
+}
+
+PoolStats ThreadPool::stats() {
+    PoolStats ps;
+    ps.threads = cur_thread_size_;
+    ps.idle_threads = idle_thread_num_;
+    ps.pending_tasks = task_size_;
+    ps.caller_runs = caller_runs_;
+    ps.dropped = dropped_;
+    ps.rejected = rejected_;
+    ps.blocked_threads = blocked_num_;
+    ps.compensations = compensations_;
+
+    std::lock_guard<QueueMutex> lock(taskque_mutx_);
+    ps.retired = retired_stats_;
+    ps.queue_latency = retired_queue_latency_;
+    ps.run_time = retired_run_time_;
+
+    {
+        std::lock_guard<std::mutex> group_lock(group_mutx_);
+        for (auto& group : groups_) {
+            GroupStats gs = group->stats_;
+            gs.queued = group->queue_.size();
+            gs.running = group->running_;
+            ps.groups.push_back(gs);
+        }
+    }
+
+    for (auto& [tid, thread] : threads_) {
+        WorkerStats& stats = thread->stats();
+        WorkerStatsSnapshot w;
+        w.thread_id = tid;
+        w.tasks_executed = stats.tasks_executed.load(std::memory_order_relaxed);
+        w.steals = stats.steals.load(std::memory_order_relaxed);
+        w.idle_ns = stats.idle_ns.load(std::memory_order_relaxed);
+        w.busy_ns = stats.busy_ns.load(std::memory_order_relaxed);
+        w.queue_wait_ns = stats.queue_wait_ns.load(std::memory_order_relaxed);
+        ps.workers.push_back(w);
+
+        stats.queue_latency.merge_into(ps.queue_latency.counts);
+        stats.run_time.merge_into(ps.run_time.counts);
+    }
+    return ps;
 }
 
 bool ThreadPool::check_running_state() const {
     return is_pool_running_;
 }
 
+/*** 定时任务 ******************************************/
+
+TimerHandle ThreadPool::add_timer(detail::TimerJob* job, uint64_t delay_ns) {
+    job->expire_ns_ = now_ns() + delay_ns;
+
+    std::unique_lock<std::mutex> lock(timer_mutx_);
+    uint64_t tick = timer_tick_of(job->expire_ns_);
+    timer_wheel_.insert(job, tick);
+    // 插入只会让最早的到期时间提前，不用重新扫一遍时间轮
+    bool earlier = tick * Timer_tick_ns < next_timer_ns_;
+    if (earlier)
+        next_timer_ns_ = tick * Timer_tick_ns;
+    lock.unlock();
+
+    if (earlier)
+        kick_timer_duty();
+    return TimerHandle(job);
+}
+
+void ThreadPool::poll_timers() {
+    uint64_t next = next_timer_ns_.load(std::memory_order_relaxed);
+    if (next == UINT64_MAX) return;
+    uint64_t now = now_ns();
+    if (now < next) return;
+
+    // 已经有别的线程在推进，不用等它
+    std::unique_lock<std::mutex> lock(timer_mutx_, std::try_to_lock);
+    if (!lock.owns_lock()) return;
+
+    static thread_local std::vector<detail::TimerJob*> fired;
+    timer_wheel_.advance(now / Timer_tick_ns, [](TimerWheel::Node* node) {
+        auto job = static_cast<detail::TimerJob*>(node);
+        job->state_ = detail::TimerJob::QUEUED;
+        fired.push_back(job);
+    });
+    update_next_timer();
+    lock.unlock();
+
+    for (std::size_t i = 0; i < fired.size(); i++) {
+        SubmitStatus status = enqueue(fired[i], std::chrono::nanoseconds::zero());
+        if (SubmitStatus::OK == status)
+            continue;
+        if (SubmitStatus::SHUTDOWN == status) {
+            for (; i < fired.size(); i++)
+                fired[i]->cancel();
+            break;
+        }
+
+        // 任务队列满了，剩下的挂回时间轮，下一个 tick 再试
+        lock.lock();
+        for (; i < fired.size(); i++) {
+            detail::TimerJob* job = fired[i];
+            int expected = detail::TimerJob::QUEUED;
+            if (job->state_.compare_exchange_strong(expected, detail::TimerJob::PENDING))
+                timer_wheel_.insert(job, timer_wheel_.now());
+            else
+                job->release();     // 刚被取消了
+        }
+        update_next_timer();
+        lock.unlock();
+    }
+    fired.clear();
+}
+
+void ThreadPool::finish_timer(detail::TimerJob* job) {
+    if (job->period_ns_ > 0) {
+        std::unique_lock<std::mutex> lock(timer_mutx_);
+        int expected = detail::TimerJob::RUNNING;
+        if (is_pool_running_
+            && job->state_.compare_exchange_strong(expected, detail::TimerJob::PENDING)) {
+            uint64_t now = now_ns();
+            uint64_t period = job->period_ns_;
+            job->expire_ns_ += period;
+            if (job->expire_ns_ <= now)     // 执行得比周期还慢，跳过错过的那几次
+                job->expire_ns_ += ((now - job->expire_ns_) / period + 1) * period;
+
+            uint64_t tick = timer_tick_of(job->expire_ns_);
+            timer_wheel_.insert(job, tick);
+            bool earlier = tick * Timer_tick_ns < next_timer_ns_;
+            if (earlier)
+                next_timer_ns_ = tick * Timer_tick_ns;
+            lock.unlock();
+
+            if (earlier)
+                kick_timer_duty();
+            return;
+        }
+    }
+
+    int expected = detail::TimerJob::RUNNING;
+    job->state_.compare_exchange_strong(expected, detail::TimerJob::DONE);
+    job->release();
+}
+
+bool ThreadPool::cancel_timer(detail::TimerJob* job) {
+    std::lock_guard<std::mutex> lock(timer_mutx_);
+    int state = job->state_.load();
+    for (;;) {
+        switch (state) {
+        case detail::TimerJob::PENDING:
+            // 只有持有 timer_mutx_ 时才会离开 PENDING；最早的到期时间不用更新，早醒一次没关系
+            timer_wheel_.remove(job);
+            job->state_ = detail::TimerJob::CANCELLED;
+            job->release();     // 时间轮的那份引用
+            return true;
+        case detail::TimerJob::QUEUED:
+            // 已经在任务队列里了，执行时看到 CANCELLED 直接释放
+            if (job->state_.compare_exchange_weak(state, detail::TimerJob::CANCELLED))
+                return true;
+            break;
+        case detail::TimerJob::RUNNING:
+            // 一次性的正在执行，拦不住了；周期任务执行完不再挂回去
+            if (job->period_ns_ == 0)
+                return false;
+            if (job->state_.compare_exchange_weak(state, detail::TimerJob::CANCELLED))
+                return true;
+            break;
+        default:
+            return false;
+        }
+    }
+}
+
+void ThreadPool::kick_timer_duty() {
+    int duty = timer_duty_;
+    if (duty >= 0)
+        wake_slot(static_cast<std::size_t>(duty));
+    else if (sleep_thread_num_ > 0)
+        wake_parked(1);
+}
+
+void ThreadPool::update_next_timer() {
+    uint64_t tick = timer_wheel_.next_tick();
+    next_timer_ns_ = tick == TimerWheel::NEVER ? UINT64_MAX : tick * Timer_tick_ns;
+}
+
+void detail::TimerJob::run() {
+    int expected = QUEUED;
+    if (!state_.compare_exchange_strong(expected, RUNNING)) {
+        release();  // 已经取消了
+        return;
+    }
+
+    try {
+        invoke();
+    } catch (...) {
+        // 定时任务没有地方把异常交给用户，忽略
+    }
+    pool_->finish_timer(this);
+}
+
+void detail::TimerJob::cancel() {
+    state_ = CANCELLED;
+    release();
+}
+
+void detail::TimerJob::drop() {
+    int expected = QUEUED;
+    if (!state_.compare_exchange_strong(expected, RUNNING)) {
+        release();  // 已经取消了
+        return;
+    }
+    pool_->finish_timer(this);
+}
+
+bool TimerHandle::cancel() {
+    if (job_ == nullptr) return false;
+    return job_->pool_->cancel_timer(job_);
+}
+
 /*** 线程方法实现 **************************************/
 
 Thread::Thread(ThreadFunc func):
@@ -242,45 +1998,63 @@ Thread::Thread(ThreadFunc func):
     thread_id_(genert_id_++) // 线程池创建一个线程，就会构造一次
      {}
 
-Thread::~Thread() {}
+Thread::~Thread() {
+    join();
+}
 
 void Thread::start() {
     // To execute a thread func
     std::thread t(func_, thread_id_);   // 创建线程对象，去执行线程函数
-    t.detach();     // 分离线程，让线程函数自己去执行, (start一结束这个对象就没了)
+
+    // 绑定 CPU：失败（CPU 不存在、被 cgroup 限制）就不绑定
+    if (!placement_.cpus.empty()) {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        for (int cpu : placement_.cpus)
+            if (cpu >= 0 && cpu < CPU_SETSIZE)
+                CPU_SET(cpu, &set);
+        pthread_setaffinity_np(t.native_handle(), sizeof(set), &set);
+    }
+    thread_ = std::move(t);     // 不再 detach：线程池关闭时 join，保证线程函数返回之后才释放线程池
+}
+
+void Thread::join() {
+    if (thread_.joinable())
+        thread_.join();
 }
 
 int Thread::getId() const { return thread_id_; }
 
 int Thread::genert_id_ = 0;
 /*** Task方法实现 ******************************************/
-Task::Task() : result_(nullptr) {}
+Task::Task() {}
 
-void Task::set_result(Result* res) { // Result 构造时调用
-    result_ = res;
-}
+/*** Result方法实现 ****************************************/
+Result::Result(Future<Any> future, bool is_valid)
+    : future_(std::move(future)), is_valid_(is_valid) {} // submitTask时调用
 
-void Task::exec() {                  // 线程函数调用
-    if (result_ != nullptr)
-        result_->get_val(run()); // run() 发生多态调用
-}
+Any Result::get() {             // 用户调用
+    if (!is_valid_) return "";
 
-/*** Result方法实现 ****************************************/
-Result::Result(std::shared_ptr<Task> task, bool is_valid)
-    : task_(task), is_valid_(is_valid) { // submitTask时调用
-    
-    task_->set_result(this);
+    // task没执行完时会阻塞
+    return future_.get();
 }
 
-void Result::get_val(Any any) { // Task执行完调用
-    any_ = std::move(any);
-    sem_.post();
+/*** futex 实现 ********************************************/
+static_assert(sizeof(std::atomic<int>) == sizeof(int), "futex needs a plain int");
+
+void detail::futex_wait(std::atomic<int>* addr, int expected) {
+    syscall(SYS_futex, reinterpret_cast<int*>(addr), FUTEX_WAIT_PRIVATE, expected, nullptr, nullptr, 0);
 }
 
-Any Result::get() {             // 用户调用
-    if (!is_valid_) return "";
+void detail::futex_wake(std::atomic<int>* addr, int count) {
+    syscall(SYS_futex, reinterpret_cast<int*>(addr), FUTEX_WAKE_PRIVATE, count, nullptr, nullptr, 0);
+}
 
-    // task没执行完时会阻塞
-    sem_.wait();
-    return std::move(any_);
+bool detail::futex_wait_for(std::atomic<int>* addr, int expected, std::chrono::nanoseconds timeout) {
+    struct timespec ts;
+    ts.tv_sec = static_cast<time_t>(timeout.count() / 1000000000);
+    ts.tv_nsec = static_cast<long>(timeout.count() % 1000000000);
+    long ret = syscall(SYS_futex, reinterpret_cast<int*>(addr), FUTEX_WAIT_PRIVATE, expected, &ts, nullptr, 0);
+    return !(ret == -1 && errno == ETIMEDOUT);
 }
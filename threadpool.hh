@@ -1,15 +1,36 @@
 #pragma once
 
 #include <vector>
+#include <deque>
+#include <string>
 #include <unordered_map>
-#include <queue>
 #include <memory>
 #include <atomic>
 #include <mutex>
 #include <condition_variable>
 #include <functional>
+#include <optional>
+#include <tuple>
+#include <type_traits>
+#include <exception>
+#include <climits>
+#include <new>
+#include <chrono>
+#include <utility>
+#include <iterator>
+#include <thread>
+
+#include "wsdeque.hh"
+#include "mpmc_queue.hh"
+#include "stats.hh"
+#include "timer_wheel.hh"
+#include "block_pool.hh"
+#include "topology.hh"
+#include "cancel.hh"
+#include "profiler.hh"
 
 // Any类：接收任意类型的数据
+// 只能移动；数据从构造到 cast_ 一路移动（右值的话），只能移动的类型（unique_ptr 等）也可以放
 class Any {
 public:
     Any() = default;
@@ -19,28 +40,39 @@ public:
     Any(Any&&) = default;
     Any& operator=(Any&&) = default;
 
-    // 该 ctor 让 Any 接收任意类型的其它数据
-    template<typename T>
-    Any(T data) : base_(std::make_unique<Derive<T>>(data)) {}
+    // 该 ctor 让 Any 接收任意类型的其它数据：右值直接移进去，不拷贝
+    template<typename T, typename = std::enable_if_t<!std::is_same<std::decay_t<T>, Any>::value>>
+    Any(T&& data) : base_(std::make_unique<Derive<std::decay_t<T>>>(std::forward<T>(data))) {}
+
+    // 用 args 直接在 Any 里构造一个 T，e.g. Any(std::in_place_type<std::vector<int>>, 1024, 0)
+    template<typename T, typename... Args>
+    explicit Any(std::in_place_type_t<T>, Args&&... args)
+        : base_(std::make_unique<Derive<T>>(std::forward<Args>(args)...)) {}
+
+    // 换成用 args 构造的一个 T，返回它的引用
+    template<typename T, typename... Args>
+    T& emplace(Args&&... args) {
+        auto pd = std::make_unique<Derive<T>>(std::forward<Args>(args)...);
+        T& data = pd->data_;
+        base_ = std::move(pd);
+        return data;
+    }
     
-    // 该函数把 Any 对象存储的 data 提取出来
+    // 该函数把 Any 对象存储的 data 提取出来：左值的 Any 拷贝一份
     template <typename T>
-    T cast_() {
-        // 从 base_ 找到它指向的 Derive 类对象，从它里面取出 data 成员变量
-        // 基类指针 -> 派生类指针 RTTI
-        Derive<T> *pd = dynamic_cast<Derive<T>*>(base_.get());
-        
-        // 如果类型不对，抛出异常
-        if (pd == nullptr)
-            throw "type is unmatched!";
-        
-        // 类型对，用派生类指针调用派生类成员
-        return pd->data_;
+    T cast_() & {
+        return derive<T>()->data_;
+    }
+
+    // 右值的 Any（比如 res.get().cast_<T>()）把 data 移出来，只能移动的类型只能这样取
+    template <typename T>
+    T cast_() && {
+        return std::move(derive<T>()->data_);
     }
 
 private:
-    // 基类类型
-    class Base {
+    // 基类类型，从 BlockPool 分配
+    class Base : public PoolAllocated {
     public:
         virtual ~Base() = default;
     };
@@ -49,11 +81,24 @@ private:
     template<typename T>
     class Derive : public Base {
     public:
-        Derive(T data) : data_(data) {}
+        template<typename... Args>
+        explicit Derive(Args&&... args) : data_(std::forward<Args>(args)...) {}
         
         T data_;
     };
 
+    template <typename T>
+    Derive<T>* derive() {
+        // 从 base_ 找到它指向的 Derive 类对象，从它里面取出 data 成员变量
+        // 基类指针 -> 派生类指针 RTTI
+        Derive<T> *pd = dynamic_cast<Derive<T>*>(base_.get());
+        
+        // 如果类型不对，抛出异常
+        if (pd == nullptr)
+            throw "type is unmatched!";
+        return pd;
+    }
+
 private:
     // 定义一个基类指针
     std::unique_ptr<Base> base_;
@@ -87,23 +132,612 @@ private:
     std::condition_variable cond_;
 };
 
-class Task;
+class ThreadPool;
+class TimerHandle;
+class ScheduleAwaiter;
+template<typename R> class FutureAwaiter;
+class TaskGroup;
+
+namespace detail {
+
+// futex 封装：在 std::atomic<int> 上等待/唤醒（Linux），实现在 threadpool.cc
+void futex_wait(std::atomic<int>* addr, int expected);
+void futex_wake(std::atomic<int>* addr, int count);
+// 最多等待 timeout，超时返回 false（被唤醒或者值已经变了返回 true，可能是虚假唤醒）
+bool futex_wait_for(std::atomic<int>* addr, int expected, std::chrono::nanoseconds timeout);
+
+// f(args...) 的返回值类型
+template<typename F, typename... Args>
+using invoke_result_t = std::decay_t<std::invoke_result_t<std::decay_t<F>, std::decay_t<Args>...>>;
+
+// 线程池内部的调度单元，任务队列里只存它的裸指针
+class Job {
+public:
+    virtual ~Job() = default;
+
+    // 线程函数调用：执行任务，并释放队列持有的那份引用
+    virtual void run() = 0;
+    // 任务不会再被执行（比如提交失败）：释放队列持有的那份引用
+    virtual void cancel() = 0;
+    // 用户提交的任务才能被 RejectPolicy::DROP_OLDEST 挤出队列；线程池内部的调度单元
+    //（parallel_for 的区间、协程的恢复、strand、任务组的票）挤不掉，由挤它的提交者直接执行
+    virtual bool evictable() const { return false; }
+    // 被挤出队列：默认和取消一样
+    virtual void drop() { cancel(); }
+
+    uint64_t enqueue_ns_ = 0;   // 入队时间，用于统计排队延迟
+    std::atomic<Job*> strand_next_{nullptr};    // 在 strand 的队列里时 指向后面的任务（见 submit_keyed）
+};
+
+// 一组任务共享的完成计数，用于 Batch 的 wait_all / wait_any
+// 引用计数：Batch 一份，组里每个还没完成的任务各一份
+class CompletionGroup : public PoolAllocated {
+public:
+    explicit CompletionGroup(int refs) : refs_(refs), done_(0), waiters_(0) {}
+
+    // 组里的任务完成时调用（完成方）
+    void complete() {
+        done_.fetch_add(1, std::memory_order_acq_rel);
+        if (waiters_.load() > 0)
+            futex_wake(&done_, INT_MAX);
+        release();
+    }
+
+    int done() const { return done_.load(std::memory_order_acquire); }
+
+    // 等待完成数超过 seen
+    void wait_change(int seen) {
+        waiters_.fetch_add(1);
+        if (done_.load() == seen)
+            futex_wait(&done_, seen);
+        waiters_.fetch_sub(1);
+    }
+
+    void release() {
+        if (refs_.fetch_sub(1, std::memory_order_acq_rel) == 1)
+            delete this;
+    }
+
+private:
+    std::atomic<int> refs_;
+    std::atomic<int> done_;
+    std::atomic<int> waiters_;
+};
+
+class Dependent;
+class GroupTicket;
+class Strand;
+
+// 前驱的后继链表上的一个节点，嵌在后继任务里，一条依赖边一个
+struct Successor {
+    Dependent* dep;
+    Successor* next;
+};
+
+// 前驱完成时调用：链表上每个后继的依赖数减一，实现在 threadpool.cc
+void resolve_successors(Successor* list);
+
+class SharedStateBase;
+
+// 带取消令牌或者截止时间提交的任务才有，由任务对象持有
+// 执行 和 取消/过期 谁先把 claim 从 0 改掉谁说了算，任务只会完成一次
+struct TaskHook final : CancelHook, PoolAllocated {
+    SharedStateBase* job = nullptr;
+    CancelState* source = nullptr;  // 取消源（持有一份引用），没有令牌时为空
+    uint64_t deadline_ns = 0;       // steady_clock 的纳秒，0 表示没有截止时间
+    std::atomic<int> claim{0};      // 0: 还没开始  1: 开始执行了  2: 不执行了
+
+    // 实现在 threadpool.cc
+    void hold() override;
+    void fire() override;
+};
+
+// 正在执行的任务的 hook，ThreadPool::stop_requested() 用
+inline thread_local const TaskHook* cur_task_hook = nullptr;
+
+// 共享状态基类：引用计数 + 完成标志
+// 完成时如果有人在等才需要 futex_wake，没人等就只是一次原子写
+// 任务对象（TaskJob）从它继承，从 BlockPool 分配，稳定之后提交任务不调用 malloc
+class SharedStateBase : public PoolAllocated {
+public:
+    SharedStateBase() : refs_(2), state_(PENDING), successors_(nullptr) {} // 一份给 Future，一份给任务队列
+    virtual ~SharedStateBase() { if (hook_ != nullptr) drop_hook(); }
+
+    void add_ref() { refs_.fetch_add(1, std::memory_order_relaxed); }
+    void release() {
+        if (refs_.fetch_sub(1, std::memory_order_acq_rel) == 1)
+            delete this;
+    }
+
+    bool is_ready() const { return state_.load(std::memory_order_acquire) == READY; }
+
+    void wait() {
+        // 有截止时间：等到截止时间还没开始执行的，不用再等了
+        if (hook_ != nullptr && hook_->deadline_ns != 0)
+            wait_deadline();
+        // 线程池自己的线程在等：边等边执行别的任务，不占着线程干等
+        if (!is_ready() && help_wait())
+            return;
+        int s = state_.load(std::memory_order_acquire);
+        while (s != READY) {
+            // 先把状态改成 WAITING，告诉完成方需要唤醒
+            if (s == WAITING || state_.compare_exchange_weak(s, WAITING, std::memory_order_acquire))
+                futex_wait(&state_, WAITING);
+            s = state_.load(std::memory_order_acquire);
+        }
+    }
+
+    // 还没开始执行就带着错误 why 完成；已经开始执行、已经完成的返回 false（以下实现在 threadpool.cc）
+    bool abort(const char* why);
+
+    // 任务开始执行前调用（有 hook 时）：令牌已经取消、过了截止时间的 带着错误完成，返回 false
+    bool begin_run();
+
+    // 挂一个后继，已经完成（链表已经封上）时返回 false，由调用者自己把后继的依赖数减一
+    bool add_successor(Successor* node) {
+        Successor* head = successors_.load(std::memory_order_acquire);
+        do {
+            if (head == sealed())
+                return false;
+            node->next = head;
+        } while (!successors_.compare_exchange_weak(head, node, std::memory_order_release,
+                                                    std::memory_order_acquire));
+        return true;
+    }
+
+protected:
+    void set_ready() {
+        CompletionGroup* group = group_;  // set_ready 之后 this 可能被 Future 释放
+        if (state_.exchange(READY, std::memory_order_acq_rel) == WAITING)
+            futex_wake(&state_, INT_MAX);
+        // 先置 READY 再封链表：之后挂上来的后继直接就绪，执行时读到的一定是完成后的结果
+        Successor* list = successors_.exchange(sealed(), std::memory_order_acq_rel);
+        if (list != nullptr)
+            resolve_successors(list);
+        if (group != nullptr)
+            group->complete();
+    }
+
+    // 不执行了：释放任务捕获的资源
+    virtual void discard() {}
+
+    std::exception_ptr error_;  // 任务抛出的异常，get() 时重新抛出
+
+public:
+    CompletionGroup* group_ = nullptr;  // 所属的任务组，入队前设置
+    ThreadPool* pool_ = nullptr;        // 提交到的线程池，then() 的后继也提交到这里
+    TaskHook* hook_ = nullptr;          // 取消令牌和截止时间，入队前设置
+
+private:
+    enum { PENDING, WAITING, READY };
+
+    // 等到截止时间，还没完成就试着让它不执行
+    void wait_deadline();
+
+    // 当前线程是线程池的线程（并且开着 help_while_waiting）时 一边执行队列里的任务一边等完成
+    // 不是的话返回 false，由调用者自己等
+    bool help_wait();
+
+    // 从取消源上摘下来，释放 hook
+    void drop_hook();
+
+    // 完成之后后继链表的头换成这个标记
+    static Successor* sealed() { return reinterpret_cast<Successor*>(uintptr_t(1)); }
+
+    std::atomic<int> refs_;
+    std::atomic<int> state_;
+    std::atomic<Successor*> successors_;    // 等这个任务完成的后继，无锁栈
+};
+
+// 共享状态：返回值直接存放在状态对象内部，不再额外分配 Any::Derive
+template<typename R>
+class SharedState : public SharedStateBase {
+public:
+    ~SharedState() {
+        if (has_value_)
+            reinterpret_cast<R*>(&storage_)->~R();
+    }
+
+    R get() {
+        wait();
+        if (error_)
+            std::rethrow_exception(error_);
+        return std::move(*reinterpret_cast<R*>(&storage_));
+    }
+
+protected:
+    template<typename Fn>
+    void invoke(Fn& fn) {
+        try {
+            new (&storage_) R(fn());
+            has_value_ = true;
+        } catch (...) {
+            error_ = std::current_exception();
+        }
+        set_ready();
+    }
+
+private:
+    typename std::aligned_storage<sizeof(R), alignof(R)>::type storage_;
+    bool has_value_ = false;
+};
+
+template<>
+class SharedState<void> : public SharedStateBase {
+public:
+    void get() {
+        wait();
+        if (error_)
+            std::rethrow_exception(error_);
+    }
+
+protected:
+    template<typename Fn>
+    void invoke(Fn& fn) {
+        try {
+            fn();
+        } catch (...) {
+            error_ = std::current_exception();
+        }
+        set_ready();
+    }
+};
+
+// 任务 + 共享状态放在同一个对象里，一次提交只有一次堆分配
+template<typename R, typename Fn>
+class TaskJob : public SharedState<R>, public Job {
+public:
+    explicit TaskJob(Fn&& fn) : fn_(std::move(fn)) {}
+
+    bool evictable() const override { return true; }
+
+    void run() override {
+        if (this->hook_ != nullptr && !this->begin_run()) {
+            this->release();    // 已经取消或者过了截止时间，不执行
+            return;
+        }
+        const TaskHook* outer = cur_task_hook;
+        cur_task_hook = this->hook_;
+        this->invoke(*fn_);
+        cur_task_hook = outer;
+        fn_.reset();    // 执行完就释放任务捕获的资源，不用等 Future 析构
+        this->release();
+    }
+
+    void cancel() override {
+        this->abort("task is cancelled!");  // 已经被令牌取消、过期的 不会再完成一次
+        this->release();
+    }
+
+protected:
+    void discard() override { fn_.reset(); }
+
+private:
+    std::optional<Fn> fn_;
+};
+
+// 有前驱的任务：依赖数归零时才放进任务队列
+// 依赖数初始为 前驱数 + 1，多出来的一份在登记完所有前驱后减掉，登记期间不会提前就绪
+class Dependent {
+public:
+    virtual ~Dependent() = default;
+
+    // 一个前驱完成（或者登记结束）：依赖数减一，归零时交给线程池调度
+    // inline_ok: 由完成前驱的线程调用，可以留给它接着执行；实现在 threadpool.cc
+    void resolve(bool inline_ok);
+
+protected:
+    virtual Job* as_job() = 0;
+
+private:
+    friend class ::ThreadPool;
+
+    ThreadPool* dep_pool_ = nullptr;       // 就绪后交给这个线程池
+    std::atomic<int> deps_{1};
+    Successor inline_edges_[2];             // 挂在各个前驱上的节点，不超过两个前驱时不用另外分配
+    std::unique_ptr<Successor[]> edges_;
+};
+
+template<typename R, typename Fn>
+class DependentTaskJob : public TaskJob<R, Fn>, public Dependent {
+public:
+    explicit DependentTaskJob(Fn&& fn) : TaskJob<R, Fn>(std::move(fn)) {}
+
+protected:
+    Job* as_job() override { return this; }
+};
+
+// Future<R>::then(f) 的返回值类型：前驱有返回值时 f(R)，否则 f()
+template<typename F, typename R>
+struct then_result {
+    using type = invoke_result_t<F, R>;
+};
+
+template<typename F>
+struct then_result<F, void> {
+    using type = invoke_result_t<F>;
+};
+
+template<typename F, typename R>
+using then_result_t = typename then_result<F, R>::type;
+
+// 定时任务：挂在线程池的时间轮上，到期后自己作为 Job 放进任务队列，周期任务执行完再挂回去
+// 引用计数：时间轮/任务队列 一份，TimerHandle 一份
+class TimerJob : public Job, public TimerWheel::Node {
+public:
+    enum State { PENDING, QUEUED, RUNNING, DONE, CANCELLED };
+
+    TimerJob(ThreadPool* pool, uint64_t period_ns)
+        : pool_(pool), period_ns_(period_ns), expire_ns_(0), state_(PENDING), refs_(2) {}
+
+    void run() override;    // 实现在 threadpool.cc
+    void cancel() override;
+    bool evictable() const override { return true; }
+    void drop() override;   // 只跳过这一次，周期任务照常挂回去
+
+    void release() {
+        if (refs_.fetch_sub(1, std::memory_order_acq_rel) == 1)
+            delete this;
+    }
+
+protected:
+    virtual void invoke() = 0;
+
+private:
+    friend class ::ThreadPool;
+    friend class ::TimerHandle;
+
+    ThreadPool* pool_;
+    uint64_t period_ns_;            // 0 表示只执行一次
+    uint64_t expire_ns_;            // 下一次到期的时间，周期任务按它累加，不会漂移
+    std::atomic<int> state_;
+    std::atomic<int> refs_;
+};
+
+template<typename Fn>
+class TimerFnJob : public TimerJob {
+public:
+    TimerFnJob(ThreadPool* pool, uint64_t period_ns, Fn&& fn)
+        : TimerJob(pool, period_ns), fn_(std::move(fn)) {}
+
+protected:
+    void invoke() override { fn_(); }
+
+private:
+    Fn fn_;
+};
+
+} // namespace detail
+
+// 类型化的任务返回值，只能移动，get() 只能调用一次
+template<typename R>
+class Future {
+public:
+    Future() = default;
+    ~Future() { if (state_ != nullptr) state_->release(); }
+
+    Future(const Future&) = delete;
+    Future& operator=(const Future&) = delete;
+    Future(Future&& other) noexcept : state_(other.state_) { other.state_ = nullptr; }
+    Future& operator=(Future&& other) noexcept {
+        if (this != &other) {
+            if (state_ != nullptr) state_->release();
+            state_ = other.state_;
+            other.state_ = nullptr;
+        }
+        return *this;
+    }
+
+    // 提交失败时返回的 Future 是无效的
+    bool valid() const { return state_ != nullptr; }
+    bool is_ready() const { return state_ != nullptr && state_->is_ready(); }
+
+    // 阻塞等待任务执行完
+    void wait() const {
+        if (state_ == nullptr)
+            throw "future is invalid!";
+        state_->wait();
+    }
+
+    // 获取返回值（任务抛出的异常会在这里重新抛出），之后 Future 变为无效
+    R get() {
+        if (state_ == nullptr)
+            throw "future is invalid!";
+        Future holder(std::move(*this)); // 出作用域时释放共享状态
+        return holder.state_->get();
+    }
+
+    /**
+     * 接一个后继：这个任务完成后 f(结果) 提交到同一个线程池（R 为 void 时调用 f()），之后 Future 变为无效
+     * 不阻塞任何线程；完成前驱的线程会接着执行第一个就绪的后继
+     * 前驱抛出的异常不调用 f，直接传给后继的 Future
+     * e.g. Future<std::string> s = pool.submit(parse, text).then([](Ast ast) { return dump(ast); });
+     */
+    template<typename F>
+    auto then(F&& f) -> Future<detail::then_result_t<F, R>>;
+
+private:
+    friend class ThreadPool;
+    friend class Dependency;
+    template<typename> friend class FutureAwaiter;
+    friend class TaskGroup;
+    explicit Future(detail::SharedState<R>* state) : state_(state) {}
+
+    detail::SharedState<R>* state_ = nullptr;
+};
+
+// submit_after 的前驱：任意类型的 Future 都可以隐式转换过来，只在登记时用一下，不持有引用
+class Dependency {
+public:
+    template<typename R>
+    Dependency(const Future<R>& future) : state_(future.state_) {
+        if (state_ == nullptr)
+            throw "future is invalid!";
+    }
+
+private:
+    friend class ThreadPool;
+    detail::SharedStateBase* state_;
+};
+
+// submitBatch 返回的一组 Future，可以一起等待
+template<typename R>
+class Batch {
+public:
+    Batch() = default;
+    ~Batch() { if (group_ != nullptr) group_->release(); }
+
+    Batch(const Batch&) = delete;
+    Batch& operator=(const Batch&) = delete;
+    Batch(Batch&& other) noexcept
+        : futures_(std::move(other.futures_)), group_(other.group_) { other.group_ = nullptr; }
+    Batch& operator=(Batch&& other) noexcept {
+        if (this != &other) {
+            if (group_ != nullptr) group_->release();
+            futures_ = std::move(other.futures_);
+            group_ = other.group_;
+            other.group_ = nullptr;
+        }
+        return *this;
+    }
+
+    std::size_t size() const { return futures_.size(); }
+    Future<R>& operator[](std::size_t i) { return futures_[i]; }
+
+    // 已经完成的任务数
+    std::size_t done() const { return group_ == nullptr ? 0 : group_->done(); }
+
+    // 等待所有任务完成
+    void wait_all() {
+        if (group_ == nullptr) return;
+        for (int seen = group_->done(); seen < static_cast<int>(futures_.size()); seen = group_->done())
+            group_->wait_change(seen);
+    }
+
+    // 等待任意一个任务完成，返回它的下标（结果已经 get 过的不算）
+    // 没有剩下的任务时返回 size()
+    std::size_t wait_any() {
+        for (;;) {
+            int seen = group_ == nullptr ? 0 : group_->done();
+            bool pending = false;
+            for (std::size_t i = 0; i < futures_.size(); i++) {
+                if (futures_[i].is_ready())
+                    return i;
+                pending = pending || futures_[i].valid();
+            }
+            if (!pending)
+                return futures_.size();
+            group_->wait_change(seen);
+        }
+    }
+
+    // 按提交顺序取出所有结果
+    template<typename T = R, typename = std::enable_if_t<!std::is_void<T>::value>>
+    std::vector<T> get_all() {
+        std::vector<T> results;
+        results.reserve(futures_.size());
+        for (auto& fut : futures_)
+            results.push_back(fut.get());
+        return results;
+    }
+
+private:
+    friend class ThreadPool;
+
+    std::vector<Future<R>> futures_;
+    detail::CompletionGroup* group_ = nullptr;
+};
+
 // 实现接收 提交到线程池的task执行完后的 返回值类型 Result
+// 现在只是 Future<Any> 的一层适配
 class Result {
 public:
-    Result(std::shared_ptr<Task> task, bool is_valid = true);
+    Result(Future<Any> future, bool is_valid = true);
     ~Result() = default;
+    Result(Result&&) = default;
+    Result& operator=(Result&&) = default;
 
-    // Q1 - get_val方法，获取 task 执行完的返回值
-    void get_val(Any any);
-    // Q2 - get方法，用户调用这个方法获取 task 的返回值
+    // get方法，用户调用这个方法获取 task 的返回值
     Any get();
 
 private:
-    Any any_;       // 存储任务的返回值
-    Semaphore sem_; // 线程通信信号量
-    std::shared_ptr<Task> task_; // 指向获取返回值的task对象
-    std::atomic_bool is_valid_;  // 返回值是否有效
+    friend class ResultAwaiter;
+    Future<Any> future_; // 存储任务的返回值
+    bool is_valid_;      // 返回值是否有效
+};
+
+// schedule_after / schedule_every 返回的句柄，只能移动
+// 句柄析构不会取消定时任务；线程池析构之后 句柄只能析构，不能再 cancel
+class TimerHandle {
+public:
+    TimerHandle() = default;
+    ~TimerHandle() { if (job_) job_->release(); }
+    TimerHandle(TimerHandle&& other) noexcept : job_(other.job_) { other.job_ = nullptr; }
+    TimerHandle& operator=(TimerHandle&& other) noexcept {
+        if (this != &other) {
+            if (job_) job_->release();
+            job_ = other.job_;
+            other.job_ = nullptr;
+        }
+        return *this;
+    }
+    TimerHandle(const TimerHandle&) = delete;
+    TimerHandle& operator=(const TimerHandle&) = delete;
+
+    bool valid() const { return job_ != nullptr; }
+
+    // 取消定时任务：还没执行的不再执行，周期任务之后不再执行（正在执行的这一次不受影响）
+    // 确实阻止了至少一次执行返回 true，已经执行完或者已经取消过返回 false
+    bool cancel();
+
+private:
+    friend class ThreadPool;
+    explicit TimerHandle(detail::TimerJob* job) : job_(job) {}
+
+    detail::TimerJob* job_ = nullptr;
+};
+
+/**
+ * shutdown(CANCEL_PENDING / IMMEDIATE) 从任务队列里取出来、还没开始执行的任务，只能移动
+ * 句柄析构时取消任务（Future 得到 "task is cancelled!" 异常），也可以 run() 在当前线程执行
+ * 要在线程池析构之前处理掉：parallel_for 拆出来的区间任务还引用着线程池
+ */
+class PendingTask {
+public:
+    PendingTask() = default;
+    ~PendingTask() { cancel(); }
+    PendingTask(PendingTask&& other) noexcept : job_(other.job_) { other.job_ = nullptr; }
+    PendingTask& operator=(PendingTask&& other) noexcept {
+        if (this != &other) {
+            cancel();
+            job_ = other.job_;
+            other.job_ = nullptr;
+        }
+        return *this;
+    }
+    PendingTask(const PendingTask&) = delete;
+    PendingTask& operator=(const PendingTask&) = delete;
+
+    bool valid() const { return job_ != nullptr; }
+
+    // 在当前线程执行；它就绪的后继没有线程池可去，会被取消
+    void run() {
+        detail::Job* job = job_;
+        job_ = nullptr;
+        if (job) job->run();
+    }
+
+    void cancel() {
+        detail::Job* job = job_;
+        job_ = nullptr;
+        if (job) job->cancel();
+    }
+
+private:
+    friend class ThreadPool;
+    explicit PendingTask(detail::Job* job) : job_(job) {}
+
+    detail::Job* job_ = nullptr;
 };
 
 // 任务抽象基类
@@ -115,18 +749,62 @@ public:
     // 用户可以自定义任意任务类型，从Task继承，重写run方法, 实现自定义任务处理
     virtual Any run() = 0;
 
-    void set_result(Result *res);
-    void exec();
+protected:
+    // 在 run 里调用：提交时给的取消令牌已经取消，或者已经过了截止时间，应该尽早返回
+    bool stop_requested() const;
+};
 
-private:
-    // 不能放Result对象，因为它的生命周期要  > task
-    Result *result_; // 不能用智能指针，会导致交叉引用
+// 提交任务的结果
+enum class SubmitStatus {
+    OK,         // 提交成功
+    QUEUE_FULL, // 任务队列已满（try_submit 不等待）
+    TIMEOUT,    // 等待任务队列空出位置超时（submit_for）
+    SHUTDOWN,   // 线程池正在关闭或者已经关闭
+};
+
+/**
+ * 任务队列满时 submit / submit_priority / submit_with / submitTask 怎么办
+ * try_submit、submit_for 自己指定了等多久，不受影响
+ * BLOCK        等队列空出位置（默认）：submit 一直等，submitTask 最多等 1s
+ * CALLER_RUNS  在提交者的线程上直接执行，执行完才返回
+ * DROP_OLDEST  把同一个队列里最早的任务挤出去（它的 Future 抛出 "task is cancelled!"），放入新任务
+ *              队头是线程池内部的任务（parallel_for 的区间、协程的恢复、submit_keyed、任务组）时不丢，由提交者执行掉
+ * FAIL         直接返回 QUEUE_FULL，Future / Result 无效
+ * 开启 setHelpWhileWaiting 时，线程池自己的线程等空位（BLOCK）时会帮忙执行队列里的任务
+ */
+enum class RejectPolicy {
+    BLOCK,
+    CALLER_RUNS,
+    DROP_OLDEST,
+    FAIL,
+};
+
+// submit_with / submitTask 的选项
+struct TaskOptions {
+    int priority = -1;      // ThreadPool::DEFAULT_PRIORITY
+    CancelToken token;      // 取消之后还没开始执行的任务不再执行
+    std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::time_point::max();  // 过了截止时间还没开始执行的不再执行
+};
+
+// create_group 的选项
+struct GroupOptions {
+    int max_concurrency = 0;        // 组里同时执行的任务数上限，0 表示不限
+    std::size_t max_queued = 0;     // 组的队列长度上限，0 表示不限
+    int weight = 1;                 // 按权重分线程的执行时间
 };
 
 // 线程池支持的模式
 enum class PoolMode {
     MODE_FIXED, // 固定数量的线程
     MODE_CACHED,// 线程数量可动态增长
+    MODE_STEAL, // 固定数量的线程，每个线程有自己的本地队列，空闲时窃取其它线程的任务
+};
+
+// 线程池怎么关闭，见 ThreadPool::shutdown
+enum class ShutdownMode {
+    DRAIN_ALL,      // 不再接受外部提交，队列里的任务（包括执行中的任务新提交的）全部执行完再 join
+    CANCEL_PENDING, // 队列里的任务取出来交给调用者，执行中的任务执行完再 join
+    IMMEDIATE,      // 和 CANCEL_PENDING 一样取出任务，但不等执行中的任务，马上返回（析构时再 join）
 };
 
 // 线程类
@@ -143,12 +821,31 @@ public:
     // start thread
     void start();
 
+    // 等线程函数返回，不能在线程自己里面调用
+    void join();
+
     int getId() const;
 
+    // 线程在线程池里的槽位：[0, 线程数上限) 内唯一，线程退出后可以复用
+    // MODE_STEAL 下也是本地队列的下标
+    void setSlot(std::size_t slot) { slot_ = slot; }
+    std::size_t getSlot() const { return slot_; }
+
+    // 绑定的 CPU 和所在的 NUMA 节点，start() 之前设置；绑定失败（比如 CPU 不存在）时照常运行，只是不绑定
+    void setPlacement(Placement placement) { placement_ = std::move(placement); }
+    const Placement& getPlacement() const { return placement_; }
+
+    // 只有线程自己写，其它线程只读
+    WorkerStats& stats() { return stats_; }
+
 private:
+    WorkerStats stats_; // 放在最前面，按 cache line 对齐
     ThreadFunc func_;
     static int genert_id_;
     int thread_id_; // 保存线程id
+    std::size_t slot_ = 0;
+    Placement placement_;
+    std::thread thread_;
 };
 
 /*
@@ -165,26 +862,287 @@ pool.submitTask(std::make_shared<MyTask>());
 
 */
 
+/**
+ * 任务组（租户）：由 ThreadPool::create_group 创建，归线程池所有，和线程池一起析构
+ * 每个组一个自己的队列，有自己的 并发上限、队列长度上限、权重，一个组把自己的队列排满也挤不到别的组
+ * 组之间按 亏空轮转（deficit round robin）分线程的执行时间：轮到一个组时给它 权重 x 200us 的额度，
+ * 按任务实际的执行时间扣，额度用完换下一个组；执行时间长的任务多的组，分到的任务数相应地少
+ * 任务队列里放的是可以互换的"票"，线程取到一张票时才按 DRR 决定执行哪个组的任务
+ */
+class TaskGroup {
+public:
+    TaskGroup(const TaskGroup&) = delete;
+    TaskGroup& operator=(const TaskGroup&) = delete;
+
+    const std::string& name() const { return name_; }
+
+    // 提交到这个组，组的队列满时一直等待；线程池已经关闭时返回无效的 Future
+    template<typename F, typename... Args>
+    auto submit(F&& f, Args&&... args) -> Future<detail::invoke_result_t<F, Args...>>;
+
+    // 组的队列满时不等待，直接返回 QUEUE_FULL（此时 Future 无效）
+    template<typename F, typename... Args>
+    auto try_submit(F&& f, Args&&... args)
+        -> std::pair<SubmitStatus, Future<detail::invoke_result_t<F, Args...>>>;
+
+    // 等组里提交的任务都执行完（不能在这个组的任务里调用）
+    void wait_all();
+
+    GroupStats stats() const;
+
+private:
+    friend class ThreadPool;
+
+    TaskGroup(ThreadPool* pool, const std::string& name, const GroupOptions& opts);
+
+    template<typename F, typename... Args>
+    auto submit_job(bool wait, F&& f, Args&&... args)
+        -> std::pair<SubmitStatus, Future<detail::invoke_result_t<F, Args...>>>;
+
+    // 放进组的队列，wait: 队列满时等待，否则返回 QUEUE_FULL（实现在 threadpool.cc）
+    SubmitStatus push(detail::Job* job, bool wait);
+
+    // 轮到这个组时给的额度（纳秒）
+    int64_t quantum() const;
+
+    ThreadPool* pool_;
+    std::string name_;
+    int max_running_;               // 不限时为 INT_MAX
+    std::size_t max_queued_;        // 不限时为 SIZE_MAX
+    int weight_;
+
+    // 以下受 pool_->group_mutx_ 保护
+    std::deque<detail::Job*> queue_;
+    int running_ = 0;
+    bool active_ = false;           // 在线程池的轮转表上（有任务排队、又没到并发上限）
+    int64_t deficit_ = 0;           // DRR 的额度，执行时间超了会欠着
+    int64_t cost_ns_;               // 单个任务执行时间的估计值，取任务时先按它扣额度
+    std::condition_variable space_cond_;    // 组的队列不满
+    std::condition_variable idle_cond_;     // 组里的任务都执行完了
+    GroupStats stats_;
+};
+
+/**
+ * 阻塞区：任务接下来要阻塞（读磁盘、等锁、sleep）时在栈上放一个，离开作用域时结束
+ * 线程池的线程进入阻塞区时，线程池临时补一个替补线程（线程总数不超过 setThreadThreshHold），
+ * 离开时线程多了一个，下一个回来取任务的线程退出（所有模式都是）；不是线程池的线程、嵌套的阻塞区什么也不做
+ * cached 模式下控制线程在阻塞期间因为排队太久加的线程不算替补，和平时一样空闲超时（setThreadIdleTimeout）才退出
+ * e.g.
+ *   Any run() {
+ *       std::string data;
+ *       {
+ *           BlockingRegion blocking;
+ *           data = read_file(path_);
+ *       }
+ *       return parse(data);
+ *   }
+ */
+class BlockingRegion {
+public:
+    BlockingRegion();   // 实现在 threadpool.cc
+    ~BlockingRegion();
+
+    BlockingRegion(const BlockingRegion&) = delete;
+    BlockingRegion& operator=(const BlockingRegion&) = delete;
+
+private:
+    ThreadPool* pool_;      // 不是线程池的线程、嵌套在外层的阻塞区里时为空
+    bool compensated_;      // 补了替补线程，离开时让一个线程退出
+};
+
 // 线程池类型
 class ThreadPool {
 public:
     ThreadPool();
+    // 等于 shutdown(ShutdownMode::DRAIN_ALL)；前提：最后一个持有者不能在线程池自己的线程里（任务里）析构它，否则 abort
     ~ThreadPool();
 
     // 设置线程池的工作模式
     void setMode(PoolMode mode);
 
-    // 设置任务队列上限阈值
+    // 设置任务队列上限阈值（向上取整到 2 的幂，启动前、队列为空时才能修改），默认 65536
+    // 队列是预先分配的环形数组，每个位置 16 字节，每个优先级、每个 NUMA 节点各一个
     void setTaskqueMaxThreshHold(int threshhold);
 
-    // 设置线程池cached模式下 线程的阈值（让用户设置：有的服务器内存大，有的小）
+    // 设置线程数的阈值（让用户设置：有的服务器内存大，有的小）
+    // cached 模式下加线程最多加到这里（默认 1024）；其它模式下阻塞区（BlockingRegion）的替补线程最多补到这里（默认初始线程数的 2 倍）
     void setThreadThreshHold(int threshhold);
+
+    // cached 模式下 多出来的线程（超过 start 时的初始线程数）空闲多久后退出，默认 60s
+    void setThreadIdleTimeout(std::chrono::milliseconds timeout);
+
+    // cached 模式下 排队时间的目标：平均排队时间超过它、并且还有任务在排队时才考虑加线程，默认 1ms
+    void setTargetQueueLatency(std::chrono::microseconds latency);
+
+    // 设置空闲线程睡眠前自旋等任务的次数（每次一条 pause 指令），0 表示不自旋直接睡眠
+    // 同时自旋的线程不超过 CPU 数的一半，单核机器上总是直接睡眠
+    void setSpinCount(int count);
+
+    // 设置任务队列满时的处理策略（见 RejectPolicy），默认 BLOCK
+    void setRejectPolicy(RejectPolicy policy);
+
+    /**
+     * 线程池自己的线程在 get() / wait() 上等待、在满的队列上等空位时 是否帮忙执行队列里的别的任务，默认关闭
+     * 开启后 任务只等自己提交的子任务（递归的 fork-join）时，线程数固定也不会死锁
+     * 帮忙执行的任务压在等待的任务上面，要等它返回，下面的任务才能接着执行：
+     * 它要是反过来等下面的任务（比如在任务里按拓扑序等前驱），或者要下面的任务持有的锁，就会死锁
+     */
+    void setHelpWhileWaiting(bool enable);
+
+    // 设置 submit_keyed 用的 strand 数量，默认 256；key 比 strand 多时 散列到同一个 strand 的 key 之间也是串行的
+    void setStrandCount(int count);
     
+    // 不指定优先级时使用中间那一级（levels / 2）
+    static constexpr int DEFAULT_PRIORITY = -1;
+
+    /**
+     * 设置优先级的级数（启动前、队列为空时才能修改，最多 16 级），0 是最高优先级
+     * 每一级一个任务队列（容量都是 taskque_max_threshhold_），线程按优先级从高到低取任务
+     * 防止饿死：每个线程每取 16 个任务，有一次从轮转的某一级开始找，每一级都能分到一份
+     * 只有 1 级（默认）时就是原来的单个 FIFO 队列
+     */
+    void setPriorityLevels(int levels);
+
     // 给线程池提交任务     用户调用该接口，传入任务对象，"生产任务"
-    Result submitTask(std::shared_ptr<Task> sptr);
+    // 任务队列满时按 RejectPolicy 处理：默认（BLOCK）最多等待1s，仍然没有空位则返回无效的 Result
+    Result submitTask(std::shared_ptr<Task> sptr, int priority = DEFAULT_PRIORITY);
+
+    // 同上，带优先级、取消令牌、截止时间（见 submit_with），Task::run 里用 stop_requested() 检查
+    Result submitTask(std::shared_ptr<Task> sptr, const TaskOptions& opts);
+
+    // 提交任意可调用对象和参数，返回值类型由 f(args...) 推导，任务队列满时按 RejectPolicy 处理（默认一直等待）
+    // e.g. Future<int> fut = pool.submit([](int a, int b) { return a + b; }, 1, 2);
+    template<typename F, typename... Args>
+    auto submit(F&& f, Args&&... args) -> Future<detail::invoke_result_t<F, Args...>>;
+
+    // 同 submit，指定优先级（超出范围的取最近的一级）
+    template<typename F, typename... Args>
+    auto submit_priority(int priority, F&& f, Args&&... args) -> Future<detail::invoke_result_t<F, Args...>>;
+
+    /**
+     * 带取消令牌、截止时间提交
+     * 线程取到任务时 令牌已经取消、或者已经过了截止时间，就直接跳过，
+     * Future 得到 "task is cancelled!" / "task deadline exceeded!"，不占用线程执行
+     * 令牌取消时还在排队的任务马上完成；在 get() 里等的线程到了截止时间，也会让还没开始的任务马上完成
+     * 已经开始执行的任务不会被打断，由任务自己用 ThreadPool::stop_requested()（或者令牌）检查
+     * e.g. auto fut = pool.submit_with({ThreadPool::DEFAULT_PRIORITY, src.token(), Clock::now() + 20ms}, handle, req);
+     */
+    template<typename F, typename... Args>
+    auto submit_with(const TaskOptions& opts, F&& f, Args&&... args) -> Future<detail::invoke_result_t<F, Args...>>;
+
+    /**
+     * 按 key 提交：同一个 key 的任务按提交顺序一个接一个执行，不会同时执行；不同的 key 照样并行
+     * key 按 std::hash 散列到固定数量的 strand（串行执行器，见 setStrandCount）上，strand 本身作为一个任务在线程池里排队，
+     * 取到它的线程连续执行它排着的一批任务（同一个 key 的数据还在这个线程的 cache 里），然后把它放回队尾
+     * 散列到同一个 strand 的不同 key 也是串行的；任务里不要等 同一个 strand 上排在后面的任务，会死锁
+     * 不受 RejectPolicy 影响：任务先在 strand 里排队，strand 进任务队列时队列满了，外部线程等空位，线程池的线程直接执行
+     * e.g. auto fut = pool.submit_keyed(account_id, apply, account_id, delta);
+     */
+    template<typename Key, typename F, typename... Args>
+    auto submit_keyed(const Key& key, F&& f, Args&&... args) -> Future<detail::invoke_result_t<F, Args...>>;
+
+    // 在任务里调用：当前任务的令牌已经取消、或者过了截止时间（不在线程池的任务里调用时返回 false）
+    static bool stop_requested();
+
+    // 协程里 co_await pool.schedule()：挂起，由线程池的线程接着执行；需要 C++20，定义在 coro.hh
+    ScheduleAwaiter schedule(int priority = DEFAULT_PRIORITY);
+
+    /**
+     * 创建一个任务组（见 TaskGroup），名字重复时抛出 "group already exists!"
+     * e.g. TaskGroup& tenant = pool.create_group("tenant-a", {4, 1000, 2});
+     *      auto fut = tenant.submit(handle, req);
+     */
+    TaskGroup& create_group(const std::string& name, const GroupOptions& opts = GroupOptions());
+
+    // 按名字找任务组，没有返回 nullptr
+    TaskGroup* find_group(const std::string& name);
+
+    /**
+     * 有前驱的任务（DAG）：deps 里的任务都完成后才放进任务队列，期间不占用任何线程
+     * 每个任务一个原子依赖计数，由完成最后一个前驱的线程入队；这个线程会接着执行第一个就绪的后继
+     * 前驱出错不影响后继执行，需要它的结果时在后继里 get()
+     * e.g. auto c = pool.submit_after({a, b}, [&] { merge(out_a, out_b); });
+     */
+    template<typename F, typename... Args>
+    auto submit_after(std::initializer_list<Dependency> deps, F&& f, Args&&... args)
+        -> Future<detail::invoke_result_t<F, Args...>>;
+
+    /**
+     * 批量提交：[first, last) 的元素是可调用对象（或 std::shared_ptr<Task>，结果为 Any）
+     * 一次预留任务队列的空位，全部入队后最多唤醒 min(N, 睡眠线程数) 个线程
+     * 任务队列放不下时，等消费者腾出位置再继续（和 submit 一样一直等待）
+     */
+    template<typename Iter>
+    auto submitBatch(Iter first, Iter last);
+
+    // 任务队列满时不等待，直接返回 QUEUE_FULL（此时 Future 无效）
+    template<typename F, typename... Args>
+    auto try_submit(F&& f, Args&&... args)
+        -> std::pair<SubmitStatus, Future<detail::invoke_result_t<F, Args...>>>;
+
+    // 任务队列满时最多等待 timeout，超时返回 TIMEOUT（此时 Future 无效）
+    template<typename Rep, typename Period, typename F, typename... Args>
+    auto submit_for(std::chrono::duration<Rep, Period> timeout, F&& f, Args&&... args)
+        -> std::pair<SubmitStatus, Future<detail::invoke_result_t<F, Args...>>>;
     
-    // 启动 线程池
-    void start(int initThreshSize=4);
+    /**
+     * 并行执行 fn(i)，i 取遍 [begin, end)，返回时全部执行完
+     * 惰性二分：每处理完 grain 个元素看一眼，有空闲线程才把剩下区间的后一半交给线程池，
+     * 否则继续就地处理，只有真正被拆出去的区间才会分配一个任务对象
+     * grain 为 0 时按区间长度和线程数自动选；fn 抛出的第一个异常会在这里重新抛出
+     * e.g. pool.parallel_for(0, n, [&](int i) { out[i] = in[i] * 2; });
+     */
+    template<typename Index, typename Fn>
+    void parallel_for(Index begin, Index end, Fn&& fn, Index grain = 0);
+
+    /**
+     * 并行归约：combine(...combine(identity, map(begin))..., map(end-1))
+     * 每个线程一个按 cache line 对齐的部分和，最后由调用者合并
+     * combine 需要满足结合律和交换律，identity 是它的单位元
+     * e.g. long sum = pool.parallel_reduce(1L, n + 1, 0L, [](long i) { return i; }, std::plus<long>());
+     */
+    template<typename Index, typename T, typename Map, typename Combine>
+    T parallel_reduce(Index begin, Index end, T identity, Map&& map, Combine&& combine, Index grain = 0);
+
+    /**
+     * 定时任务：delay 之后执行一次 f()，返回值被丢弃，抛出的异常被忽略
+     * 时间轮的精度是 1ms，不会提前执行；由空闲线程在等待任务时顺便推进，没有单独的定时器线程
+     * 所有线程都在执行很长的任务时，定时任务会等到有线程空下来
+     * 线程池析构时还没到期的定时任务直接丢弃
+     */
+    template<typename Rep, typename Period, typename F>
+    TimerHandle schedule_after(std::chrono::duration<Rep, Period> delay, F&& f);
+
+    // 周期任务：每隔 period 执行一次 f()（第一次在 period 之后），直到 cancel 或者线程池析构
+    // 按固定频率计算下一次的时间；执行得比周期还慢时，跳过错过的那几次
+    template<typename Rep, typename Period, typename F>
+    TimerHandle schedule_every(std::chrono::duration<Rep, Period> period, F&& f);
+
+    /**
+     * 启动 线程池
+     * affinity: 线程怎么绑 CPU（见 topology.hh），cached 模式下后来创建的线程按槽位用同样的规则
+     * 线程分布在多个 NUMA 节点上时，默认优先级的任务按提交者所在的节点放进该节点的队列，
+     * 线程先取本节点的，再取公共队列，最后才取其它节点的，唤醒时也优先叫醒本节点的线程
+     */
+    void start(int initThreshSize=4, AffinityPolicy affinity = AffinityPolicy());
+
+    // 当前线程所在的 NUMA 节点：线程池里绑定了节点的线程返回分到的节点，其它线程返回当前 CPU 所在的节点
+    static int current_node();
+
+    /**
+     * 关闭线程池，之后外部提交的任务返回 SubmitStatus::SHUTDOWN（Future 无效）
+     * DRAIN_ALL / CANCEL_PENDING 返回时所有线程都已经 join；IMMEDIATE 马上返回，析构或者再调用一次时 join
+     * 返回从队列里取出来、没有执行的任务，不处理的话随返回值析构时取消
+     * 关闭之后可以重新 start；不能在线程池自己的线程里调用（要等的就是它）
+     * 析构函数等于 shutdown(ShutdownMode::DRAIN_ALL)，但是不抛异常
+     */
+    std::vector<PendingTask> shutdown(ShutdownMode mode = ShutdownMode::DRAIN_ALL);
+
+    // 等到任务队列空了、所有线程都空闲为止（还没就绪的后继、没到期的定时任务不算），不能在线程池的线程里调用
+    void wait_idle();
+
+    // 线程池当前状态和每个线程的统计数据快照
+    PoolStats stats();
 
     // 防止对线程池本身copy
     ThreadPool(const ThreadPool&) = delete;
@@ -198,29 +1156,693 @@ private:
      */
     void threadFunc(int thread_id);
 
+    /**
+     * cached 模式下调整线程数的控制线程，每 10ms 采样一次 完成的任务数 和 排队时间，不在提交任务的路径上
+     * 有任务排队但一个都没完成（线程都阻塞了）：加线程，连续几次这样就每次加倍
+     * 平均排队时间超过目标：爬山法，上一次加的线程让吞吐涨了才接着加（步长加倍），
+     * 没涨说明瓶颈不在线程数，退回上一步（让多出来的空闲线程退出），过一会儿再试
+     * 线程数在 [初始线程数, thread_max_threshhold_] 之间；空闲太久的线程自己退出
+     */
+    void controlFunc();
+
+    // 创建并启动一个线程，线程数已到上限返回 false（需要持有 taskque_mutx_）
+    bool spawn_thread();
+
+    // 多出来的线程退出：线程数不少于初始线程数
+    // wanted 表示是应 spares_owed_ / retire_wanted_ 的要求退出（阻塞区结束、控制线程觉得多了），否则是 cached 模式下空闲太久
+    // 线程对象移到 exited_ 里，由控制线程、下一次进入阻塞区的线程 或者 shutdown join
+    bool retire_idle(int thread_id, uint64_t idle_since, bool wanted);
+
+    // join 已经退出的线程
+    void reap_exited();
+
+    // 丢弃时间轮上所有还没到期的定时任务
+    void drop_timers();
+
+    // join 所有线程，回收线程对象（线程池已经不在运行）
+    void join_workers();
+
+    // shutdown 的实现，不检查调用者是不是线程池自己的线程（析构函数用，不抛异常）
+    std::vector<PendingTask> stop(ShutdownMode mode);
+
+    // 把所有任务队列里的任务取出来
+    void drain_queues(std::vector<PendingTask>& out);
+
+    // 正在关闭：外部提交的都拒绝，CANCEL_PENDING / IMMEDIATE 时线程池内部提交的也拒绝
+    bool submit_rejected() const;
+
+    // 把 f(args...) 包装成 Job（TaskJob，submit_after 用 DependentTaskJob），
+    // 返回的任务对象持有两份引用：一份给 Future，一份给任务队列
+    template<template<typename, typename> class JobT = detail::TaskJob, typename F, typename... Args>
+    auto make_job(F&& f, Args&&... args);
+
+    // 把任务包装成 Job 放入任务队列，失败时任务不会被执行，Future 无效
+    // by_policy: 队列满时按 reject_policy_ 处理（timeout 只在 BLOCK 时有用）
+    template<typename F, typename... Args>
+    auto submit_job(std::chrono::nanoseconds timeout, bool by_policy, const TaskOptions& opts,
+                    F&& f, Args&&... args)
+        -> std::pair<SubmitStatus, Future<detail::invoke_result_t<F, Args...>>>;
+
+    // 有令牌或者截止时间时给任务挂上 hook，登记到取消源上（入队之前）
+    void attach_hook(detail::SharedStateBase* job, const TaskOptions& opts);
+
+    // Future<R>::then 的实现：prev 移进后继任务里，前驱完成后 get() 出结果交给 f
+    template<typename R, typename F>
+    auto then_job(Future<R> prev, F&& f) -> Future<detail::then_result_t<F, R>>;
+
+    // 把 job 挂到 deps 的每个前驱上，最后减掉登记时多占的那一份依赖
+    void add_dependencies(detail::Dependent* job, const Dependency* deps, std::size_t n);
+
+    /**
+     * 依赖数归零的任务：
+     * 完成前驱的线程（inline_ok）留一个给自己，当前任务执行完接着执行，前驱刚写的数据还在 cache 里
+     * 其余的放进任务队列；线程池自己的线程遇到队列满时不等，直接执行
+     */
+    void dispatch_ready(detail::Job* job, bool inline_ok);
+
+    // 协程用（coro.hh）：把恢复协程的任务放进任务队列，线程池已经关闭时返回 false
+    bool post_resume(detail::Job* job, int priority);
+
+    // 协程用：state 完成时由完成它的线程调度 job；已经完成了返回 false，由调用者直接接着执行
+    static bool resume_after(detail::SharedStateBase* state, detail::Dependent* job);
+
+    // 任务组多了一个可以执行的任务：往任务队列里放一张票
+    void issue_ticket();
+
+    // 执行一张票：按 DRR 挑一个组，执行它队头的任务；票比可执行的任务多时什么也不做
+    void run_group_task();
+
+    // submit_keyed 的实现：job 放进 hash 对应的 strand，strand 原来是空的就把它放进任务队列；线程池已经关闭返回 false
+    bool submit_strand(std::size_t hash, detail::Job* job);
+
+    // 按 DRR 挑一个组（需要持有 group_mutx_）
+    TaskGroup* pick_group();
+
+    // 组能不能执行任务变了：加入/移出轮转表（需要持有 group_mutx_）
+    void update_active(TaskGroup* group);
+
+    // 票被取消（线程池关闭）：取消所有组里还在排队的任务
+    void cancel_group_tasks();
+
+    // 把任务放入对应优先级的任务队列，队列满时最多等待 timeout（nanoseconds::max() 表示一直等）
+    // by_policy: 用户提交的任务，队列满时按 reject_policy_ 处理
+    SubmitStatus enqueue(detail::Job* job, std::chrono::nanoseconds timeout,
+                         int priority = DEFAULT_PRIORITY, bool by_policy = false);
+
+    // 把用户传的优先级换算成任务队列的下标
+    std::size_t priority_level(int priority) const;
+
+    // 按优先级从高到低 依次尝试 [from, to) 这几级任务队列
+    detail::Job* pop_levels(std::size_t from, std::size_t to);
+
+    // 多个节点时默认优先级的那一级：本节点的队列 -> 公共队列 -> 其它节点的队列
+    detail::Job* pop_nodes();
+
+    // 提交者所在的节点（这个节点上得有线程池的线程），不按节点分队列时返回 -1
+    int submit_node() const;
+
+    // 按 affinity_ 给新线程分配 CPU 和节点（需要持有 taskque_mutx_ 或者还没启动）
+    void assign_placement(Thread& thread);
+
+    // 批量入队，队列满时一直等待
+    void enqueue_bulk(detail::Job* const* jobs, std::size_t n);
+
+    // 入队之后：有线程睡眠时唤醒其中 n 个（有线程在自旋就少唤醒几个）
+    // node: 任务放进了哪个节点的队列，优先唤醒这个节点上的线程
+    void notify_not_empty(std::size_t n, int node = -1);
+
+    // 空闲线程睡眠前先自旋一会儿，期间有任务就取出来
+    detail::Job* spin_for_task(std::size_t local_idx, WorkerStats& stats);
+
+    // 把当前线程登记到睡眠栈上，在自己的 park 字上等待，最多等 timeout
+    // 被 wake_parked 唤醒返回 true，超时或者登记后发现有任务、线程池要退出 返回 false
+    // timer_duty: 负责定时任务的线程，最多睡到最早的定时任务到期
+    bool park(std::size_t slot, std::chrono::nanoseconds timeout, bool timer_duty = false);
+
+    // 从睡眠栈上取最多 n 个线程唤醒，返回唤醒的个数；node >= 0 时先挑这个节点上的线程
+    std::size_t wake_parked(std::size_t n, int node = -1);
+
+    // 取出一个任务后，如果有生产者阻塞在 not_full_ 上就通知它
+    void notify_not_full();
+
+    // 无锁取一个任务：MODE_STEAL本地队列 -> 公共队列 -> 窃取其它线程，没有任务返回 nullptr
+    // idle: 调用者是空闲的线程，取到任务就不再算空闲（在任务数减一之前，wait_idle 不会误判）
+    detail::Job* take_task(std::size_t local_idx, WorkerStats& stats, bool idle);
+
+    // 线程退出前把它的统计数据累加到 retired_ 里（需要持有 taskque_mutx_）
+    void retire_stats(Thread& thread);
+
+    // 分配/归还线程槽位（需要持有 taskque_mutx_）
+    std::size_t acquire_slot();
+    void release_slot(std::size_t slot);
+
+    // 当前线程的槽位，不是线程池的线程时返回 slot_num_（留给外部调用者）
+    std::size_t current_slot() const;
+
+    // 线程池内部的线程在等待时帮忙执行一个任务，没有任务或者不是线程池的线程返回 false
+    bool run_pending_task();
+
+    // 在线程池的线程上嵌套执行一个任务，以及它就绪的后继（耗时算在外层任务里）
+    void run_nested(detail::Job* task);
+
+    // 在提交者的线程上执行（CALLER_RUNS、DROP_OLDEST 挤不掉的内部任务）：线程池的线程用 run_nested
+    void run_in_caller(detail::Job* job);
+
+    // 当前线程进入阻塞区：补一个替补线程（留下一个等着退出的，或者新建一个），补上了返回 true
+    bool enter_blocking();
+
+    // 离开阻塞区：补过替补线程的 让一个线程退出
+    void leave_blocking(bool compensated);
+
+    // parallel_for/parallel_reduce 的共享状态，放在调用者的栈上
+    template<typename Index, typename Body>
+    struct RangeContext {
+        RangeContext(Body& body, Index grain) : body(body), grain(grain) {}
+
+        Body& body;                         // body(lo, hi, slot) 处理 [lo, hi)
+        Index grain;                        // 不再拆分的最小区间长度
+        std::atomic<int> pending{1};        // 还没处理完的区间数，根区间由调用者处理
+        std::atomic<int> done{0};           // pending 归零时置 1，调用者等在上面
+        std::atomic_bool failed{false};     // 出错后剩下的区间直接跳过
+        std::exception_ptr error;           // 第一个异常，由调用者重新抛出
+    };
+
+    // 拆分出去的区间
+    template<typename Ctx, typename Index>
+    class RangeJob : public detail::Job {
+    public:
+        RangeJob(ThreadPool* pool, Ctx* ctx, Index lo, Index hi)
+            : pool_(pool), ctx_(ctx), lo_(lo), hi_(hi) {}
+
+        void run() override {
+            ThreadPool* pool = pool_;
+            Ctx* ctx = ctx_;
+            Index lo = lo_, hi = hi_;
+            delete this;    // 先释放自己：区间处理完之后 ctx 随时可能失效
+            pool->run_range(*ctx, lo, hi);
+        }
+
+        void cancel() override {
+            ThreadPool* pool = pool_;
+            Ctx* ctx = ctx_;
+            delete this;
+            pool->fail_range(*ctx, std::make_exception_ptr("task is cancelled!"));
+            pool->finish_range(*ctx);
+        }
+
+    private:
+        ThreadPool* pool_;
+        Ctx* ctx_;
+        Index lo_, hi_;
+    };
+
+    // 拆分并处理 [lo, hi)，最后把 pending 减一
+    template<typename Ctx, typename Index>
+    void run_range(Ctx& ctx, Index lo, Index hi);
+
+    template<typename Ctx>
+    void fail_range(Ctx& ctx, std::exception_ptr error);
+
+    template<typename Ctx>
+    void finish_range(Ctx& ctx);
+
+    // 调用者处理根区间，等待所有拆出去的区间处理完
+    template<typename Index, typename Body>
+    void run_parallel(Index begin, Index end, Body& body, Index grain);
+
+    // 有空闲线程，而且它们还没有排队的任务可做：值得拆一半出去
+    bool range_split_wanted() const {
+        return idle_thread_num_.load(std::memory_order_relaxed)
+             > task_size_.load(std::memory_order_relaxed);
+    }
+
     // 检查 pool 的运行状态
     bool check_running_state() const;
 
+    friend class detail::TimerJob;
+    friend class detail::Dependent;
+    template<typename> friend class Future;
+    friend class TimerHandle;
+    friend class ScheduleAwaiter;
+    template<typename> friend class FutureAwaiter;
+    friend class TaskGroup;
+    friend class detail::GroupTicket;
+    friend class detail::SharedStateBase;
+    friend class BlockingRegion;
+    friend class detail::Strand;
+
+    // 把定时任务挂到时间轮上，delay_ns 之后到期
+    TimerHandle add_timer(detail::TimerJob* job, uint64_t delay_ns);
+
+    // 到期的定时任务放进任务队列；所有线程每次取任务前调用，没到期时只有一次 load
+    void poll_timers();
+
+    // 定时任务执行完：周期任务挂回时间轮，否则释放
+    void finish_timer(detail::TimerJob* job);
+
+    // TimerHandle::cancel
+    bool cancel_timer(detail::TimerJob* job);
+
+    // 最早到期的定时任务提前了：叫醒负责定时的线程（没有的话叫醒任意一个睡眠的线程）重新算等待时间
+    void kick_timer_duty();
+
+    // 唤醒指定槽位上睡眠的线程，它不在睡眠栈上时什么也不做
+    void wake_slot(std::size_t slot);
+
+    // 在持有 timer_mutx_ 时，按时间轮重新计算 next_timer_ns_
+    void update_next_timer();
+
 private:
     // std::vector<Thread*> threads_;                   // 线程列表
     // std::vector<std::unique_ptr<Thread>> threads_;   // 线程列表
     std::unordered_map<int, std::unique_ptr<Thread>> threads_; // 线程列表
+    std::vector<std::unique_ptr<Thread>> exited_;   // 已经退出、还没 join 的线程（cached 模式、阻塞区的替补线程）
     
     std::size_t init_thread_size_;      // 初始的线程数量
-    uint thread_max_threshhold_;         // cached模式下 线程阈值（资源不是无限的）
+    uint thread_max_threshhold_;         // 用户设置的线程阈值（资源不是无限的），0 表示没设置过
+    uint thread_limit_;                 // 实际的线程数上限，start() 时按模式和 thread_max_threshhold_ 确定
     std::atomic_uint cur_thread_size_;   // 记录线程池的实际线程数量
     std::atomic_uint idle_thread_num_;   // 记录空闲线程的数量
 
-    // 防止用户传递临时对象，用智能指针延长生命周期
-    std::queue<std::shared_ptr<Task>> taskque_; // 任务队列
-    std::atomic_uint task_size_;        // 任务数量
+    // 有界无锁队列，生产者和消费者都不需要抢锁；每个优先级一个，下标 0 优先级最高
+    std::vector<std::unique_ptr<MpmcQueue<detail::Job>>> taskques_; // 任务队列
+    std::atomic_uint task_size_;        // 任务数量（包括 MODE_STEAL 的本地队列）
     uint taskque_max_threshhold_;        // 任务队列数量上限阈值
+    std::size_t priority_levels_;       // 优先级的级数，即 taskques_.size()
+
+    // 任务队列本身无锁，这把锁只用来配合条件变量 让线程睡眠/唤醒，以及保护 threads_
+    // 剖析构建（THREADPOOL_PROFILE）里 两把锁换成记录等待/持有时间的 ProfiledMutex，见 profiler.hh
+#ifdef THREADPOOL_PROFILE
+    using QueueMutex = ProfiledMutex<ProfilePoint::QUEUE_LOCK_WAIT, ProfilePoint::QUEUE_LOCK_HOLD>;
+    using ParkMutex = ProfiledMutex<ProfilePoint::PARK_LOCK_WAIT, ProfilePoint::PARK_LOCK_HOLD>;
+    using QueueCondVar = std::condition_variable_any;
+#else
+    using QueueMutex = std::mutex;
+    using ParkMutex = std::mutex;
+    using QueueCondVar = std::condition_variable;
+#endif
+    QueueMutex taskque_mutx_;
+    QueueCondVar not_full_;             // 表示任务队列不满
+    std::atomic_uint blocked_producer_num_; // 等待在 not_full_ 上的生产者数量
+    QueueCondVar idle_cond_;            // wait_idle 等所有线程空闲
+    std::atomic_uint idle_waiters_;     // 等在 idle_cond_ 上的线程数量
+
+    // MODE_STEAL: 每个线程一个本地队列，taskques_ 作为外部提交的公共注入队列
+    // 有多个优先级时，只有默认优先级的内部提交进本地队列
+    // 本地队列归线程池所有，线程退出时其它线程可能还在窃取，不能随线程对象释放
+    std::vector<std::unique_ptr<WorkStealingDeque<detail::Job>>> local_ques_;
+
+    // 空闲线程先自旋再睡眠，每个线程在自己的 park 字上睡眠，唤醒时只叫醒需要的那几个
+    struct alignas(64) ParkSlot {
+        std::atomic<int> state{0};      // 0: 睡眠中  1: 被唤醒
+#ifdef THREADPOOL_PROFILE
+        std::atomic<uint64_t> wake_ns{0};   // 唤醒方置位的时间
+#endif
+    };
+    std::unique_ptr<ParkSlot[]> parks_; // 按槽位下标
+    std::vector<std::size_t> parked_;   // 睡眠栈（槽位下标），后睡的先醒，cache 更热
+    ParkMutex park_mutx_;               // 保护 parked_
+    std::atomic_uint sleep_thread_num_; // 睡眠栈上的线程数量
+    std::atomic_uint spinning_num_;     // 正在自旋等任务的线程数量
+    int spin_count_;                    // 睡眠前自旋的次数
+
+    // 任务队列满时的处理，以及线程池的线程等待任务时帮忙执行
+    RejectPolicy reject_policy_;
+    bool help_while_waiting_;
+    std::atomic<uint64_t> caller_runs_; // CALLER_RUNS 在提交者线程上执行的任务数
+    std::atomic<uint64_t> dropped_;     // DROP_OLDEST 挤掉的任务数
+    std::atomic<uint64_t> rejected_;    // FAIL 拒绝的任务数
+
+    // 定时任务：时间轮由取任务的线程推进；睡眠时最多一个线程负责定时（带超时睡眠），其它线程一直睡
+    std::mutex timer_mutx_;             // 保护 timer_wheel_
+    TimerWheel timer_wheel_;            // tick 为 1ms
+    std::atomic<uint64_t> next_timer_ns_;   // 最早需要推进时间轮的时间，没有定时任务时为 UINT64_MAX
+    std::atomic<int> timer_duty_;       // 负责定时的睡眠线程的槽位，没有为 -1
+
+    // 线程槽位：parallel_reduce 的部分和 和 MODE_STEAL 的本地队列按槽位下标存放
+    std::size_t slot_num_;              // 槽位总数，start() 时确定
+    std::vector<bool> slot_used_;       // 受 taskque_mutx_ 保护
+
+    // CPU 绑定和 NUMA 节点：node_count_ > 1 时默认优先级的任务按节点分队列，taskques_ 的那一级作为公共队列
+    AffinityPolicy affinity_;
+    const CpuTopology* topology_;       // start() 时确定
+    int node_count_;                    // 不绑定或者只有 1 个节点时为 1
+    std::vector<int> slot_node_;        // 每个槽位上的线程所在的节点，不绑定为 -1
+    std::vector<std::unique_ptr<MpmcQueue<detail::Job>>> node_ques_;    // 按节点编号
+    std::unique_ptr<std::atomic_int[]> node_threads_;                   // 每个节点上的线程数
 
-    std::mutex taskque_mutx_;           // 保证任务队列的线程安全
-    std::condition_variable not_full_;  // 表示任务队列不满
-    std::condition_variable not_empty_; // 表示任务队列不空
-    std::condition_variable exit_cond_; // 等待线程资源全部回收
+    // 已经退出的线程的统计数据（受 taskque_mutx_ 保护）
+    WorkerStatsSnapshot retired_stats_;
+    HistogramSnapshot retired_queue_latency_;
+    HistogramSnapshot retired_run_time_;
+
+    // cached 模式的控制线程
+    std::thread controller_;
+    std::mutex ctl_mutx_;
+    std::condition_variable ctl_cond_;  // 析构时叫醒控制线程
+    std::atomic_uint retire_wanted_;    // 控制线程希望退出的多余线程数，准备加线程时清零
+    std::atomic_uint spares_owed_;      // 阻塞区结束后还没退出的替补线程数，控制线程不清零（所有模式）
+    uint64_t idle_timeout_ns_;          // 多出来的线程空闲多久后退出
+    uint64_t target_latency_ns_;        // 排队时间的目标
+
+    // 任务组：组里的任务在组自己的队列里排队，任务队列里放的是可以互换的票（GroupTicket）
+    // 有任务排队、又没到并发上限的组 在轮转表上；票的数量不少于这些组可以执行的任务数
+    std::mutex group_mutx_;             // 保护 groups_、active_groups_ 和 所有组的队列、计数
+    std::vector<std::unique_ptr<TaskGroup>> groups_;
+    std::vector<TaskGroup*> active_groups_; // DRR 的轮转表
+    std::size_t drr_cursor_;            // 轮到 active_groups_ 的哪个组
+
+    // submit_keyed 的串行执行器，按 key 的 hash 取模
+    std::unique_ptr<detail::Strand[]> strands_;
+    std::size_t strand_num_;
+
+    // 阻塞区
+    std::atomic_uint blocked_num_;      // 正在阻塞区里的线程数
+    std::atomic<uint64_t> compensations_;   // 新建替补线程的次数
+
+    // 关闭
+    std::mutex shutdown_mutx_;          // shutdown 不能并发
+    std::atomic_bool stopping_;         // shutdown 开始了，拒绝外部提交
+    std::atomic_bool cancel_pending_;   // CANCEL_PENDING / IMMEDIATE：线程取到的任务直接取消
 
     PoolMode pool_mode_;                // 当前线程池的工作模式
     std::atomic_bool is_pool_running_;  // 表示线程池当前的启动状态
-};
\ No newline at end of file
+};
+
+template<typename F, typename... Args>
+auto ThreadPool::submit(F&& f, Args&&... args) -> Future<detail::invoke_result_t<F, Args...>> {
+    return submit_job(std::chrono::nanoseconds::max(), true, TaskOptions(),
+                      std::forward<F>(f), std::forward<Args>(args)...).second;
+}
+
+template<typename F, typename... Args>
+auto ThreadPool::submit_priority(int priority, F&& f, Args&&... args)
+    -> Future<detail::invoke_result_t<F, Args...>> {
+    TaskOptions opts;
+    opts.priority = priority;
+    return submit_job(std::chrono::nanoseconds::max(), true, opts,
+                      std::forward<F>(f), std::forward<Args>(args)...).second;
+}
+
+template<typename F, typename... Args>
+auto ThreadPool::submit_with(const TaskOptions& opts, F&& f, Args&&... args)
+    -> Future<detail::invoke_result_t<F, Args...>> {
+    return submit_job(std::chrono::nanoseconds::max(), true, opts,
+                      std::forward<F>(f), std::forward<Args>(args)...).second;
+}
+
+template<typename F, typename... Args>
+auto ThreadPool::try_submit(F&& f, Args&&... args)
+    -> std::pair<SubmitStatus, Future<detail::invoke_result_t<F, Args...>>> {
+    return submit_job(std::chrono::nanoseconds::zero(), false, TaskOptions(),
+                      std::forward<F>(f), std::forward<Args>(args)...);
+}
+
+template<typename Rep, typename Period, typename F, typename... Args>
+auto ThreadPool::submit_for(std::chrono::duration<Rep, Period> timeout, F&& f, Args&&... args)
+    -> std::pair<SubmitStatus, Future<detail::invoke_result_t<F, Args...>>> {
+    return submit_job(std::chrono::duration_cast<std::chrono::nanoseconds>(timeout), false, TaskOptions(),
+                      std::forward<F>(f), std::forward<Args>(args)...);
+}
+
+template<template<typename, typename> class JobT, typename F, typename... Args>
+auto ThreadPool::make_job(F&& f, Args&&... args) {
+    using R = detail::invoke_result_t<F, Args...>;
+
+    // 参数按值打包进任务对象（C++17 的 lambda 不能直接捕获参数包）
+    auto fn = [func = std::forward<F>(f),
+               params = std::make_tuple(std::forward<Args>(args)...)]() mutable -> R {
+        return std::apply(func, std::move(params));
+    };
+
+    auto job = new JobT<R, decltype(fn)>(std::move(fn));
+    job->pool_ = this;
+    return job;
+}
+
+template<typename F, typename... Args>
+auto ThreadPool::submit_job(std::chrono::nanoseconds timeout, bool by_policy, const TaskOptions& opts,
+                            F&& f, Args&&... args)
+    -> std::pair<SubmitStatus, Future<detail::invoke_result_t<F, Args...>>> {
+    using R = detail::invoke_result_t<F, Args...>;
+
+    auto job = make_job(std::forward<F>(f), std::forward<Args>(args)...);
+    if (opts.token.can_be_cancelled() || opts.deadline != std::chrono::steady_clock::time_point::max())
+        attach_hook(job, opts);
+    SubmitStatus status = enqueue(job, timeout, opts.priority, by_policy);
+    if (status != SubmitStatus::OK) {
+        job->cancel();  // 释放队列的引用
+        job->release(); // 释放 Future 的引用
+        return {status, Future<R>()};
+    }
+    return {status, Future<R>(job)};
+}
+
+template<typename Key, typename F, typename... Args>
+auto ThreadPool::submit_keyed(const Key& key, F&& f, Args&&... args) -> Future<detail::invoke_result_t<F, Args...>> {
+    using R = detail::invoke_result_t<F, Args...>;
+
+    auto job = make_job(std::forward<F>(f), std::forward<Args>(args)...);
+    if (!submit_strand(std::hash<Key>()(key), job)) {
+        job->cancel();  // 释放队列的引用
+        job->release(); // 释放 Future 的引用
+        return Future<R>();
+    }
+    return Future<R>(job);
+}
+
+template<typename F, typename... Args>
+auto TaskGroup::submit(F&& f, Args&&... args) -> Future<detail::invoke_result_t<F, Args...>> {
+    return submit_job(true, std::forward<F>(f), std::forward<Args>(args)...).second;
+}
+
+template<typename F, typename... Args>
+auto TaskGroup::try_submit(F&& f, Args&&... args)
+    -> std::pair<SubmitStatus, Future<detail::invoke_result_t<F, Args...>>> {
+    return submit_job(false, std::forward<F>(f), std::forward<Args>(args)...);
+}
+
+template<typename F, typename... Args>
+auto TaskGroup::submit_job(bool wait, F&& f, Args&&... args)
+    -> std::pair<SubmitStatus, Future<detail::invoke_result_t<F, Args...>>> {
+    using R = detail::invoke_result_t<F, Args...>;
+
+    auto job = pool_->make_job(std::forward<F>(f), std::forward<Args>(args)...);
+    SubmitStatus status = push(job, wait);
+    if (status != SubmitStatus::OK) {
+        job->cancel();  // 释放队列的引用
+        job->release(); // 释放 Future 的引用
+        return {status, Future<R>()};
+    }
+    return {status, Future<R>(job)};
+}
+
+template<typename F, typename... Args>
+auto ThreadPool::submit_after(std::initializer_list<Dependency> deps, F&& f, Args&&... args)
+    -> Future<detail::invoke_result_t<F, Args...>> {
+    using R = detail::invoke_result_t<F, Args...>;
+
+    auto job = make_job<detail::DependentTaskJob>(std::forward<F>(f), std::forward<Args>(args)...);
+    Future<R> future(job);
+    add_dependencies(job, deps.begin(), deps.size());
+    return future;
+}
+
+template<typename R, typename F>
+auto ThreadPool::then_job(Future<R> prev, F&& f) -> Future<detail::then_result_t<F, R>> {
+    using R2 = detail::then_result_t<F, R>;
+
+    Dependency dep(prev);   // 只记下前驱的共享状态，prev 本身移进后继，保证它活到后继执行
+    auto fn = [prev = std::move(prev), func = std::forward<F>(f)]() mutable -> R2 {
+        // 前驱已经完成，get() 不会阻塞；前驱的异常从这里抛出，存进后继的共享状态
+        if constexpr (std::is_void<R>::value) {
+            prev.get();
+            return func();
+        } else {
+            return func(prev.get());
+        }
+    };
+
+    auto job = new detail::DependentTaskJob<R2, decltype(fn)>(std::move(fn));
+    job->pool_ = this;
+    Future<R2> future(job);
+    add_dependencies(job, &dep, 1);
+    return future;
+}
+
+template<typename R>
+template<typename F>
+auto Future<R>::then(F&& f) -> Future<detail::then_result_t<F, R>> {
+    if (state_ == nullptr)
+        throw "future is invalid!";
+    ThreadPool* pool = state_->pool_;
+    return pool->then_job(std::move(*this), std::forward<F>(f));
+}
+
+template<typename Iter>
+auto ThreadPool::submitBatch(Iter first, Iter last) {
+    using Elem = std::decay_t<decltype(*first)>;
+    constexpr bool is_task = std::is_convertible<Elem, std::shared_ptr<Task>>::value;
+
+    // 老的 Task 接口适配成可调用对象
+    auto make_fn = [](auto&& elem) {
+        if constexpr (is_task) {
+            std::shared_ptr<Task> sptr = elem;
+            return [sptr]() -> Any { return sptr->run(); };
+        } else {
+            return Elem(std::forward<decltype(elem)>(elem));
+        }
+    };
+    using Fn = decltype(make_fn(*first));
+    using R = detail::invoke_result_t<Fn>;
+
+    Batch<R> batch;
+    std::vector<detail::Job*> jobs;
+    if constexpr (std::is_base_of<std::random_access_iterator_tag,
+                  typename std::iterator_traits<Iter>::iterator_category>::value) {
+        batch.futures_.reserve(last - first);
+        jobs.reserve(last - first);
+    }
+
+    for (; first != last; ++first) {
+        auto job = new detail::TaskJob<R, Fn>(make_fn(*first));
+        batch.futures_.emplace_back(Future<R>(job));
+        jobs.push_back(job);
+    }
+
+    // Batch 一份引用，每个任务一份
+    batch.group_ = new detail::CompletionGroup(static_cast<int>(jobs.size()) + 1);
+    for (auto& fut : batch.futures_) {
+        fut.state_->group_ = batch.group_;
+        fut.state_->pool_ = this;
+    }
+
+    enqueue_bulk(jobs.data(), jobs.size());
+    return batch;
+}
+
+template<typename Index, typename Fn>
+void ThreadPool::parallel_for(Index begin, Index end, Fn&& fn, Index grain) {
+    auto body = [&fn](Index lo, Index hi, std::size_t) {
+        for (Index i = lo; i < hi; ++i)
+            fn(i);
+    };
+    run_parallel(begin, end, body, grain);
+}
+
+template<typename Index, typename T, typename Map, typename Combine>
+T ThreadPool::parallel_reduce(Index begin, Index end, T identity, Map&& map, Combine&& combine, Index grain) {
+    // 每个槽位一个部分和，各占一条 cache line，最后一个留给调用者（不是线程池的线程时）
+    struct alignas(64) Partial {
+        std::optional<T> value;
+    };
+    std::vector<Partial> partials(slot_num_ + 1);
+
+    auto body = [&](Index lo, Index hi, std::size_t slot) {
+        T acc = identity;
+        for (Index i = lo; i < hi; ++i)
+            acc = combine(std::move(acc), map(i));
+        std::optional<T>& part = partials[slot].value;
+        if (part)
+            part = combine(std::move(*part), std::move(acc));
+        else
+            part.emplace(std::move(acc));
+    };
+    run_parallel(begin, end, body, grain);
+
+    T result = std::move(identity);
+    for (Partial& part : partials) {
+        if (part.value)
+            result = combine(std::move(result), std::move(*part.value));
+    }
+    return result;
+}
+
+template<typename Index, typename Body>
+void ThreadPool::run_parallel(Index begin, Index end, Body& body, Index grain) {
+    static_assert(std::is_integral<Index>::value, "parallel_for needs an integral index");
+    if (!(begin < end)) return;
+
+    if (grain <= 0) {
+        // 每个线程平均能分到 8 块左右，剩下的交给惰性拆分去平衡
+        Index parts = static_cast<Index>(8 * (slot_num_ + 1));
+        grain = (end - begin) / parts;
+        if (grain <= 0) grain = 1;
+    }
+
+    RangeContext<Index, Body> ctx(body, grain);
+    run_range(ctx, begin, end);
+
+    // 线程池内部调用时不能干等：拆出去的区间可能还排在队列里，而其它线程也在等
+    while (ctx.done.load(std::memory_order_acquire) == 0) {
+        if (run_pending_task())
+            continue;
+        if (current_slot() < slot_num_)
+            std::this_thread::yield();
+        else
+            detail::futex_wait(&ctx.done, 0);
+    }
+
+    if (ctx.error)
+        std::rethrow_exception(ctx.error);
+}
+
+template<typename Ctx, typename Index>
+void ThreadPool::run_range(Ctx& ctx, Index lo, Index hi) {
+    std::size_t slot = current_slot();
+    try {
+        while (lo < hi && !ctx.failed.load(std::memory_order_relaxed)) {
+            if (hi - lo > ctx.grain && range_split_wanted()) {
+                Index mid = lo + (hi - lo) / 2;
+                auto job = new RangeJob<Ctx, Index>(this, &ctx, mid, hi);
+                ctx.pending.fetch_add(1, std::memory_order_relaxed);
+                if (enqueue(job, std::chrono::nanoseconds::zero()) == SubmitStatus::OK) {
+                    hi = mid;
+                    continue;
+                }
+                // 任务队列满了，说明线程池不缺活干，不拆了
+                ctx.pending.fetch_sub(1, std::memory_order_relaxed);
+                delete job;
+            }
+
+            Index chunk_end = hi - lo > ctx.grain ? lo + ctx.grain : hi;
+            ctx.body(lo, chunk_end, slot);
+            lo = chunk_end;
+        }
+    } catch (...) {
+        fail_range(ctx, std::current_exception());
+    }
+    finish_range(ctx);
+}
+
+template<typename Ctx>
+void ThreadPool::fail_range(Ctx& ctx, std::exception_ptr error) {
+    if (!ctx.failed.exchange(true))
+        ctx.error = error;  // 只有第一个出错的区间写，调用者在 done 之后读
+}
+
+template<typename Ctx>
+void ThreadPool::finish_range(Ctx& ctx) {
+    if (ctx.pending.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+        // 置 done 之后调用者随时可能返回，之后只能用 ctx 的地址做唤醒，不能再读写它
+        ctx.done.store(1, std::memory_order_release);
+        detail::futex_wake(&ctx.done, INT_MAX);
+    }
+}
+
+template<typename Rep, typename Period, typename F>
+TimerHandle ThreadPool::schedule_after(std::chrono::duration<Rep, Period> delay, F&& f) {
+    using Fn = std::decay_t<F>;
+    auto delay_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(delay).count();
+    auto job = new detail::TimerFnJob<Fn>(this, 0, Fn(std::forward<F>(f)));
+    return add_timer(job, delay_ns > 0 ? static_cast<uint64_t>(delay_ns) : 0);
+}
+
+template<typename Rep, typename Period, typename F>
+TimerHandle ThreadPool::schedule_every(std::chrono::duration<Rep, Period> period, F&& f) {
+    using Fn = std::decay_t<F>;
+    auto period_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(period).count();
+    if (period_ns <= 0) period_ns = 1;
+    auto job = new detail::TimerFnJob<Fn>(this, static_cast<uint64_t>(period_ns), Fn(std::forward<F>(f)));
+    return add_timer(job, static_cast<uint64_t>(period_ns));
+}
@@ -0,0 +1,230 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+/**
+ * 分层时间轮
+ *
+ * 4 层，每层 256 个槽，第 L 层一个槽覆盖 256^L 个 tick，一共覆盖 2^32 个 tick，
+ * 更远的定时器先放在能放下的最远处，到那时再重新放一次
+ * 定时器按离当前时间的距离放在某一层，上层的槽到时间后整体往下层放（cascade），最后在第 0 层到期
+ *
+ * 插入、删除 O(1)：每个槽是一个带哨兵的双向链表，节点侵入式地嵌在定时器对象里
+ * 每层一个位图记录哪些槽非空，用来直接跳到下一个有事件的 tick，空闲很久之后推进也不用逐个 tick 走
+ *
+ * 不加锁，由使用者保护；节点的生命周期也由使用者负责
+ */
+class TimerWheel {
+public:
+    static constexpr int LEVELS = 4;
+    static constexpr int SLOT_BITS = 8;
+    static constexpr int SLOTS = 1 << SLOT_BITS;
+    static constexpr uint64_t NEVER = UINT64_MAX;
+
+    struct Node {
+        Node* prev = nullptr;
+        Node* next = nullptr;
+        uint64_t expire = 0;    // 到期的 tick
+        int slot = -1;          // 所在的槽 level * SLOTS + idx，不在时间轮上为 -1
+
+        bool linked() const { return slot >= 0; }
+    };
+
+    // now: 当前的 tick，之后 advance 传入的时间不能比它小
+    explicit TimerWheel(uint64_t now) : cur_(now), size_(0) {
+        for (Node& head : heads_)
+            head.prev = head.next = &head;
+        for (auto& level : bitmap_)
+            for (uint64_t& word : level)
+                word = 0;
+    }
+
+    TimerWheel(const TimerWheel&) = delete;
+    TimerWheel& operator=(const TimerWheel&) = delete;
+
+    std::size_t size() const { return size_; }
+
+    // 下一个还没处理的 tick
+    uint64_t now() const { return cur_; }
+
+    // expire 早于当前时间的，下一次 advance 时到期
+    void insert(Node* node, uint64_t expire) {
+        node->expire = expire;
+        link(node);
+        size_++;
+    }
+
+    void remove(Node* node) {
+        unlink(node);
+        size_--;
+    }
+
+    // 处理到 now（包括 now）为止的所有 tick，到期的节点从时间轮上摘下来交给 on_expire(Node*)
+    template<typename F>
+    void advance(uint64_t now, F&& on_expire) {
+        while (cur_ <= now) {
+            uint64_t t = next_tick();
+            if (t > now) {
+                cur_ = now + 1;
+                return;
+            }
+            cur_ = t;
+
+            // 先把上层到时间的槽往下放，要从高往低放：高层放下来的节点可能正好落在下一层这次要放的槽里
+            int top = 0;
+            while (top + 1 < LEVELS && (t & ((uint64_t(1) << ((top + 1) * SLOT_BITS)) - 1)) == 0)
+                top++;
+            for (int level = top; level >= 1; level--)
+                relink_slot(level * SLOTS + ((t >> (level * SLOT_BITS)) & (SLOTS - 1)));
+
+            Node list;
+            detach_slot(static_cast<int>(t & (SLOTS - 1)), list);
+            while (list.next != &list) {
+                Node* node = list.next;
+                remove_from(node);
+                if (node->expire > t) {
+                    link(node);     // 超出范围被放在远处的定时器，还没到期
+                    continue;
+                }
+                size_--;
+                on_expire(node);
+            }
+            cur_ = t + 1;
+        }
+    }
+
+    // 下一个需要处理的 tick（有定时器到期，或者有上层的槽要往下放），没有定时器时返回 NEVER
+    uint64_t next_tick() const {
+        uint64_t best = NEVER;
+        for (int level = 0; level < LEVELS; level++) {
+            int shift = level * SLOT_BITS;
+            unsigned from = static_cast<unsigned>((cur_ >> shift) & (SLOTS - 1));
+            int d = next_set(bitmap_[level], from);
+            if (d < 0) continue;
+
+            uint64_t t;
+            if (level == 0) {
+                t = cur_ + d;
+            } else {
+                // 和当前同一个槽：正好在这个槽的起点时还没往下放，否则是下一圈的，要接着往后找
+                if (d == 0 && (cur_ & ((uint64_t(1) << shift) - 1)) != 0) {
+                    int d2 = next_set(bitmap_[level], (from + 1) & (SLOTS - 1));
+                    d = d2 < 0 ? SLOTS : d2 + 1;
+                }
+                t = ((cur_ >> shift) + d) << shift;
+            }
+            if (t < best) best = t;
+        }
+        return best;
+    }
+
+    // 摘下所有节点交给 fn(Node*)
+    template<typename F>
+    void clear(F&& fn) {
+        for (int slot = 0; slot < LEVELS * SLOTS; slot++) {
+            Node list;
+            detach_slot(slot, list);
+            while (list.next != &list) {
+                Node* node = list.next;
+                remove_from(node);
+                size_--;
+                fn(node);
+            }
+        }
+    }
+
+private:
+    void link(Node* node) {
+        uint64_t e = node->expire < cur_ ? cur_ : node->expire;
+        uint64_t delta = e - cur_;
+
+        int level = 0;
+        while (level < LEVELS - 1 && delta >= (uint64_t(1) << ((level + 1) * SLOT_BITS)))
+            level++;
+        // 超出时间轮的范围，先放在最远处
+        if (delta >= (uint64_t(1) << (LEVELS * SLOT_BITS)))
+            e = cur_ + (uint64_t(1) << (LEVELS * SLOT_BITS)) - 1;
+
+        unsigned idx = static_cast<unsigned>((e >> (level * SLOT_BITS)) & (SLOTS - 1));
+        int slot = level * SLOTS + static_cast<int>(idx);
+        Node& head = heads_[slot];
+        node->prev = head.prev;
+        node->next = &head;
+        head.prev->next = node;
+        head.prev = node;
+        node->slot = slot;
+        bitmap_[level][idx / 64] |= uint64_t(1) << (idx % 64);
+    }
+
+    void unlink(Node* node) {
+        int slot = node->slot;
+        remove_from(node);
+        Node& head = heads_[slot];
+        if (head.next == &head)
+            clear_bit(slot);
+    }
+
+    // 从所在链表里摘下来，不管位图
+    static void remove_from(Node* node) {
+        node->prev->next = node->next;
+        node->next->prev = node->prev;
+        node->prev = node->next = nullptr;
+        node->slot = -1;
+    }
+
+    // 把整个槽的链表挪到 list 上（list 作为新的哨兵）
+    void detach_slot(int slot, Node& list) {
+        Node& head = heads_[slot];
+        if (head.next == &head) {
+            list.prev = list.next = &list;
+            return;
+        }
+        list.next = head.next;
+        list.prev = head.prev;
+        list.next->prev = &list;
+        list.prev->next = &list;
+        head.prev = head.next = &head;
+        clear_bit(slot);
+    }
+
+    // 上层的槽到时间了，按现在的距离重新放一遍
+    void relink_slot(int slot) {
+        Node list;
+        detach_slot(slot, list);
+        while (list.next != &list) {
+            Node* node = list.next;
+            remove_from(node);
+            link(node);
+        }
+    }
+
+    void clear_bit(int slot) {
+        int level = slot / SLOTS;
+        int idx = slot % SLOTS;
+        bitmap_[level][idx / 64] &= ~(uint64_t(1) << (idx % 64));
+    }
+
+    // 从 from 开始（循环）找第一个非空的槽，返回距离，全空返回 -1
+    static int next_set(const uint64_t (&bits)[SLOTS / 64], unsigned from) {
+        constexpr unsigned WORDS = SLOTS / 64;
+        for (unsigned k = 0; k <= WORDS; k++) {
+            unsigned w = (from / 64 + k) % WORDS;
+            uint64_t word = bits[w];
+            if (k == 0)
+                word &= ~uint64_t(0) << (from % 64);
+            else if (k == WORDS)
+                word &= (from % 64 == 0) ? 0 : ~(~uint64_t(0) << (from % 64));
+            if (word != 0) {
+                unsigned idx = w * 64 + __builtin_ctzll(word);
+                return static_cast<int>((idx - from) & (SLOTS - 1));
+            }
+        }
+        return -1;
+    }
+
+    uint64_t cur_;
+    std::size_t size_;
+    Node heads_[LEVELS * SLOTS];
+    uint64_t bitmap_[LEVELS][SLOTS / 64];
+};
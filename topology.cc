@@ -0,0 +1,205 @@
+#include "topology.hh"
+
+#include <algorithm>
+#include <fstream>
+#include <map>
+#include <tuple>
+
+#include <sched.h>
+#include <dirent.h>
+
+namespace {
+
+// 读文件的第一行，读不到返回空串
+std::string read_line(const std::string& path) {
+    std::ifstream in(path);
+    std::string line;
+    if (in)
+        std::getline(in, line);
+    return line;
+}
+
+int read_int(const std::string& path, int fallback) {
+    std::string line = read_line(path);
+    if (line.empty()) return fallback;
+    try {
+        return std::stoi(line);
+    } catch (...) {
+        return fallback;
+    }
+}
+
+// 目录下 prefix 后面跟数字的子目录的编号，比如 node0 node1
+std::vector<int> numbered_entries(const std::string& dir, const std::string& prefix) {
+    std::vector<int> ids;
+    DIR* d = opendir(dir.c_str());
+    if (d == nullptr) return ids;
+    while (dirent* e = readdir(d)) {
+        std::string name = e->d_name;
+        if (name.size() <= prefix.size() || name.compare(0, prefix.size(), prefix) != 0)
+            continue;
+        std::string num = name.substr(prefix.size());
+        if (std::all_of(num.begin(), num.end(), [](char c) { return c >= '0' && c <= '9'; }))
+            ids.push_back(std::stoi(num));
+    }
+    closedir(d);
+    std::sort(ids.begin(), ids.end());
+    return ids;
+}
+
+// 进程能用的 CPU
+std::vector<int> allowed_cpus() {
+    std::vector<int> cpus;
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    if (sched_getaffinity(0, sizeof(set), &set) == 0) {
+        for (int i = 0; i < CPU_SETSIZE; i++)
+            if (CPU_ISSET(i, &set))
+                cpus.push_back(i);
+    }
+    if (cpus.empty())
+        cpus.push_back(0);
+    return cpus;
+}
+
+} // namespace
+
+std::vector<int> CpuTopology::parse_cpulist(const std::string& text) {
+    std::vector<int> cpus;
+    std::size_t pos = 0;
+    while (pos < text.size()) {
+        std::size_t end = text.find(',', pos);
+        if (end == std::string::npos) end = text.size();
+        std::string item = text.substr(pos, end - pos);
+        pos = end + 1;
+
+        std::size_t dash = item.find('-');
+        try {
+            if (dash == std::string::npos) {
+                cpus.push_back(std::stoi(item));
+            } else {
+                int lo = std::stoi(item.substr(0, dash));
+                int hi = std::stoi(item.substr(dash + 1));
+                for (int i = lo; i <= hi; i++)
+                    cpus.push_back(i);
+            }
+        } catch (...) {
+            // 空项或者格式不对的项跳过
+        }
+    }
+    return cpus;
+}
+
+CpuTopology CpuTopology::from_sysfs(const std::string& root) {
+    CpuTopology topo;
+    std::map<int, int> node_of;     // CPU -> 节点
+
+    std::vector<int> nodes = numbered_entries(root + "/node", "node");
+    for (int node : nodes) {
+        for (int cpu : parse_cpulist(read_line(root + "/node/node" + std::to_string(node) + "/cpulist")))
+            node_of[cpu] = node;
+    }
+    // 没有 NUMA 信息：1 个节点，包含进程能用的所有 CPU
+    if (node_of.empty()) {
+        for (int cpu : allowed_cpus())
+            node_of[cpu] = 0;
+    }
+
+    int max_node = 0;
+    for (auto [id, node] : node_of) {
+        std::string dir = root + "/cpu/cpu" + std::to_string(id) + "/topology/";
+        Cpu cpu;
+        cpu.id = id;
+        cpu.node = node;
+        cpu.package = read_int(dir + "physical_package_id", 0);
+        cpu.core = read_int(dir + "core_id", id);
+        topo.cpus_.push_back(cpu);
+        max_node = std::max(max_node, node);
+    }
+    topo.node_count_ = max_node + 1;
+
+    topo.node_of_.assign(topo.cpus_.back().id + 1, 0);
+    for (const Cpu& cpu : topo.cpus_)
+        topo.node_of_[cpu.id] = cpu.node;
+    return topo;
+}
+
+const CpuTopology& CpuTopology::system() {
+    static const CpuTopology topo = from_sysfs();
+    return topo;
+}
+
+std::vector<int> CpuTopology::node_cpus(int node) const {
+    std::vector<int> cpus;
+    for (const Cpu& cpu : cpus_)
+        if (cpu.node == node)
+            cpus.push_back(cpu.id);
+    return cpus;
+}
+
+int CpuTopology::node_of_cpu(int cpu) const {
+    if (cpu < 0 || cpu >= static_cast<int>(node_of_.size())) return 0;
+    return node_of_[cpu];
+}
+
+Placement place_thread(const AffinityPolicy& policy, std::size_t slot) {
+    Placement placement;
+    if (policy.mode == AffinityMode::NONE) return placement;
+
+    const CpuTopology& topo = policy.topology != nullptr ? *policy.topology : CpuTopology::system();
+    std::vector<CpuTopology::Cpu> cpus = topo.cpus();
+
+    // 有 CPU 的节点
+    std::vector<int> nodes;
+    for (int node = 0; node < topo.node_count(); node++)
+        if (!topo.node_cpus(node).empty())
+            nodes.push_back(node);
+
+    switch (policy.mode) {
+    case AffinityMode::COMPACT: {
+        std::sort(cpus.begin(), cpus.end(), [](const CpuTopology::Cpu& a, const CpuTopology::Cpu& b) {
+            return std::make_tuple(a.node, a.package, a.core, a.id)
+                 < std::make_tuple(b.node, b.package, b.core, b.id);
+        });
+        const CpuTopology::Cpu& cpu = cpus[slot % cpus.size()];
+        placement.cpus = {cpu.id};
+        placement.node = cpu.node;
+        break;
+    }
+    case AffinityMode::SCATTER: {
+        // 节点内按 (是这个核上的第几个超线程, 封装, 核) 排序，先把不同的核占一遍
+        std::map<std::tuple<int, int, int>, int> seen;  // (节点, 封装, 核) -> 已经排到的超线程数
+        std::vector<std::vector<std::pair<int, int>>> per_node(topo.node_count());   // (超线程序号, CPU)
+        for (const CpuTopology::Cpu& cpu : cpus) {
+            int rank = seen[std::make_tuple(cpu.node, cpu.package, cpu.core)]++;
+            per_node[cpu.node].emplace_back(rank, cpu.id);
+        }
+        for (auto& list : per_node)
+            std::stable_sort(list.begin(), list.end(),
+                             [](const std::pair<int, int>& a, const std::pair<int, int>& b) { return a.first < b.first; });
+
+        // 线程轮流放到各个节点：第 slot 个线程是它所在节点的第 slot / 节点数 个
+        int node = nodes[slot % nodes.size()];
+        auto& list = per_node[node];
+        placement.cpus = {list[(slot / nodes.size()) % list.size()].second};
+        placement.node = node;
+        break;
+    }
+    case AffinityMode::CPU_LIST: {
+        if (policy.cpus.empty()) break;
+        int cpu = policy.cpus[slot % policy.cpus.size()];
+        placement.cpus = {cpu};
+        placement.node = topo.node_of_cpu(cpu);
+        break;
+    }
+    case AffinityMode::PER_NODE: {
+        int node = nodes[slot % nodes.size()];
+        placement.cpus = topo.node_cpus(node);
+        placement.node = node;
+        break;
+    }
+    default:
+        break;
+    }
+    return placement;
+}
@@ -0,0 +1,78 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+#include <utility>
+#include <vector>
+
+/**
+ * CPU 拓扑：每个 CPU 属于哪个 NUMA 节点、哪个物理封装、哪个核
+ *
+ * 从 sysfs 读（node/nodeN/cpulist 和 cpu/cpuN/topology 下的 core_id、physical_package_id），
+ * 没有 node 目录（内核没开 NUMA、容器里没挂 sysfs）时退化成 1 个节点，CPU 列表取进程能用的那些
+ * 可以指定 sysfs 的根目录，单节点的机器上也能用伪造的目录测试多节点的逻辑
+ */
+class CpuTopology {
+public:
+    struct Cpu {
+        int id;
+        int node;
+        int package;
+        int core;       // 封装内的核编号，同一个核上的超线程相同
+    };
+
+    // 本机的拓扑，第一次调用时读取
+    static const CpuTopology& system();
+
+    // 从 root（默认是 /sys/devices/system）读取
+    static CpuTopology from_sysfs(const std::string& root = "/sys/devices/system");
+
+    // 所有 CPU，按编号排序
+    const std::vector<Cpu>& cpus() const { return cpus_; }
+
+    // 节点数（节点编号在 [0, node_count()) 内，可能有空节点）
+    int node_count() const { return node_count_; }
+
+    // 节点上的 CPU 编号
+    std::vector<int> node_cpus(int node) const;
+
+    // CPU 所在的节点，不认识的 CPU 返回 0
+    int node_of_cpu(int cpu) const;
+
+    // 解析 "0-3,8,10-11" 这种 CPU 列表
+    static std::vector<int> parse_cpulist(const std::string& text);
+
+private:
+    std::vector<Cpu> cpus_;
+    std::vector<int> node_of_;  // 按 CPU 编号
+    int node_count_ = 1;
+};
+
+// 线程池的线程怎么绑 CPU
+enum class AffinityMode {
+    NONE,       // 不绑定，由操作系统调度（默认）
+    COMPACT,    // 挨着放：先占满一个节点的 CPU（同一个核的超线程相邻），再用下一个节点
+    SCATTER,    // 散开放：线程轮流放到各个节点，节点内先占不同的核
+    CPU_LIST,   // 第 i 个线程绑到 cpus[i % cpus.size()]
+    PER_NODE,   // 按节点分组：线程轮流分到各个节点，绑到整个节点的 CPU 上，节点内由操作系统调度
+};
+
+struct AffinityPolicy {
+    AffinityMode mode = AffinityMode::NONE;
+    std::vector<int> cpus;                  // CPU_LIST 用
+    const CpuTopology* topology = nullptr;  // 为空时用 CpuTopology::system()
+
+    static AffinityPolicy compact() { return {AffinityMode::COMPACT, {}, nullptr}; }
+    static AffinityPolicy scatter() { return {AffinityMode::SCATTER, {}, nullptr}; }
+    static AffinityPolicy per_node() { return {AffinityMode::PER_NODE, {}, nullptr}; }
+    static AffinityPolicy cpu_list(std::vector<int> cpus) { return {AffinityMode::CPU_LIST, std::move(cpus), nullptr}; }
+};
+
+// 一个线程的放置结果
+struct Placement {
+    std::vector<int> cpus;  // 绑定的 CPU 集合，空表示不绑定
+    int node = -1;          // 所在的节点，不绑定时为 -1
+};
+
+// 第 slot 个线程（线程槽位）的放置
+Placement place_thread(const AffinityPolicy& policy, std::size_t slot);
@@ -0,0 +1,199 @@
+#include "tracer.hh"
+
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <iomanip>
+#include <mutex>
+#include <vector>
+
+std::atomic_bool Tracer::enabled_(false);
+
+// 单个线程的环形缓冲区：只有所属线程写，dump 时其它线程读
+class TraceBuffer {
+public:
+    TraceBuffer(std::size_t capacity, int tid, const std::string& name)
+        : name(name), head_(0), tid_(tid) {
+        std::size_t cap = 1;
+        while (cap < capacity) cap <<= 1;
+        mask_ = cap - 1;
+        slots_.reset(new Slot[cap]);
+    }
+
+    void record(TraceEvent type, uint64_t id, uint64_t ts) {
+        uint64_t h = head_.load(std::memory_order_relaxed);
+        Slot& slot = slots_[h & mask_];
+        slot.ts.store(ts, std::memory_order_relaxed);
+        slot.id.store(id, std::memory_order_relaxed);
+        slot.type.store(static_cast<uint32_t>(type), std::memory_order_relaxed);
+        head_.store(h + 1, std::memory_order_release);
+    }
+
+    struct Event {
+        uint64_t ts;
+        uint64_t id;
+        TraceEvent type;
+    };
+
+    // 读出还没被覆盖的事件
+    std::vector<Event> snapshot() const {
+        std::vector<Event> events;
+        uint64_t cap = mask_ + 1;
+        uint64_t end = head_.load(std::memory_order_acquire);
+        uint64_t begin = end > cap ? end - cap : 0;
+        for (uint64_t i = begin; i < end; i++) {
+            const Slot& slot = slots_[i & mask_];
+            events.push_back({slot.ts.load(std::memory_order_relaxed),
+                              slot.id.load(std::memory_order_relaxed),
+                              static_cast<TraceEvent>(slot.type.load(std::memory_order_relaxed))});
+        }
+
+        // 读的过程中写线程又绕了一圈，被覆盖的那部分不可信
+        uint64_t now = head_.load(std::memory_order_acquire);
+        uint64_t valid = now > cap ? now - cap : 0;
+        if (valid > begin)
+            events.erase(events.begin(), events.begin() + std::min<uint64_t>(valid - begin, events.size()));
+        return events;
+    }
+
+    void clear() { head_.store(0, std::memory_order_relaxed); }
+
+    int tid() const { return tid_; }
+
+    std::string name;   // 线程名，受 registry 的锁保护
+
+private:
+    struct Slot {
+        std::atomic<uint64_t> ts;
+        std::atomic<uint64_t> id;
+        std::atomic<uint32_t> type;
+    };
+
+    std::unique_ptr<Slot[]> slots_;
+    uint64_t mask_;
+    std::atomic<uint64_t> head_;
+    int tid_;
+};
+
+namespace {
+
+// 所有线程的缓冲区，线程退出后缓冲区还保留着，直到进程结束
+struct Registry {
+    std::mutex mtx;
+    std::vector<std::unique_ptr<TraceBuffer>> buffers;
+    std::size_t capacity = 1 << 14;
+};
+
+Registry& registry() {
+    static Registry* reg = new Registry;  // 不析构，其它线程退出时可能还在用
+    return *reg;
+}
+
+thread_local TraceBuffer* tls_buffer = nullptr;
+thread_local std::string tls_name;
+
+uint64_t now_ns() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+const char* event_name(TraceEvent type) {
+    switch (type) {
+    case TraceEvent::ENQUEUE: return "enqueue";
+    case TraceEvent::DEQUEUE: return "dequeue";
+    case TraceEvent::START:   return "task";
+    case TraceEvent::FINISH:  return "task";
+    case TraceEvent::SPAWN:   return "spawn";
+    case TraceEvent::RETIRE:  return "retire";
+    }
+    return "?";
+}
+
+} // namespace
+
+TraceBuffer* Tracer::local_buffer() {
+    if (tls_buffer == nullptr) {
+        Registry& reg = registry();
+        std::lock_guard<std::mutex> lock(reg.mtx);
+        int tid = static_cast<int>(reg.buffers.size());
+        reg.buffers.emplace_back(new TraceBuffer(reg.capacity, tid, tls_name));
+        tls_buffer = reg.buffers.back().get();
+    }
+    return tls_buffer;
+}
+
+void Tracer::record(TraceEvent type, uint64_t id) {
+    local_buffer()->record(type, id, now_ns());
+}
+
+void Tracer::set_thread_name(const std::string& name) {
+    tls_name = name;
+    if (tls_buffer != nullptr) {
+        std::lock_guard<std::mutex> lock(registry().mtx);
+        tls_buffer->name = name;
+    }
+}
+
+void Tracer::set_buffer_capacity(std::size_t capacity) {
+    std::lock_guard<std::mutex> lock(registry().mtx);
+    registry().capacity = capacity;
+}
+
+void Tracer::clear() {
+    std::lock_guard<std::mutex> lock(registry().mtx);
+    for (auto& buf : registry().buffers)
+        buf->clear();
+}
+
+void Tracer::dump_chrome_json(std::ostream& os) {
+    Registry& reg = registry();
+    std::lock_guard<std::mutex> lock(reg.mtx);
+
+    // 下面要改进制和填充字符：先存下调用者的格式，结束时还原；调用者设过 hex 之类的也不影响输出
+    std::ios_base::fmtflags flags = os.flags();
+    char fill = os.fill();
+    os.flags(std::ios_base::dec);
+
+    os << "{\"traceEvents\":[\n";
+    bool first = true;
+    auto sep = [&]() { if (!first) os << ",\n"; first = false; };
+
+    for (auto& buf : reg.buffers) {
+        if (!buf->name.empty()) {
+            sep();
+            os << "{\"ph\":\"M\",\"pid\":1,\"tid\":" << buf->tid()
+               << ",\"name\":\"thread_name\",\"args\":{\"name\":\"" << buf->name << "\"}}";
+        }
+
+        for (const auto& ev : buf->snapshot()) {
+            sep();
+            // Chrome trace 的时间单位是微秒
+            os << "{\"pid\":1,\"tid\":" << buf->tid()
+               << ",\"ts\":" << ev.ts / 1000 << "." << std::setw(3) << std::setfill('0') << ev.ts % 1000
+               << ",\"name\":\"" << event_name(ev.type) << "\"";
+            switch (ev.type) {
+            case TraceEvent::START:
+                os << ",\"ph\":\"B\"";
+                break;
+            case TraceEvent::FINISH:
+                os << ",\"ph\":\"E\"";
+                break;
+            default:
+                os << ",\"ph\":\"i\",\"s\":\"t\"";
+                break;
+            }
+            os << ",\"args\":{\"id\":\"0x" << std::hex << ev.id << std::dec << "\"}}";
+        }
+    }
+    os << "\n]}\n";
+    os.flags(flags);
+    os.fill(fill);
+}
+
+bool Tracer::dump_chrome_json(const std::string& path) {
+    std::ofstream ofs(path);
+    if (!ofs)
+        return false;
+    dump_chrome_json(ofs);
+    return static_cast<bool>(ofs);
+}
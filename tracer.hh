@@ -0,0 +1,66 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <ostream>
+#include <string>
+
+/**
+ * 线程池事件追踪
+ *
+ * 每个线程一个无锁环形缓冲区（只有自己写），满了覆盖最旧的事件
+ * dump_chrome_json 输出 Chrome trace-event 格式，用 chrome://tracing 或 Perfetto 打开
+ *
+ * 编译期开关：定义 THREADPOOL_TRACE 才会在线程池里埋点（make TRACE=1），
+ * 否则 TP_TRACE 展开为空，取任务的路径上没有任何额外代码
+ * 运行期开关：Tracer::enable(true)，关闭时埋点只有一次 relaxed load
+ */
+
+enum class TraceEvent : uint32_t {
+    ENQUEUE,    // 任务入队
+    DEQUEUE,    // 线程取到任务
+    START,      // 开始执行任务
+    FINISH,     // 任务执行完
+    SPAWN,      // 创建线程
+    RETIRE,     // 线程退出
+};
+
+class TraceBuffer;
+
+class Tracer {
+public:
+    // 运行期开关
+    static void enable(bool on) { enabled_.store(on, std::memory_order_relaxed); }
+    static bool enabled() { return enabled_.load(std::memory_order_relaxed); }
+
+    // 记录一个事件到当前线程的缓冲区，id 一般是任务或线程的标识
+    static void record(TraceEvent type, uint64_t id);
+
+    // 给当前线程起个名字，显示在 trace 里
+    static void set_thread_name(const std::string& name);
+
+    // 每个线程缓冲区能保存的事件数（向上取整到 2 的幂），只影响之后新建的缓冲区
+    static void set_buffer_capacity(std::size_t capacity);
+
+    // 输出所有线程的事件，线程还在写时，被覆盖的事件会被丢掉
+    static void dump_chrome_json(std::ostream& os);
+    static bool dump_chrome_json(const std::string& path);
+
+    // 清空所有缓冲区里的事件
+    static void clear();
+
+private:
+    static TraceBuffer* local_buffer();
+
+    static std::atomic_bool enabled_;
+};
+
+#ifdef THREADPOOL_TRACE
+#define TP_TRACE(type, id) \
+    do { if (Tracer::enabled()) Tracer::record(TraceEvent::type, (uint64_t)(id)); } while (0)
+#define TP_TRACE_THREAD_NAME(name) Tracer::set_thread_name(name)
+#else
+#define TP_TRACE(type, id) ((void)0)
+#define TP_TRACE_THREAD_NAME(name) ((void)0)
+#endif
@@ -0,0 +1,132 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+/**
+ * Chase-Lev 工作窃取双端队列（参考 Lê et al. "Correct and Efficient Work-Stealing for Weak Memory Models"）
+ *
+ * 只有拥有者线程可以 push/pop（在 bottom 端，LIFO，数据在cache里是热的）
+ * 其它线程只能 steal（在 top 端，FIFO）
+ * 队列只保存指针，不负责对象的生命周期
+ */
+template<typename T>
+class WorkStealingDeque {
+public:
+    explicit WorkStealingDeque(std::size_t capacity = 256)
+        : top_(0), bottom_(0), array_(new Array(capacity)) {
+        garbage_.emplace_back(array_.load(std::memory_order_relaxed));
+    }
+    ~WorkStealingDeque() = default;
+
+    WorkStealingDeque(const WorkStealingDeque&) = delete;
+    WorkStealingDeque& operator=(const WorkStealingDeque&) = delete;
+
+    // 拥有者线程调用：把任务压入 bottom 端，满了就扩容
+    void push(T* item) {
+        int64_t b = bottom_.load(std::memory_order_relaxed);
+        int64_t t = top_.load(std::memory_order_acquire);
+        Array* a = array_.load(std::memory_order_relaxed);
+
+        if (b - t > static_cast<int64_t>(a->capacity()) - 1) {
+            // 旧数组不能马上释放，窃取者可能还在读它，等队列析构时统一释放
+            a = a->grow(t, b);
+            garbage_.emplace_back(a);
+            array_.store(a, std::memory_order_release);
+        }
+        a->put(b, item);
+        std::atomic_thread_fence(std::memory_order_release);
+        bottom_.store(b + 1, std::memory_order_relaxed);
+    }
+
+    // 拥有者线程调用：从 bottom 端取任务，队列为空返回 nullptr
+    T* pop() {
+        int64_t b = bottom_.load(std::memory_order_relaxed) - 1;
+        Array* a = array_.load(std::memory_order_relaxed);
+        bottom_.store(b, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        int64_t t = top_.load(std::memory_order_relaxed);
+
+        T* item = nullptr;
+        if (t <= b) {
+            item = a->get(b);
+            if (t == b) {
+                // 只剩最后一个任务，和窃取者竞争 top
+                if (!top_.compare_exchange_strong(t, t + 1,
+                        std::memory_order_seq_cst, std::memory_order_relaxed))
+                    item = nullptr;
+                bottom_.store(b + 1, std::memory_order_relaxed);
+            }
+        } else {
+            bottom_.store(b + 1, std::memory_order_relaxed);
+        }
+        return item;
+    }
+
+    // 任意线程调用：从 top 端窃取任务，队列为空或竞争失败返回 nullptr
+    T* steal() {
+        int64_t t = top_.load(std::memory_order_acquire);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        int64_t b = bottom_.load(std::memory_order_acquire);
+
+        if (t < b) {
+            Array* a = array_.load(std::memory_order_acquire);
+            T* item = a->get(t);
+            if (!top_.compare_exchange_strong(t, t + 1,
+                    std::memory_order_seq_cst, std::memory_order_relaxed))
+                return nullptr;
+            return item;
+        }
+        return nullptr;
+    }
+
+    bool empty() const {
+        int64_t b = bottom_.load(std::memory_order_relaxed);
+        int64_t t = top_.load(std::memory_order_relaxed);
+        return b <= t;
+    }
+
+private:
+    // 环形数组，容量总是 2 的幂
+    class Array {
+    public:
+        explicit Array(std::size_t capacity) {
+            cap_ = 1;
+            while (cap_ < capacity) cap_ <<= 1;
+            mask_ = cap_ - 1;
+            buf_.reset(new std::atomic<T*>[cap_]);
+        }
+
+        std::size_t capacity() const { return cap_; }
+
+        T* get(int64_t i) const {
+            return buf_[i & mask_].load(std::memory_order_relaxed);
+        }
+
+        void put(int64_t i, T* item) {
+            buf_[i & mask_].store(item, std::memory_order_relaxed);
+        }
+
+        Array* grow(int64_t t, int64_t b) const {
+            Array* a = new Array(cap_ * 2);
+            for (int64_t i = t; i < b; i++)
+                a->put(i, get(i));
+            return a;
+        }
+
+    private:
+        std::size_t cap_;
+        std::size_t mask_;
+        std::unique_ptr<std::atomic<T*>[]> buf_;
+    };
+
+private:
+    // top/bottom 分别被窃取者和拥有者频繁修改，放在不同的 cache line 上
+    alignas(64) std::atomic<int64_t> top_;
+    alignas(64) std::atomic<int64_t> bottom_;
+    alignas(64) std::atomic<Array*> array_;
+
+    std::vector<std::unique_ptr<Array>> garbage_; // 所有分配过的数组，只有拥有者线程访问
+};